@@ -4,96 +4,511 @@
  */
 
 #include "trace_data.hpp"
-#include <reshade.hpp>
+#include "trace_events.hpp"
 #include <vector>
+#include <memory>
+#include <utility>
+#include <type_traits>
 #include <unordered_map>
 #include <algorithm>
 #include <shared_mutex>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
 
 using namespace reshade::api;
 
-static std::unordered_map<uint64_t, sampler> s_samplers;
-static std::unordered_map<uint64_t, resource> s_resources;
-static std::unordered_map<uint64_t, resource_view> s_resource_views;
-static std::unordered_map<uint64_t, pipeline> s_pipelines;
-static std::unordered_map<uint64_t, pipeline_layout> s_pipeline_layouts;
+// Objects are referenced by sequential IDs in the trace, which index these arrays (the first element is the null handle)
+static std::vector<sampler> s_samplers(1);
+static std::vector<resource> s_resources(1);
+static std::vector<resource_view> s_resource_views(1);
+static std::vector<pipeline> s_pipelines(1);
+static std::vector<pipeline_layout> s_pipeline_layouts(1);
+// Command queues are not created during playback, only their type is remembered to attribute submissions to (unknown queues are assumed to be graphics queues)
+static std::vector<command_queue_type> s_command_queue_types(1, command_queue_type::graphics);
+// Contents of buffers that delta encoded mappings refer to, indexed by resource ID
+static std::vector<std::vector<uint8_t>> s_buffer_contents;
+// Descriptor tables are not created by the trace, so these are still referenced by their original handles
 static std::unordered_map<uint64_t, descriptor_table> s_descriptor_tables;
 
-static void play_init_swapchain(trace_data_read &trace_data, effect_runtime *runtime)
+// Optionally reports every object ID read from the trace, so that tools can find out which objects events reference
+static void(*s_object_callback)(trace_object_type type, uint64_t id, void *user_data) = nullptr;
+static void *s_object_callback_data = nullptr;
+
+static trace_object_type object_type(sampler) { return trace_object_type::sampler; }
+static trace_object_type object_type(resource) { return trace_object_type::resource; }
+static trace_object_type object_type(resource_view) { return trace_object_type::resource_view; }
+static trace_object_type object_type(pipeline_layout) { return trace_object_type::pipeline_layout; }
+static trace_object_type object_type(pipeline) { return trace_object_type::pipeline; }
+
+template <typename T>
+static T report_object(T object)
+{
+	if (s_object_callback != nullptr)
+		s_object_callback(object_type(object), object.handle, s_object_callback_data);
+	return object;
+}
+template <typename T>
+static T read_object(trace_data_read &trace_data)
+{
+	return report_object(trace_data.read<T>());
+}
+static uint64_t report_command_queue(uint64_t id)
+{
+	if (s_object_callback != nullptr)
+		s_object_callback(trace_object_type::command_queue, id, s_object_callback_data);
+	return id;
+}
+
+static descriptor_table find_descriptor_table(uint64_t handle)
+{
+	const auto it = s_descriptor_tables.find(handle);
+	return it != s_descriptor_tables.end() ? it->second : descriptor_table { 0 };
+}
+
+// Linear allocator for data decoded during playback of a frame, reset on present
+// Chunks are kept across frames (and merged into a single one if a frame needed more than that), so that no allocations happen in steady state
+class frame_arena
+{
+public:
+	template <typename T>
+	T *allocate(size_t count)
+	{
+		static_assert(std::is_trivially_destructible_v<T>);
+
+		if (count == 0)
+			return nullptr;
+
+		T *const data = static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+		std::uninitialized_value_construct_n(data, count);
+		return data;
+	}
+
+	void reset()
+	{
+		if (_chunks.size() > 1)
+		{
+			size_t total_size = 0;
+			for (const chunk &chunk : _chunks)
+				total_size += chunk.size;
+
+			_chunks.clear();
+			_chunks.push_back({ std::make_unique<uint8_t[]>(total_size), total_size });
+		}
+
+		_offset = 0;
+	}
+
+private:
+	static constexpr size_t min_chunk_size = 1024 * 1024;
+
+	struct chunk
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+	};
+
+	void *allocate(size_t size, size_t alignment)
+	{
+		size_t offset = (_offset + alignment - 1) & ~(alignment - 1);
+
+		if (_chunks.empty() || offset + size > _chunks.back().size)
+		{
+			const size_t chunk_size = std::max(size, min_chunk_size);
+			_chunks.push_back({ std::make_unique<uint8_t[]>(chunk_size), chunk_size });
+
+			offset = 0;
+		}
+
+		_offset = offset + size;
+		return _chunks.back().data.get() + offset;
+	}
+
+	std::vector<chunk> _chunks;
+	size_t _offset = 0;
+};
+
+static frame_arena s_frame_arena;
+
+template <typename T>
+static T &init_object(std::vector<T> &objects, uint64_t id)
+{
+	assert(id != 0);
+	if (id >= objects.size())
+		objects.resize(static_cast<size_t>(id) + 1);
+	return objects[static_cast<size_t>(id)];
+}
+// IDs the trace references without having created them (because it was cut short, trimmed or is corrupt) resolve to null handles
+template <typename T>
+static T find_object(const std::vector<T> &objects, uint64_t id)
+{
+	return id < objects.size() ? objects[static_cast<size_t>(id)] : T {};
+}
+template <typename T>
+static T release_object(std::vector<T> &objects, uint64_t id)
+{
+	return id < objects.size() ? std::exchange(objects[static_cast<size_t>(id)], T {}) : T {};
+}
+
+static bool take_prefetched_object(uint64_t offset, uint64_t &handle);
+
+// Pipelines and pipeline layouts with identical trace data are only created once and kept until playback ends, which also covers rewinds
+// Pipelines are keyed by their data with the layout ID replaced by the key of that layout, since layouts are recreated under different IDs
+class pipeline_cache
+{
+public:
+	explicit pipeline_cache(device *device) : _device(device) {}
+	~pipeline_cache()
+	{
+		for (const auto &[key, object] : _pipelines)
+			_device->destroy_pipeline(object);
+		for (const auto &[key, object] : _pipeline_layouts)
+			_device->destroy_pipeline_layout(object);
+	}
+
+	uint64_t layout_key(uint64_t id) const
+	{
+		return id < _layout_keys.size() ? _layout_keys[static_cast<size_t>(id)] : 0;
+	}
+	void set_layout_key(uint64_t id, uint64_t key)
+	{
+		init_object(_layout_keys, id) = key;
+	}
+
+	pipeline_layout create_pipeline_layout(uint64_t key, uint32_t param_count, const pipeline_layout_param *params)
+	{
+		// Layouts are only ever created on the playback thread
+		if (const auto it = _pipeline_layouts.find(key); it != _pipeline_layouts.end())
+			return it->second;
+
+		pipeline_layout object = {};
+		if (!_device->create_pipeline_layout(param_count, params, &object))
+			assert(false);
+
+		const std::unique_lock<std::mutex> lock(_mutex);
+		return _pipeline_layouts[key] = object;
+	}
+	pipeline create_pipeline(uint64_t key, uint64_t layout_key, uint32_t subobject_count, const pipeline_subobject *subobjects)
+	{
+		pipeline_layout layout = {};
+		{
+			const std::unique_lock<std::mutex> lock(_mutex);
+			if (const auto it = _pipelines.find(key); it != _pipelines.end())
+				return it->second;
+			if (const auto it = _pipeline_layouts.find(layout_key); it != _pipeline_layouts.end())
+				layout = it->second;
+		}
+
+		// Created outside the lock, so that multiple threads can compile at the same time
+		pipeline object = {};
+		if (!_device->create_pipeline(layout, subobject_count, subobjects, &object))
+			return {};
+
+		const std::unique_lock<std::mutex> lock(_mutex);
+		return _pipelines[key] = object;
+	}
+
+private:
+	device *const _device;
+	std::mutex _mutex;
+	std::vector<uint64_t> _layout_keys;
+	std::unordered_map<uint64_t, pipeline> _pipelines;
+	std::unordered_map<uint64_t, pipeline_layout> _pipeline_layouts;
+};
+
+static std::unique_ptr<pipeline_cache> s_pipeline_cache;
+
+// Keeps resources (and their views) that the trace destroyed alive for a few frames, so that they can be used again for later ones with the same description instead of creating new ones, since many titles create and destroy transient resources every frame
+// They keep whatever contents they had, which is fine since new resources without initial data have undefined contents as well
+class resource_pool
+{
+public:
+	// Resources that were not used again for this many frames are destroyed for real
+	static constexpr uint64_t max_unused_frames = 4;
+
+	explicit resource_pool(device *device) : _device(device),
+		// Views are separate objects that keep a reference to their resource only in D3D10 and D3D11
+		_pool_views(device->get_api() == device_api::d3d10 || device->get_api() == device_api::d3d11) {}
+	~resource_pool()
+	{
+		for (const auto &[key, entries] : _free_resources)
+			for (const free_resource &entry : entries)
+				destroy_pooled_resource(entry.object);
+	}
+
+	bool create_resource(const resource_desc &desc, const subresource_data *initial_data, resource_usage initial_state, resource *out_resource)
+	{
+		// Resources with initial data are always created, since uploading that data to an existing one would cost about as much
+		if (initial_data == nullptr)
+		{
+			if (const auto it = _free_resources.find(resource_desc_key(desc)); it != _free_resources.end())
+			{
+				std::vector<free_resource> &entries = it->second;
+				for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+				{
+					if (!same_resource_desc(_descs.at(entry->object.handle), desc))
+						continue;
+
+					*out_resource = entry->object;
+					entries.erase(entry);
+					return true;
+				}
+			}
+		}
+
+		if (!_device->create_resource(desc, initial_data, initial_state, out_resource))
+			return false;
+
+		_descs[out_resource->handle] = desc;
+		return true;
+	}
+	void destroy_resource(resource object)
+	{
+		const auto it = _descs.find(object.handle);
+		if (it == _descs.end())
+		{
+			_device->destroy_resource(object);
+			return;
+		}
+
+		_free_resources[resource_desc_key(it->second)].push_back({ object, _frame });
+	}
+
+	bool create_resource_view(resource resource, resource_usage usage_type, const resource_view_desc &desc, resource_view *out_view)
+	{
+		if (const auto it = _free_views.find(resource.handle); it != _free_views.end())
+		{
+			std::vector<view_entry> &entries = it->second;
+			for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+			{
+				if (entry->usage_type != usage_type || std::memcmp(&entry->desc, &desc, sizeof(desc)) != 0)
+					continue;
+
+				*out_view = entry->object;
+				_views[out_view->handle] = *entry;
+				entries.erase(entry);
+				return true;
+			}
+		}
+
+		if (!_device->create_resource_view(resource, usage_type, desc, out_view))
+			return false;
+
+		// Only views of resources created through the pool are kept, since the handle of a resource that was destroyed for real may be returned again by the driver for a different one
+		if (_pool_views && _descs.find(resource.handle) != _descs.end())
+			_views[out_view->handle] = { *out_view, resource, usage_type, desc };
+		return true;
+	}
+	void destroy_resource_view(resource_view object)
+	{
+		const auto it = _views.find(object.handle);
+		if (it == _views.end())
+		{
+			_device->destroy_resource_view(object);
+			return;
+		}
+
+		// The resource may have been destroyed for real in the meantime
+		if (_descs.find(it->second.resource.handle) != _descs.end())
+			_free_views[it->second.resource.handle].push_back(it->second);
+		else
+			_device->destroy_resource_view(object);
+		_views.erase(it);
+	}
+
+	void end_frame()
+	{
+		_frame++;
+
+		for (auto &[key, entries] : _free_resources)
+		{
+			entries.erase(std::remove_if(entries.begin(), entries.end(), [this](const free_resource &entry) {
+				if (_frame - entry.frame < max_unused_frames)
+					return false;
+				destroy_pooled_resource(entry.object);
+				return true;
+			}), entries.end());
+		}
+	}
+
+private:
+	struct free_resource
+	{
+		resource object;
+		uint64_t frame;
+	};
+	struct view_entry
+	{
+		resource_view object;
+		resource resource;
+		resource_usage usage_type;
+		resource_view_desc desc;
+	};
+
+	// Only the members in use are compared, since the padding between them is undefined
+	static bool same_resource_desc(const resource_desc &a, const resource_desc &b)
+	{
+		if (a.type != b.type || a.heap != b.heap || a.usage != b.usage || a.flags != b.flags)
+			return false;
+		if (a.type == resource_type::buffer)
+			return a.buffer.size == b.buffer.size && a.buffer.stride == b.buffer.stride;
+		return a.texture.width == b.texture.width && a.texture.height == b.texture.height && a.texture.depth_or_layers == b.texture.depth_or_layers && a.texture.levels == b.texture.levels && a.texture.format == b.texture.format && a.texture.samples == b.texture.samples;
+	}
+	static uint64_t resource_desc_key(const resource_desc &desc)
+	{
+		const uint64_t values[] = {
+			static_cast<uint64_t>(desc.type),
+			desc.type == resource_type::buffer ? desc.buffer.size : desc.texture.width | (static_cast<uint64_t>(desc.texture.height) << 32),
+			desc.type == resource_type::buffer ? desc.buffer.stride : desc.texture.depth_or_layers | (static_cast<uint64_t>(desc.texture.levels) << 16) | (static_cast<uint64_t>(desc.texture.format) << 32),
+			static_cast<uint64_t>(desc.usage) | (static_cast<uint64_t>(desc.heap) << 32),
+		};
+		return trace_blob_hash(values, sizeof(values));
+	}
+
+	void destroy_pooled_resource(resource object)
+	{
+		if (const auto it = _free_views.find(object.handle); it != _free_views.end())
+		{
+			for (const view_entry &entry : it->second)
+				_device->destroy_resource_view(entry.object);
+			_free_views.erase(it);
+		}
+
+		_device->destroy_resource(object);
+		_descs.erase(object.handle);
+	}
+
+	device *const _device;
+	const bool _pool_views;
+	uint64_t _frame = 0;
+	// Descriptions of all resources created through the pool that still exist, whether they are in use or not
+	std::unordered_map<uint64_t, resource_desc> _descs;
+	std::unordered_map<uint64_t, std::vector<free_resource>> _free_resources;
+	std::unordered_map<uint64_t, view_entry> _views;
+	std::unordered_map<uint64_t, std::vector<view_entry>> _free_views;
+};
+
+static std::unique_ptr<resource_pool> s_resource_pool;
+
+// Hashes the raw trace data of an event between the specified offsets, which only identifies events without blobs (those may be written inline or as a reference to an earlier copy)
+static uint64_t hash_event_data(trace_data_read &trace_data, frame_arena &arena, uint64_t begin, uint64_t end)
 {
-	device *const device = runtime->get_device();
+	const uint64_t position = trace_data.tell();
+	const size_t size = static_cast<size_t>(end - begin);
+
+	uint8_t *const data = arena.allocate<uint8_t>(size);
+	trace_data.seek(begin);
+	trace_data.read(data, size);
+	trace_data.seek(position);
 
+	return trace_blob_hash(data, size);
+}
+
+// Back buffers are left as null handles without a runtime, when events are only decoded
+static void play_init_swapchain(trace_data_read &trace_data, device *device, effect_runtime *runtime)
+{
 	const auto buffer_count = trace_data.read<uint32_t>();
 
 	for (uint32_t i = 0; i < buffer_count; ++i)
 	{
-		const auto handle = trace_data.read<resource>().handle;
+		const auto handle = read_object<resource>(trace_data).handle;
+		const auto view_handle = read_object<resource_view>(trace_data).handle;
 
-		s_resources[handle] = runtime->get_back_buffer(i < runtime->get_back_buffer_count() ? i : 0);
-		if (device->get_api() == device_api::d3d9 || device->get_api() == device_api::opengl)
-			s_resource_views[handle] = { s_resources[handle].handle };
+		const resource back_buffer = runtime != nullptr ? runtime->get_back_buffer(i < runtime->get_back_buffer_count() ? i : 0) : resource { 0 };
+
+		init_object(s_resources, handle) = back_buffer;
+		if (view_handle != 0 && (device->get_api() == device_api::d3d9 || device->get_api() == device_api::opengl))
+			init_object(s_resource_views, view_handle) = { back_buffer.handle };
 	}
 }
-static void play_destroy_swapchain(trace_data_read &trace_data, effect_runtime *runtime)
+static void play_destroy_swapchain(trace_data_read &trace_data)
 {
-	device *const device = runtime->get_device();
-
 	const auto buffer_count = trace_data.read<uint32_t>();
 
 	for (uint32_t i = 0; i < buffer_count; ++i)
 	{
-		const auto handle = trace_data.read<resource>().handle;
+		const auto handle = read_object<resource>(trace_data).handle;
+		const auto view_handle = read_object<resource_view>(trace_data).handle;
 
-		s_resources[handle] = {};
-		if (device->get_api() == device_api::d3d9 || device->get_api() == device_api::opengl)
-			s_resource_views[handle] = {};
+		release_object(s_resources, handle);
+		release_object(s_resource_views, view_handle);
 	}
 }
 
+static void play_init_command_queue(trace_data_read &trace_data)
+{
+	const auto id = report_command_queue(trace_data.read<uint64_t>());
+	const auto type = trace_data.read<command_queue_type>();
+
+	init_object(s_command_queue_types, id) = type;
+}
+static void play_destroy_command_queue(trace_data_read &trace_data)
+{
+	const auto id = report_command_queue(trace_data.read<uint64_t>());
+
+	if (id < s_command_queue_types.size())
+		s_command_queue_types[id] = command_queue_type::graphics;
+}
+
 static void play_init_sampler(trace_data_read &trace_data, device *device)
 {
 	const auto desc = trace_data.read<sampler_desc>();
-	const auto handle = trace_data.read<sampler>().handle;
+	const auto handle = read_object<sampler>(trace_data).handle;
+
+	sampler &object = init_object(s_samplers, handle);
 
-	if (!device->create_sampler(desc, &s_samplers[handle]))
+	if (object != 0)
+		device->destroy_sampler(object);
+
+	if (!device->create_sampler(desc, &object))
 		assert(false);
 }
 static void play_destroy_sampler(trace_data_read &trace_data, device *device)
 {
-	const auto handle = trace_data.read<sampler>().handle;
+	const auto handle = read_object<sampler>(trace_data).handle;
 
-	device->destroy_sampler(s_samplers[handle]);
-	s_samplers[handle] = {};
+	device->destroy_sampler(release_object(s_samplers, handle));
 }
 
-static void play_init_resource(trace_data_read &trace_data, device *device)
+struct init_resource_data
+{
+	resource_desc desc;
+	resource_usage initial_state;
+	uint64_t handle;
+	uint64_t original_handle;
+	subresource_data *initial_data;
+};
+
+// Initial data is not read if skipped, for events of resources that were already created ahead of time
+static void read_init_resource(trace_data_read &trace_data, frame_arena &arena, device_api api, init_resource_data &data, bool skip_data = false)
 {
-	auto desc = trace_data.read<resource_desc>();
-	const auto initial_state = trace_data.read<resource_usage>();
-	const auto handle = trace_data.read<resource>().handle;
+	data.desc = trace_data.read<resource_desc>();
+	data.initial_state = trace_data.read<resource_usage>();
+	data.handle = read_object<resource>(trace_data).handle;
+	data.original_handle = trace_data.read<uint64_t>();
 
 	const auto subresources = trace_data.read<uint32_t>();
 
-	std::vector<std::vector<uint8_t>> data(subresources);
-	std::vector<subresource_data> initial_data(subresources);
+	data.initial_data = skip_data ? nullptr : arena.allocate<subresource_data>(subresources);
 
-	if (desc.type == resource_type::buffer)
+	if (data.desc.type == resource_type::buffer)
 	{
 		if (subresources != 0)
 		{
-			data[0].resize(static_cast<size_t>(desc.buffer.size));
-			trace_data.read(data[0].data(), data[0].size());
-
-			initial_data[0].data = data[0].data();
+			if (skip_data)
+				trace_data.skip_blob(static_cast<size_t>(data.desc.buffer.size));
+			else
+				data.initial_data[0].data = const_cast<void *>(trace_data.read_blob(static_cast<size_t>(data.desc.buffer.size)));
 		}
 	}
 	else
 	{
-		if (device->get_api() == device_api::opengl && desc.texture.levels == 0)
-			desc.texture.levels = 1;
+		if (api == device_api::opengl && data.desc.texture.levels == 0)
+			data.desc.texture.levels = 1;
 
-		const uint32_t levels = desc.texture.levels;
-		const uint32_t layers = (desc.type != resource_type::texture_3d) ? desc.texture.depth_or_layers : 1;
+		const uint32_t levels = data.desc.texture.levels;
+		const uint32_t layers = (data.desc.type != resource_type::texture_3d) ? data.desc.texture.depth_or_layers : 1;
 
 		for (uint32_t layer = 0; layer < layers; ++layer)
 		{
@@ -107,79 +522,128 @@ static void play_init_resource(trace_data_read &trace_data, device *device)
 				subresource_data.row_pitch = trace_data.read<uint32_t>();
 				subresource_data.slice_pitch = trace_data.read<uint32_t>();
 
-				data[subresource].resize(static_cast<size_t>(trace_data.read<uint64_t>()));
-				trace_data.read(data[subresource].data(), data[subresource].size());
+				const auto size = trace_data.read<uint64_t>();
+				if (skip_data)
+				{
+					trace_data.skip_blob(static_cast<size_t>(size));
+					continue;
+				}
 
-				subresource_data.data = data[subresource].data();
-				initial_data[subresource] = subresource_data;
+				subresource_data.data = const_cast<void *>(trace_data.read_blob(static_cast<size_t>(size)));
+				data.initial_data[subresource] = subresource_data;
 			}
 		}
 	}
+}
+
+static void play_init_resource(trace_data_read &trace_data, device *device)
+{
+	uint64_t prefetched = 0;
+	const bool is_prefetched = take_prefetched_object(trace_data.tell() - sizeof(trace_event_tag), prefetched);
+
+	init_resource_data data;
+	read_init_resource(trace_data, s_frame_arena, device->get_api(), data, is_prefetched);
+
+	// Delta encoded mappings of a new buffer start from zeroed contents again
+	if (data.handle < s_buffer_contents.size())
+		s_buffer_contents[data.handle] = {};
 
-	if (device->get_api() == device_api::opengl && (handle >> 40) == 0x8218 /* GL_FRAMEBUFFER_DEFAULT */)
+	resource &object = init_object(s_resources, data.handle);
+
+	if (device->get_api() == device_api::opengl && (data.original_handle >> 40) == 0x8218 /* GL_FRAMEBUFFER_DEFAULT */)
 	{
-		s_resources[handle].handle = handle;
+		object.handle = data.original_handle;
 		return;
 	}
 
-	if (s_resources.find(handle) != s_resources.end())
-		device->destroy_resource(s_resources[handle]);
+	if (object != 0)
+	{
+		if (s_resource_pool != nullptr)
+			s_resource_pool->destroy_resource(object);
+		else
+			device->destroy_resource(object);
+	}
 
-	if (!device->create_resource(desc, initial_data.data(), initial_state, &s_resources[handle]))
+	if (is_prefetched)
+		object = { prefetched };
+	else if (s_resource_pool != nullptr ? !s_resource_pool->create_resource(data.desc, data.initial_data, data.initial_state, &object) : !device->create_resource(data.desc, data.initial_data, data.initial_state, &object))
 		assert(false);
 }
 static void play_destroy_resource(trace_data_read &trace_data, device *device)
 {
-	const auto handle = trace_data.read<resource>().handle;
+	const auto handle = read_object<resource>(trace_data).handle;
 
-	if (device->get_api() == device_api::opengl && (handle >> 40) == 0x8218 /* GL_FRAMEBUFFER_DEFAULT */)
-		return;
+	const resource object = release_object(s_resources, handle);
 
-	device->destroy_resource(s_resources[handle]);
-	s_resources[handle] = {};
+	if (object != 0 && (device->get_api() != device_api::opengl || (object.handle >> 40) != 0x8218 /* GL_FRAMEBUFFER_DEFAULT */))
+	{
+		if (s_resource_pool != nullptr)
+			s_resource_pool->destroy_resource(object);
+		else
+			device->destroy_resource(object);
+	}
+
+	if (handle < s_buffer_contents.size())
+		s_buffer_contents[handle] = {};
 }
 
 static void play_init_resource_view(trace_data_read &trace_data, device *device)
 {
-	const auto resource_handle = trace_data.read<resource_view>().handle;
+	const auto resource_handle = read_object<resource>(trace_data).handle;
 	const auto usage_type = trace_data.read<resource_usage>();
 	const auto desc = trace_data.read<resource_view_desc>();
-	const auto handle = trace_data.read<resource_view>().handle;
+	const auto handle = read_object<resource_view>(trace_data).handle;
+	const auto original_handle = trace_data.read<uint64_t>();
+
+	resource_view &object = init_object(s_resource_views, handle);
 
-	if (device->get_api() == device_api::opengl && (handle >> 40) == 0x8218 /* GL_FRAMEBUFFER_DEFAULT */)
+	if (device->get_api() == device_api::opengl && (original_handle >> 40) == 0x8218 /* GL_FRAMEBUFFER_DEFAULT */)
 	{
-		s_resource_views[handle].handle = handle;
+		object.handle = original_handle;
 		return;
 	}
 
-	if (s_resource_views.find(handle) != s_resource_views.end())
-		device->destroy_resource_view(s_resource_views[handle]);
+	if (object != 0)
+	{
+		if (s_resource_pool != nullptr)
+			s_resource_pool->destroy_resource_view(object);
+		else
+			device->destroy_resource_view(object);
+	}
 
-	if (!device->create_resource_view(s_resources[resource_handle], usage_type, desc, &s_resource_views[handle]))
+	if (s_resource_pool != nullptr ? !s_resource_pool->create_resource_view(find_object(s_resources, resource_handle), usage_type, desc, &object) : !device->create_resource_view(find_object(s_resources, resource_handle), usage_type, desc, &object))
 		assert(false);
 }
 static void play_destroy_resource_view(trace_data_read &trace_data, device *device)
 {
-	const auto handle = trace_data.read<resource_view>().handle;
+	const auto handle = read_object<resource_view>(trace_data).handle;
 
-	device->destroy_resource_view(s_resource_views[handle]);
-	s_resource_views[handle] = {};
+	const resource_view object = release_object(s_resource_views, handle);
+
+	if (object != 0 && (device->get_api() != device_api::opengl || (object.handle >> 40) != 0x8218 /* GL_FRAMEBUFFER_DEFAULT */))
+	{
+		if (s_resource_pool != nullptr)
+			s_resource_pool->destroy_resource_view(object);
+		else
+			device->destroy_resource_view(object);
+	}
 }
 
-static void play_init_pipeline(trace_data_read &trace_data, device *device)
+struct init_pipeline_data
+{
+	uint64_t layout;
+	uint32_t subobject_count;
+	pipeline_subobject *subobjects;
+	uint64_t handle;
+};
+
+static void read_init_pipeline(trace_data_read &trace_data, frame_arena &arena, init_pipeline_data &data)
 {
-	const auto layout = trace_data.read<pipeline_layout>().handle;
-	const auto subobject_count = trace_data.read<uint32_t>();
+	data.layout = read_object<pipeline_layout>(trace_data).handle;
+	data.subobject_count = trace_data.read<uint32_t>();
 
-	std::vector<pipeline_subobject> subobjects(subobject_count);
-	shader_desc shader_descs[6];
-	std::vector<char> shader_code[6];
-	std::vector<char> entry_points[6];
-	std::vector<input_element> input_layout;
-	std::vector<std::vector<char>> input_layout_semantics;
-	blend_desc blend_state;
-	rasterizer_desc rasterizer_state;
-	depth_stencil_desc depth_stencil_state;
+	const uint32_t subobject_count = data.subobject_count;
+	pipeline_subobject *const subobjects = arena.allocate<pipeline_subobject>(subobject_count);
 
 	for (uint32_t i = 0; i < subobject_count; ++i)
 	{
@@ -194,23 +658,18 @@ static void play_init_pipeline(trace_data_read &trace_data, device *device)
 		case pipeline_subobject_type::pixel_shader:
 		case pipeline_subobject_type::compute_shader:
 		{
-			const auto shader_type_index = static_cast<size_t>(subobjects[i].type) - static_cast<size_t>(pipeline_subobject_type::vertex_shader);
-
-			const auto desc = static_cast<shader_desc *>(&shader_descs[shader_type_index]);
-			std::vector<char> &code = shader_code[shader_type_index];
-			std::vector<char> &entry_point = entry_points[shader_type_index];
+			shader_desc *const desc = arena.allocate<shader_desc>(1);
 
 			const auto code_size = trace_data.read<uint64_t>();
-			code.resize(static_cast<size_t>(code_size));
-			trace_data.read(code.data(), static_cast<size_t>(code_size));
+			const void *const code = trace_data.read_blob(static_cast<size_t>(code_size));
 
 			const auto entry_point_length = trace_data.read<uint32_t>();
-			entry_point.resize(entry_point_length + 1);
-			trace_data.read(entry_point.data(), entry_point_length);
+			char *const entry_point = arena.allocate<char>(entry_point_length + 1);
+			trace_data.read(entry_point, entry_point_length);
 
-			desc->code = code.data();
+			desc->code = code;
 			desc->code_size = static_cast<size_t>(code_size);
-			desc->entry_point = entry_point_length ? entry_point.data() : nullptr;
+			desc->entry_point = entry_point_length ? entry_point : nullptr;
 
 			subobjects[i].count = 1;
 			subobjects[i].data = desc;
@@ -220,16 +679,15 @@ static void play_init_pipeline(trace_data_read &trace_data, device *device)
 		{
 			const auto count = trace_data.read<uint32_t>();
 
-			input_layout.resize(count);
-			input_layout_semantics.resize(count);
+			input_element *const input_layout = arena.allocate<input_element>(count);
 
 			for (uint32_t k = 0; k < count; ++k)
 			{
 				input_layout[k].location = trace_data.read<uint32_t>();
 
 				const auto semantic_length = trace_data.read<uint32_t>();
-				input_layout_semantics[k].resize(semantic_length + 1);
-				trace_data.read(input_layout_semantics[k].data(), semantic_length);
+				char *const semantic = arena.allocate<char>(semantic_length + 1);
+				trace_data.read(semantic, semantic_length);
 
 				input_layout[k].semantic_index = trace_data.read<uint32_t>();
 				input_layout[k].format = trace_data.read<format>();
@@ -238,124 +696,670 @@ static void play_init_pipeline(trace_data_read &trace_data, device *device)
 				input_layout[k].stride = trace_data.read<uint32_t>();
 				input_layout[k].instance_step_rate = trace_data.read<uint32_t>();
 
-				input_layout[k].semantic = semantic_length ? input_layout_semantics[k].data() : nullptr;
+				input_layout[k].semantic = semantic_length ? semantic : nullptr;
 			}
 
 			subobjects[i].count = count;
-			subobjects[i].data = input_layout.data();
+			subobjects[i].data = input_layout;
 			break;
 		}
 		case pipeline_subobject_type::blend_state:
 		{
-			blend_state = trace_data.read<blend_desc>();
+			blend_desc *const desc = arena.allocate<blend_desc>(1);
+			*desc = trace_data.read<blend_desc>();
 
 			subobjects[i].count = 1;
-			subobjects[i].data = &blend_state;
+			subobjects[i].data = desc;
 			break;
 		}
 		case pipeline_subobject_type::rasterizer_state:
 		{
-			rasterizer_state = trace_data.read<rasterizer_desc>();
+			rasterizer_desc *const desc = arena.allocate<rasterizer_desc>(1);
+			*desc = trace_data.read<rasterizer_desc>();
+
+			subobjects[i].count = 1;
+			subobjects[i].data = desc;
+			break;
+		}
+		case pipeline_subobject_type::depth_stencil_state:
+		{
+			depth_stencil_desc *const desc = arena.allocate<depth_stencil_desc>(1);
+			*desc = trace_data.read<depth_stencil_desc>();
+
+			subobjects[i].count = 1;
+			subobjects[i].data = desc;
+			break;
+		}
+		case pipeline_subobject_type::stream_output_state:
+		case pipeline_subobject_type::primitive_topology:
+		case pipeline_subobject_type::depth_stencil_format:
+		case pipeline_subobject_type::render_target_formats:
+		case pipeline_subobject_type::sample_mask:
+		case pipeline_subobject_type::sample_count:
+		case pipeline_subobject_type::viewport_count:
+		case pipeline_subobject_type::dynamic_pipeline_states:
+		case pipeline_subobject_type::max_vertex_count:
+			break;
+		}
+	}
+
+	data.subobjects = subobjects;
+	data.handle = read_object<pipeline>(trace_data).handle;
+}
+
+// Hashes the decoded description of a pipeline along with the key of its layout, so that identical pipelines get the same key no matter whether their shader code was written inline or referenced
+static uint64_t hash_init_pipeline(const init_pipeline_data &data, uint64_t layout_key)
+{
+	std::vector<uint64_t> hashes;
+	hashes.push_back(layout_key);
+
+	const auto hash_string = [](const char *string) { return string != nullptr ? trace_blob_hash(string, std::strlen(string)) : 0; };
+
+	for (uint32_t i = 0; i < data.subobject_count; ++i)
+	{
+		const pipeline_subobject &subobject = data.subobjects[i];
+		hashes.push_back(static_cast<uint64_t>(subobject.type));
+		hashes.push_back(subobject.count);
+
+		switch (subobject.type)
+		{
+		case pipeline_subobject_type::vertex_shader:
+		case pipeline_subobject_type::hull_shader:
+		case pipeline_subobject_type::domain_shader:
+		case pipeline_subobject_type::geometry_shader:
+		case pipeline_subobject_type::pixel_shader:
+		case pipeline_subobject_type::compute_shader:
+		{
+			const shader_desc &desc = *static_cast<const shader_desc *>(subobject.data);
+			hashes.push_back(trace_blob_hash(desc.code, desc.code_size));
+			hashes.push_back(hash_string(desc.entry_point));
+			break;
+		}
+		case pipeline_subobject_type::input_layout:
+			for (uint32_t k = 0; k < subobject.count; ++k)
+			{
+				const input_element &element = static_cast<const input_element *>(subobject.data)[k];
+				hashes.push_back(element.location);
+				hashes.push_back(hash_string(element.semantic));
+				hashes.push_back(element.semantic_index);
+				hashes.push_back(static_cast<uint64_t>(element.format));
+				hashes.push_back(element.buffer_binding);
+				hashes.push_back(element.offset);
+				hashes.push_back(element.stride);
+				hashes.push_back(element.instance_step_rate);
+			}
+			break;
+		case pipeline_subobject_type::blend_state:
+			hashes.push_back(trace_blob_hash(subobject.data, sizeof(blend_desc)));
+			break;
+		case pipeline_subobject_type::rasterizer_state:
+			hashes.push_back(trace_blob_hash(subobject.data, sizeof(rasterizer_desc)));
+			break;
+		case pipeline_subobject_type::depth_stencil_state:
+			hashes.push_back(trace_blob_hash(subobject.data, sizeof(depth_stencil_desc)));
+			break;
+		default:
+			break;
+		}
+	}
+
+	return trace_blob_hash(hashes.data(), hashes.size() * sizeof(uint64_t));
+}
+
+static void play_init_pipeline(trace_data_read &trace_data, device *device)
+{
+	uint64_t prefetched = 0;
+	const bool is_prefetched = take_prefetched_object(trace_data.tell() - sizeof(trace_event_tag), prefetched);
+
+	init_pipeline_data data;
+	read_init_pipeline(trace_data, s_frame_arena, data);
+
+	pipeline &object = init_object(s_pipelines, data.handle);
+
+	if (s_pipeline_cache != nullptr)
+	{
+		const uint64_t layout_key = s_pipeline_cache->layout_key(data.layout);
+		const uint64_t key = hash_init_pipeline(data, layout_key);
+
+		object = s_pipeline_cache->create_pipeline(key, layout_key, data.subobject_count, data.subobjects);
+		assert(object != 0);
+		return;
+	}
+
+	if (object != 0)
+		device->destroy_pipeline(object);
+
+	if (is_prefetched)
+		object = { prefetched };
+	else if (!device->create_pipeline(find_object(s_pipeline_layouts, data.layout), data.subobject_count, data.subobjects, &object))
+		assert(false);
+}
+static void play_destroy_pipeline(trace_data_read &trace_data, device *device)
+{
+	const auto handle = read_object<pipeline>(trace_data).handle;
+
+	const pipeline object = release_object(s_pipelines, handle);
+
+	// Cached objects are kept alive until playback ends
+	if (s_pipeline_cache == nullptr)
+		device->destroy_pipeline(object);
+}
+
+struct init_pipeline_layout_data
+{
+	uint32_t param_count;
+	pipeline_layout_param *params;
+	uint64_t handle;
+};
+
+static void read_init_pipeline_layout(trace_data_read &trace_data, frame_arena &arena, init_pipeline_layout_data &data)
+{
+	data.param_count = trace_data.read<uint32_t>();
+
+	const uint32_t param_count = data.param_count;
+	pipeline_layout_param *const params = arena.allocate<pipeline_layout_param>(param_count);
+
+	for (uint32_t i = 0; i < param_count; ++i)
+	{
+		params[i].type = trace_data.read<pipeline_layout_param_type>();
+
+		switch (params[i].type)
+		{
+		case pipeline_layout_param_type::push_constants:
+			params[i].push_constants = trace_data.read<decltype(params[i].push_constants)>();
+			break;
+		case pipeline_layout_param_type::push_descriptors:
+			params[i].push_descriptors = trace_data.read<decltype(params[i].push_descriptors)>();
+			break;
+		case pipeline_layout_param_type::descriptor_table:
+		case pipeline_layout_param_type::push_descriptors_with_ranges:
+		{
+			params[i].descriptor_table.count = trace_data.read<uint32_t>();
+			descriptor_range *const ranges = arena.allocate<descriptor_range>(params[i].descriptor_table.count);
+			for (uint32_t k = 0; k < params[i].descriptor_table.count; ++k)
+				ranges[k] = trace_data.read<descriptor_range>();
+			params[i].descriptor_table.ranges = ranges;
+			break;
+		}
+		case pipeline_layout_param_type::descriptor_table_with_static_samplers:
+		case pipeline_layout_param_type::push_descriptors_with_static_samplers:
+		{
+			params[i].descriptor_table_with_static_samplers.count = trace_data.read<uint32_t>();
+			descriptor_range_with_static_samplers *const ranges = arena.allocate<descriptor_range_with_static_samplers>(params[i].descriptor_table_with_static_samplers.count);
+			for (uint32_t k = 0; k < params[i].descriptor_table_with_static_samplers.count; ++k)
+				ranges[k] = trace_data.read<descriptor_range_with_static_samplers>();
+			params[i].descriptor_table_with_static_samplers.ranges = ranges;
+			break;
+		}
+		}
+	}
+
+	data.params = params;
+	data.handle = read_object<pipeline_layout>(trace_data).handle;
+}
+
+static void play_init_pipeline_layout(trace_data_read &trace_data, device *device)
+{
+	uint64_t prefetched = 0;
+	const bool is_prefetched = take_prefetched_object(trace_data.tell() - sizeof(trace_event_tag), prefetched);
+
+	const uint64_t begin = trace_data.tell();
+
+	init_pipeline_layout_data data;
+	read_init_pipeline_layout(trace_data, s_frame_arena, data);
+
+	pipeline_layout &object = init_object(s_pipeline_layouts, data.handle);
+
+	if (s_pipeline_cache != nullptr)
+	{
+		const uint64_t key = hash_event_data(trace_data, s_frame_arena, begin, trace_data.tell() - sizeof(pipeline_layout));
+
+		s_pipeline_cache->set_layout_key(data.handle, key);
+		object = s_pipeline_cache->create_pipeline_layout(key, data.param_count, data.params);
+		return;
+	}
+
+	if (object != 0)
+		device->destroy_pipeline_layout(object);
+
+	if (is_prefetched)
+		object = { prefetched };
+	else if (!device->create_pipeline_layout(data.param_count, data.params, &object))
+		assert(false);
+}
+static void play_destroy_pipeline_layout(trace_data_read &trace_data, device *device)
+{
+	const auto handle = read_object<pipeline_layout>(trace_data).handle;
+
+	const pipeline_layout object = release_object(s_pipeline_layouts, handle);
+
+	// Cached objects are kept alive until playback ends
+	if (s_pipeline_cache == nullptr)
+		device->destroy_pipeline_layout(object);
+}
+
+// Creates resources, pipeline layouts and pipelines of the next frames on worker threads ahead of time, using the trace index to find them
+// Each object is identified by the offset of its init event, so that it is only used where that event is played back
+class object_prefetcher
+{
+public:
+	object_prefetcher(const char *path, const trace_index &index, device *device) :
+		_index(index), _device(device), _scan(path)
+	{
+		const uint32_t thread_count = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+		for (uint32_t i = 0; i < thread_count; ++i)
+			_threads.emplace_back(&object_prefetcher::worker_main, this, path);
+	}
+	~object_prefetcher()
+	{
+		reset();
+
+		{
+			const std::unique_lock<std::mutex> lock(_mutex);
+			_exit = true;
+		}
+
+		_queue_cv.notify_all();
+
+		for (std::thread &thread : _threads)
+			thread.join();
+	}
+
+	// Queues init events up to the end of the frame after next, starting from the current playback position
+	void advance(uint64_t position)
+	{
+		const auto frame_it = std::upper_bound(_index.frame_offsets.begin(), _index.frame_offsets.end(), position);
+		const size_t frame = frame_it - _index.frame_offsets.begin();
+		const uint64_t scan_end = frame + look_ahead_frames < _index.frame_offsets.size() ? _index.frame_offsets[frame + look_ahead_frames] : UINT64_MAX;
+
+		if (_scan_index == SIZE_MAX)
+			_scan_index = std::lower_bound(_index.state_offsets.begin(), _index.state_offsets.end(), position) - _index.state_offsets.begin();
+
+		const std::unique_lock<std::mutex> lock(_mutex);
+
+		for (; _scan_index < _index.state_offsets.size() && _index.state_offsets[_scan_index] < scan_end; ++_scan_index)
+		{
+			const uint64_t offset = _index.state_offsets[_scan_index];
+
+			_scan.seek(offset);
+			const auto ev = _scan.read_event();
+
+			switch (ev)
+			{
+			case reshade::addon_event::init_resource:
+				break;
+			case reshade::addon_event::init_pipeline:
+			case reshade::addon_event::init_pipeline_layout:
+				// These were all created up front already if there is a pipeline cache
+				if (s_pipeline_cache != nullptr)
+					continue;
+				break;
+			case reshade::addon_event::destroy_pipeline_layout:
+				_layout_jobs.erase(_scan.read<pipeline_layout>().handle);
+				continue;
+			default:
+				continue;
+			}
+
+			const std::shared_ptr<job> &job = _jobs[offset] = std::make_shared<object_prefetcher::job>();
+			job->offset = offset;
+			job->ev = ev;
+
+			if (ev == reshade::addon_event::init_pipeline_layout)
+			{
+				// Skip parameters to get to the handle the layout is referenced by afterwards
+				_scan.release_data();
+				init_pipeline_layout_data data;
+				read_init_pipeline_layout(_scan, _scan_arena, data);
+				_scan_arena.reset();
+
+				_layout_jobs[data.handle] = job;
+			}
+			else if (ev == reshade::addon_event::init_pipeline)
+			{
+				// Pipelines depend on the layout, which is either created ahead of time too or was already created during playback
+				const uint64_t layout = _scan.read<pipeline_layout>().handle;
+				if (const auto it = _layout_jobs.find(layout); it != _layout_jobs.end())
+					job->layout = it->second;
+				else
+					job->layout_handle = find_object(s_pipeline_layouts, layout).handle;
+			}
+
+			_queue.push_back(job);
+			_queue_cv.notify_one();
+		}
+
+		_scan.release_data();
+	}
+
+	// Drops all objects that were not used yet, so that playback can continue at a different position
+	void reset()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		_queue.clear();
+		_done_cv.wait(lock, [this]() { return _running == 0; });
+
+		// Pipelines reference layouts, so destroy those first
+		for (const reshade::addon_event ev : { reshade::addon_event::init_pipeline, reshade::addon_event::init_pipeline_layout, reshade::addon_event::init_resource })
+		{
+			for (const auto &[offset, job] : _jobs)
+			{
+				if (job->ev != ev || job->state != job_state::done || job->handle == 0)
+					continue;
+
+				switch (ev)
+				{
+				case reshade::addon_event::init_resource:
+					_device->destroy_resource({ job->handle });
+					break;
+				case reshade::addon_event::init_pipeline_layout:
+					_device->destroy_pipeline_layout({ job->handle });
+					break;
+				case reshade::addon_event::init_pipeline:
+					_device->destroy_pipeline({ job->handle });
+					break;
+				}
+			}
+		}
+
+		_jobs.clear();
+		_layout_jobs.clear();
+		_scan_index = SIZE_MAX;
+	}
+
+	// Waits for the object of the init event at the specified offset to be created and passes ownership of it to the caller
+	bool take(uint64_t offset, uint64_t &handle)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		const auto it = _jobs.find(offset);
+		if (it == _jobs.end())
+			return false;
+
+		const std::shared_ptr<job> job = std::move(it->second);
+		_jobs.erase(it);
+
+		_done_cv.wait(lock, [&job]() { return job->state == job_state::done; });
+
+		handle = job->handle;
+		return handle != 0;
+	}
+
+private:
+	static constexpr size_t look_ahead_frames = 2;
+
+	enum class job_state
+	{
+		queued,
+		running,
+		done
+	};
+
+	struct job
+	{
+		uint64_t offset = 0;
+		reshade::addon_event ev = {};
+		job_state state = job_state::queued;
+		std::shared_ptr<job> layout;
+		uint64_t layout_handle = 0;
+		uint64_t handle = 0;
+	};
+
+	void worker_main(const char *path)
+	{
+		trace_data_read trace_data(path);
+		frame_arena arena;
+
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		while (true)
+		{
+			_queue_cv.wait(lock, [this]() { return _exit || !_queue.empty(); });
+			if (_exit)
+				break;
+
+			const std::shared_ptr<job> job = std::move(_queue.front());
+			_queue.pop_front();
+
+			job->state = job_state::running;
+			_running++;
+
+			// Layouts are queued before the pipelines using them, so they are already being created by another thread at this point
+			if (job->layout != nullptr)
+			{
+				_done_cv.wait(lock, [&job]() { return job->layout->state == job_state::done; });
+				job->layout_handle = job->layout->handle;
+				job->layout.reset();
+			}
+
+			lock.unlock();
+
+			trace_data.seek(job->offset + sizeof(trace_event_tag));
+
+			uint64_t handle = 0;
+			switch (job->ev)
+			{
+			case reshade::addon_event::init_resource:
+			{
+				init_resource_data data;
+				read_init_resource(trace_data, arena, _device->get_api(), data);
+
+				resource object = {};
+				if (_device->create_resource(data.desc, data.initial_data, data.initial_state, &object))
+					handle = object.handle;
+				break;
+			}
+			case reshade::addon_event::init_pipeline_layout:
+			{
+				init_pipeline_layout_data data;
+				read_init_pipeline_layout(trace_data, arena, data);
+
+				pipeline_layout object = {};
+				if (_device->create_pipeline_layout(data.param_count, data.params, &object))
+					handle = object.handle;
+				break;
+			}
+			case reshade::addon_event::init_pipeline:
+			{
+				init_pipeline_data data;
+				read_init_pipeline(trace_data, arena, data);
+
+				// Nothing to create if the layout failed
+				pipeline object = {};
+				if ((data.layout == 0 || job->layout_handle != 0) && _device->create_pipeline({ job->layout_handle }, data.subobject_count, data.subobjects, &object))
+					handle = object.handle;
+				break;
+			}
+			}
+
+			trace_data.release_data();
+			arena.reset();
+
+			lock.lock();
+
+			job->handle = handle;
+			job->state = job_state::done;
+			_running--;
+
+			_done_cv.notify_all();
+		}
+	}
+
+	const trace_index &_index;
+	device *const _device;
+	trace_data_read _scan;
+	frame_arena _scan_arena;
+	size_t _scan_index = SIZE_MAX;
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _queue_cv;
+	std::condition_variable _done_cv;
+	std::deque<std::shared_ptr<job>> _queue;
+	std::unordered_map<uint64_t, std::shared_ptr<job>> _jobs;
+	std::unordered_map<uint64_t, std::shared_ptr<job>> _layout_jobs;
+	uint32_t _running = 0;
+	bool _exit = false;
+};
+
+static std::unique_ptr<object_prefetcher> s_prefetcher;
+
+static bool take_prefetched_object(uint64_t offset, uint64_t &handle)
+{
+	return s_prefetcher != nullptr && s_prefetcher->take(offset, handle);
+}
+
+// Only enabled for APIs that allow creating objects from multiple threads
+void enable_prefetch(const char *path, const trace_index &index, device *device)
+{
+	if (device->get_api() == device_api::d3d11 || device->get_api() == device_api::d3d12 || device->get_api() == device_api::vulkan)
+		s_prefetcher = std::make_unique<object_prefetcher>(path, index, device);
+}
+void disable_prefetch()
+{
+	s_prefetcher.reset();
+}
+
+// Creates all unique pipelines of the trace before playback starts, spread across multiple threads, so that the first pass through the frames does not include compile times
+void warm_up_pipelines(const char *path, const trace_index &index, device *device)
+{
+	s_pipeline_cache = std::make_unique<pipeline_cache>(device);
+
+	trace_data_read trace_data(path);
+	frame_arena arena;
+
+	// Layouts are cheap to create, so do those right away while collecting the pipelines in stream order
+	struct pipeline_job
+	{
+		uint64_t offset;
+		uint64_t key;
+		uint64_t layout_key;
+	};
+
+	std::vector<pipeline_job> jobs;
+	std::vector<uint64_t> layout_keys(1);
+	std::unordered_map<uint64_t, size_t> job_keys;
+
+	for (const uint64_t offset : index.state_offsets)
+	{
+		trace_data.seek(offset);
+		const auto ev = trace_data.read_event();
+		const uint64_t begin = trace_data.tell();
+
+		if (ev == reshade::addon_event::init_pipeline_layout)
+		{
+			init_pipeline_layout_data data;
+			read_init_pipeline_layout(trace_data, arena, data);
 
-			subobjects[i].count = 1;
-			subobjects[i].data = &rasterizer_state;
-			break;
+			const uint64_t key = hash_event_data(trace_data, arena, begin, trace_data.tell() - sizeof(pipeline_layout));
+			s_pipeline_cache->create_pipeline_layout(key, data.param_count, data.params);
+			init_object(layout_keys, data.handle) = key;
 		}
-		case pipeline_subobject_type::depth_stencil_state:
+		else if (ev == reshade::addon_event::init_pipeline)
 		{
-			depth_stencil_state = trace_data.read<depth_stencil_desc>();
+			init_pipeline_data data;
+			read_init_pipeline(trace_data, arena, data);
 
-			subobjects[i].count = 1;
-			subobjects[i].data = &depth_stencil_state;
-			break;
-		}
-		case pipeline_subobject_type::stream_output_state:
-		case pipeline_subobject_type::primitive_topology:
-		case pipeline_subobject_type::depth_stencil_format:
-		case pipeline_subobject_type::render_target_formats:
-		case pipeline_subobject_type::sample_mask:
-		case pipeline_subobject_type::sample_count:
-		case pipeline_subobject_type::viewport_count:
-		case pipeline_subobject_type::dynamic_pipeline_states:
-		case pipeline_subobject_type::max_vertex_count:
-			break;
+			const uint64_t layout_key = data.layout < layout_keys.size() ? layout_keys[static_cast<size_t>(data.layout)] : 0;
+			const uint64_t key = hash_init_pipeline(data, layout_key);
+			if (job_keys.try_emplace(key, jobs.size()).second)
+				jobs.push_back({ offset, key, layout_key });
 		}
+
+		trace_data.release_data();
+		arena.reset();
 	}
 
+	std::atomic<size_t> next_job = 0;
+
+	const auto worker_main = [&]() {
+		trace_data_read trace_data(path);
+		frame_arena arena;
 
-	const auto handle = trace_data.read<pipeline>().handle;
+		for (size_t i; (i = next_job++) < jobs.size();)
+		{
+			trace_data.seek(jobs[i].offset + sizeof(trace_event_tag));
 
-	if (s_pipelines.find(handle) != s_pipelines.end())
-		device->destroy_pipeline(s_pipelines[handle]);
+			init_pipeline_data data;
+			read_init_pipeline(trace_data, arena, data);
 
-	if (!device->create_pipeline(s_pipeline_layouts[layout], subobject_count, subobjects.data(), &s_pipelines[handle]))
-		assert(false);
+			s_pipeline_cache->create_pipeline(jobs[i].key, jobs[i].layout_key, data.subobject_count, data.subobjects);
+
+			trace_data.release_data();
+			arena.reset();
+		}
+	};
+
+	// Objects of D3D9 and OpenGL devices may only be created on the thread the device belongs to
+	if (device->get_api() == device_api::d3d9 || device->get_api() == device_api::opengl)
+	{
+		worker_main();
+		return;
+	}
+
+	std::vector<std::thread> threads(std::max(std::thread::hardware_concurrency(), 1u));
+	for (std::thread &thread : threads)
+		thread = std::thread(worker_main);
+	for (std::thread &thread : threads)
+		thread.join();
 }
-static void play_destroy_pipeline(trace_data_read &trace_data, device *device)
+// Only enabled for APIs that do not track resource states explicitly, since a recycled resource would otherwise still be in whatever state the trace last transitioned it to
+void enable_resource_pool(device *device)
 {
-	const auto handle = trace_data.read<pipeline>().handle;
-
-	device->destroy_pipeline(s_pipelines[handle]);
-	s_pipelines[handle] = {};
+	if (device->get_api() == device_api::d3d9 || device->get_api() == device_api::d3d10 || device->get_api() == device_api::d3d11 || device->get_api() == device_api::opengl)
+		s_resource_pool = std::make_unique<resource_pool>(device);
+}
+void release_resource_pool()
+{
+	s_resource_pool.reset();
 }
 
-static void play_init_pipeline_layout(trace_data_read &trace_data, device *device)
+void release_pipeline_cache()
 {
-	const auto param_count = trace_data.read<uint32_t>();
+	s_pipeline_cache.reset();
+}
 
-	std::vector<pipeline_layout_param> params(param_count);
-	std::vector<std::vector<descriptor_range>> ranges(param_count);
-	std::vector<std::vector<descriptor_range_with_static_samplers>> ranges_with_static_samplers(param_count);
+static const uint64_t *read_descriptors(trace_data_read &trace_data, descriptor_type type, uint32_t count)
+{
+	uint64_t *const descriptors = s_frame_arena.allocate<uint64_t>(count * 3);
 
-	for (uint32_t i = 0; i < param_count; ++i)
+	for (uint32_t i = 0; i < count; ++i)
 	{
-		params[i].type = trace_data.read<pipeline_layout_param_type>();
-
-		switch (params[i].type)
+		switch (type)
 		{
-		case pipeline_layout_param_type::push_constants:
-			params[i].push_constants = trace_data.read<decltype(params[i].push_constants)>();
+		case descriptor_type::sampler:
+			descriptors[i] = find_object(s_samplers, read_object<sampler>(trace_data).handle).handle;
 			break;
-		case pipeline_layout_param_type::push_descriptors:
-			params[i].push_descriptors = trace_data.read<decltype(params[i].push_descriptors)>();
+		case descriptor_type::sampler_with_resource_view:
+			descriptors[i * 2 + 0] = find_object(s_samplers, read_object<sampler>(trace_data).handle).handle;
+			descriptors[i * 2 + 1] = find_object(s_resource_views, read_object<resource_view>(trace_data).handle).handle;
 			break;
-		case pipeline_layout_param_type::descriptor_table:
-		case pipeline_layout_param_type::push_descriptors_with_ranges:
-			params[i].descriptor_table.count = trace_data.read<uint32_t>();
-			ranges[i].resize(params[i].descriptor_table.count);
-			for (uint32_t k = 0; k < params[i].descriptor_table.count; ++k)
-				ranges[i][k] = trace_data.read<descriptor_range>();
-			params[i].descriptor_table.ranges = ranges[i].data();
+		case descriptor_type::buffer_shader_resource_view:
+		case descriptor_type::buffer_unordered_access_view:
+		case descriptor_type::texture_shader_resource_view:
+		case descriptor_type::texture_unordered_access_view:
+			descriptors[i] = find_object(s_resource_views, read_object<resource_view>(trace_data).handle).handle;
 			break;
-		case pipeline_layout_param_type::descriptor_table_with_static_samplers:
-		case pipeline_layout_param_type::push_descriptors_with_static_samplers:
-			params[i].descriptor_table_with_static_samplers.count = trace_data.read<uint32_t>();
-			ranges_with_static_samplers[i].resize(params[i].descriptor_table_with_static_samplers.count);
-			for (uint32_t k = 0; k < params[i].descriptor_table_with_static_samplers.count; ++k)
-				ranges_with_static_samplers[i][k] = trace_data.read<descriptor_range_with_static_samplers>();
-			params[i].descriptor_table_with_static_samplers.ranges = ranges_with_static_samplers[i].data();
+		case descriptor_type::constant_buffer:
+		case descriptor_type::shader_storage_buffer:
+			descriptors[i * 3 + 0] = find_object(s_resources, read_object<resource>(trace_data).handle).handle;
+			descriptors[i * 3 + 1] = trace_data.read<uint64_t>();
+			descriptors[i * 3 + 2] = trace_data.read<uint64_t>();
+			break;
+		default:
+			assert(false);
 			break;
 		}
 	}
 
-	const auto handle = trace_data.read<pipeline_layout>().handle;
-
-	if (!device->create_pipeline_layout(param_count, params.data(), &s_pipeline_layouts[handle]))
-		assert(false);
-}
-static void play_destroy_pipeline_layout(trace_data_read &trace_data, device *device)
-{
-	const auto handle = trace_data.read<pipeline_layout>().handle;
-
-	device->destroy_pipeline_layout(s_pipeline_layouts[handle]);
-	s_pipeline_layouts[handle] = {};
+	return descriptors;
 }
 
 static void play_copy_descriptor_tables(trace_data_read &trace_data, device *device)
 {
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<descriptor_table_copy> copies(count);
+	descriptor_table_copy *const copies = s_frame_arena.allocate<descriptor_table_copy>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 	{
@@ -364,18 +1368,17 @@ static void play_copy_descriptor_tables(trace_data_read &trace_data, device *dev
 		copy = trace_data.read<descriptor_table_copy>();
 
 		// TODO: Create these tables somehow
-		copy.source_table = s_descriptor_tables[copy.source_table.handle];
-		copy.dest_table = s_descriptor_tables[copy.dest_table.handle];
+		copy.source_table = find_descriptor_table(copy.source_table.handle);
+		copy.dest_table = find_descriptor_table(copy.dest_table.handle);
 	}
 
-	device->copy_descriptor_tables(count, copies.data());
+	device->copy_descriptor_tables(count, copies);
 }
 static void play_update_descriptor_tables(trace_data_read &trace_data, device *device)
 {
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<descriptor_table_update> updates(count);
-	std::vector<std::vector<uint64_t>> descriptors(count);
+	descriptor_table_update *const updates = s_frame_arena.allocate<descriptor_table_update>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 	{
@@ -384,82 +1387,125 @@ static void play_update_descriptor_tables(trace_data_read &trace_data, device *d
 		const auto table_handle = trace_data.read<descriptor_table>().handle;
 
 		// TODO: Create this table somehow
-		update.table = s_descriptor_tables[table_handle];
+		update.table = find_descriptor_table(table_handle);
 		update.binding = trace_data.read<uint32_t>();
 		update.array_offset = trace_data.read<uint32_t>();
 		update.count = trace_data.read<uint32_t>();
 		update.type = trace_data.read<descriptor_type>();
 
-		uint64_t handle[3] = {};
-		descriptors[i].resize(update.count * 3);
-
-		for (uint32_t k = 0; k < update.count; ++k)
-		{
-			switch (update.type)
-			{
-			case descriptor_type::sampler:
-				trace_data.read(handle, sizeof(*handle));
-				descriptors[i][k] = s_samplers[handle[0]].handle;
-				break;
-			case descriptor_type::shader_resource_view:
-			case descriptor_type::unordered_access_view:
-			case descriptor_type::shader_storage_buffer:
-				trace_data.read(handle, sizeof(*handle));
-				descriptors[i][k] = s_resource_views[handle[0]].handle;
-				break;
-			case descriptor_type::sampler_with_resource_view:
-				trace_data.read(handle, sizeof(*handle) * 2);
-				descriptors[i][k * 2 + 0] = s_samplers[handle[0]].handle;
-				descriptors[i][k * 2 + 1] = s_resource_views[handle[1]].handle;
-				break;
-			case descriptor_type::constant_buffer:
-				trace_data.read(handle, sizeof(*handle) * 3);
-				descriptors[i][k * 3 + 0] = s_resources[handle[0]].handle;
-				descriptors[i][k * 3 + 1] = handle[1];
-				descriptors[i][k * 3 + 2] = handle[2];
-				break;
-			}
-		}
-
-		update.descriptors = descriptors.data();
+		update.descriptors = read_descriptors(trace_data, update.type, update.count);
 	}
 
-	device->update_descriptor_tables(count, updates.data());
+	device->update_descriptor_tables(count, updates);
 }
 
 static void play_map_buffer_region(trace_data_read &trace_data, device *device)
 {
-	trace_data.read<resource>();
-	trace_data.read<uint64_t>();
-	trace_data.read<uint64_t>();
-	trace_data.read<map_access>();
+	report_object(trace_data.read<trace_event_payload<reshade::addon_event::map_buffer_region>>().buffer);
 }
 static void play_unmap_buffer_region(trace_data_read &trace_data, device *device)
 {
-	const auto handle = trace_data.read<resource>().handle;
-	const auto offset = trace_data.read<uint64_t>();
-	const auto size = trace_data.read<uint64_t>();
-	const auto access = trace_data.read<map_access>();
+	const auto payload = trace_data.read<trace_event_payload<reshade::addon_event::unmap_buffer_region>>();
+	const auto handle = report_object(payload.buffer).handle;
+	const auto offset = payload.offset;
+	const auto size = payload.size;
+	const auto access = payload.access;
 
 	if (access != map_access::read_only)
 	{
-		std::vector<uint8_t> data(static_cast<size_t>(size));
-		trace_data.read(data.data(), static_cast<size_t>(size));
+		const void *data = nullptr;
+
+		switch (trace_data.read<trace_buffer_encoding>())
+		{
+		case trace_buffer_encoding::raw:
+			data = trace_data.read_blob(static_cast<size_t>(size));
+			break;
+		case trace_buffer_encoding::raw_and_keep:
+		{
+			data = trace_data.read_blob(static_cast<size_t>(size));
+			if (data == nullptr)
+				break;
+
+			std::vector<uint8_t> &contents = init_object(s_buffer_contents, handle);
+			if (contents.size() < offset + size)
+				contents.resize(static_cast<size_t>(offset + size));
+			std::memcpy(contents.data() + offset, data, static_cast<size_t>(size));
+			break;
+		}
+		case trace_buffer_encoding::delta:
+		{
+			std::vector<uint8_t> &contents = init_object(s_buffer_contents, handle);
+			if (contents.size() < offset + size)
+				contents.resize(static_cast<size_t>(offset + size));
+
+			// Ranges outside the mapping or past the end of the trace can only come from a corrupt or truncated trace, which leaves the contents incomplete, so the mapping is skipped
+			bool valid = true;
+			const auto range_count = trace_data.read<uint32_t>();
+			for (uint32_t i = 0; i < range_count; ++i)
+			{
+				const auto range_offset = trace_data.read<uint32_t>();
+				const auto range_size = trace_data.read<uint32_t>();
+				const void *const range_data = trace_data.read_data(range_size);
+				if (range_data == nullptr)
+				{
+					valid = false;
+					break;
+				}
+
+				assert(range_offset <= size && range_size <= size - range_offset);
+				if (range_offset > size || range_size > size - range_offset)
+				{
+					valid = false;
+					continue;
+				}
+
+				std::memcpy(contents.data() + offset + range_offset, range_data, range_size);
+			}
+
+			if (valid)
+				data = contents.data() + offset;
+			break;
+		}
+		default:
+			assert(false);
+			break;
+		}
 
-		if (s_resources[handle] == 0)
+		const resource object = find_object(s_resources, handle);
+		if (object == 0 || data == nullptr)
 			return;
 
 		void *mapped_data = nullptr;
-		if (device->map_buffer_region(s_resources[handle], offset, size, access, &mapped_data))
+		if (device->map_buffer_region(object, offset, size, access, &mapped_data))
 		{
-			std::memcpy(mapped_data, data.data(), data.size());
-			device->unmap_buffer_region(s_resources[handle]);
+			std::memcpy(mapped_data, data, static_cast<size_t>(size));
+			device->unmap_buffer_region(object);
 		}
 	}
 }
+// Copies texture data into a mapping, which may have different row and slice pitches than the data was recorded with (e.g. if rows were packed during capture)
+static void copy_texture_rows(const subresource_data &dst, const subresource_data &src, size_t size)
+{
+	if (src.row_pitch == 0 || (src.row_pitch == dst.row_pitch && src.slice_pitch == dst.slice_pitch))
+	{
+		std::memcpy(dst.data, src.data, size);
+		return;
+	}
+
+	const size_t row_size = std::min(src.row_pitch, dst.row_pitch);
+	const size_t rows = std::min<size_t>(src.slice_pitch != 0 ? src.slice_pitch / src.row_pitch : SIZE_MAX, size / src.row_pitch);
+	const size_t slices = src.slice_pitch != 0 ? std::max<size_t>(size / src.slice_pitch, 1) : 1;
+
+	for (size_t slice = 0; slice < slices; ++slice)
+		for (size_t row = 0; row < rows; ++row)
+			std::memcpy(
+				static_cast<uint8_t *>(dst.data) + slice * dst.slice_pitch + row * dst.row_pitch,
+				static_cast<const uint8_t *>(src.data) + slice * src.slice_pitch + row * src.row_pitch, row_size);
+}
+
 static void play_map_texture_region(trace_data_read &trace_data, device *device)
 {
-	trace_data.read<resource>();
+	read_object<resource>(trace_data);
 	trace_data.read<uint32_t>();
 	const bool has_box = trace_data.read<bool>();
 	has_box ? trace_data.read<subresource_box>() : subresource_box {};
@@ -467,7 +1513,7 @@ static void play_map_texture_region(trace_data_read &trace_data, device *device)
 }
 static void play_unmap_texture_region(trace_data_read &trace_data, device *device)
 {
-	const auto handle = trace_data.read<resource>().handle;
+	const auto handle = read_object<resource>(trace_data).handle;
 	const auto subresource = trace_data.read<uint32_t>();
 	const bool has_box = trace_data.read<bool>();
 	const auto box = has_box ? trace_data.read<subresource_box>() : subresource_box {};
@@ -475,86 +1521,133 @@ static void play_unmap_texture_region(trace_data_read &trace_data, device *devic
 
 	if (access != map_access::read_only)
 	{
-		std::vector<uint8_t> data(static_cast<size_t>(trace_data.read<uint64_t>()));
-		trace_data.read(data.data(), data.size());
+		subresource_data data = {};
+		data.row_pitch = trace_data.read<uint32_t>();
+		data.slice_pitch = trace_data.read<uint32_t>();
 
-		if (s_resources[handle] == 0)
+		const auto size = static_cast<size_t>(trace_data.read<uint64_t>());
+		data.data = const_cast<void *>(trace_data.read_blob(size));
+
+		const resource object = find_object(s_resources, handle);
+		if (object == 0)
 			return;
 
 		subresource_data mapped_data = {};
-		if (device->map_texture_region(s_resources[handle], subresource, has_box ? &box : nullptr, access, &mapped_data))
+		if (device->map_texture_region(object, subresource, has_box ? &box : nullptr, access, &mapped_data))
 		{
-			std::memcpy(mapped_data.data, data.data(), data.size());
-			device->unmap_texture_region(s_resources[handle], subresource);
+			copy_texture_rows(mapped_data, data, size);
+			device->unmap_texture_region(object, subresource);
 		}
 	}
 }
 static void play_update_buffer_region(trace_data_read &trace_data, device *device)
 {
-	const auto handle = trace_data.read<resource>().handle;
-	const auto offset = trace_data.read<uint64_t>();
-	const auto size = trace_data.read<uint64_t>();
+	const auto payload = trace_data.read<trace_event_payload<reshade::addon_event::update_buffer_region>>();
+	const auto handle = report_object(payload.buffer).handle;
+	const auto offset = payload.offset;
+	const auto size = payload.size;
 
-	std::vector<uint8_t> data(static_cast<size_t>(size));
-	trace_data.read(data.data(), data.size());
+	const void *const data = trace_data.read_blob(static_cast<size_t>(size));
 
-	if (data.empty() || s_resources[handle] == 0)
+	const resource object = find_object(s_resources, handle);
+	if (size == 0 || object == 0)
 		return;
 
-	device->update_buffer_region(data.data(), s_resources[handle], offset, size);
+	// Buffers the CPU can write to (upload heaps) cannot be the destination of a copy in all APIs, so write to them through a mapping instead
+	if (device->get_resource_desc(object).heap != memory_heap::gpu_only)
+	{
+		void *mapped_data = nullptr;
+		if (device->map_buffer_region(object, offset, size, map_access::write_only, &mapped_data))
+		{
+			std::memcpy(mapped_data, data, static_cast<size_t>(size));
+			device->unmap_buffer_region(object);
+			return;
+		}
+	}
+
+	device->update_buffer_region(data, object, offset, size);
 }
 static void play_update_texture_region(trace_data_read &trace_data, device *device)
 {
-	const auto handle = trace_data.read<resource>().handle;
-	const auto subresource = trace_data.read<uint32_t>();
-	const bool has_box = trace_data.read<bool>();
+	const auto payload = trace_data.read<trace_event_payload<reshade::addon_event::update_texture_region>>();
+	const auto handle = report_object(payload.texture).handle;
+	const auto subresource = payload.subresource;
+	const bool has_box = payload.has_box;
 	const auto box = has_box ? trace_data.read<subresource_box>() : subresource_box {};
 
 	subresource_data subresource_data = {};
 	subresource_data.row_pitch = trace_data.read<uint32_t>();
 	subresource_data.slice_pitch = trace_data.read<uint32_t>();
 
-	std::vector<uint8_t> data(static_cast<size_t>(trace_data.read<uint64_t>()));
-	trace_data.read(data.data(), data.size());
+	const auto size = trace_data.read<uint64_t>();
+	subresource_data.data = const_cast<void *>(trace_data.read_blob(static_cast<size_t>(size)));
 
-	if (data.empty() || s_resources[handle] == 0)
+	const resource object = find_object(s_resources, handle);
+	if (size == 0 || object == 0)
 		return;
 
-	subresource_data.data = data.data();
+	device->update_texture_region(subresource_data, object, subresource, has_box ? &box : nullptr);
+}
 
-	device->update_texture_region(subresource_data, s_resources[handle], subresource, has_box ? &box : nullptr);
+static void skip_snapshot_data(trace_data_read &trace_data)
+{
+	switch (trace_data.read_event())
+	{
+	case reshade::addon_event::update_buffer_region:
+	{
+		const auto payload = trace_data.read<trace_event_payload<reshade::addon_event::update_buffer_region>>();
+		report_object(payload.buffer);
+		trace_data.skip_blob(static_cast<size_t>(payload.size));
+		break;
+	}
+	case reshade::addon_event::update_texture_region:
+	{
+		const auto payload = trace_data.read<trace_event_payload<reshade::addon_event::update_texture_region>>();
+		report_object(payload.texture);
+		if (payload.has_box)
+			trace_data.read<subresource_box>();
+		trace_data.read<uint32_t>();
+		trace_data.read<uint32_t>();
+		const auto size = trace_data.read<uint64_t>();
+		trace_data.skip_blob(static_cast<size_t>(size));
+		break;
+	}
+	default:
+		assert(false);
+		break;
+	}
 }
 
 static void play_barrier(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto count = trace_data.read<uint32_t>();
+	const auto count = static_cast<uint32_t>(trace_data.read_varint());
 
-	std::vector<resource> resources(count);
-	std::vector<resource_usage> old_states(count);
-	std::vector<resource_usage> new_states(count);
+	resource *const resources = s_frame_arena.allocate<resource>(count);
+	resource_usage *const old_states = s_frame_arena.allocate<resource_usage>(count);
+	resource_usage *const new_states = s_frame_arena.allocate<resource_usage>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 	{
-		const auto handle = trace_data.read<resource>().handle;
+		const auto barrier = read_compact<trace_resource_barrier>(trace_data);
 
-		resources[i] = s_resources[handle];
-		old_states[i] = trace_data.read<resource_usage>();
-		new_states[i] = trace_data.read<resource_usage>();
+		resources[i] = find_object(s_resources, report_object(barrier.resource).handle);
+		old_states[i] = barrier.old_state;
+		new_states[i] = barrier.new_state;
 	}
 
-	cmd_list->barrier(count, resources.data(), old_states.data(), new_states.data());
+	cmd_list->barrier(count, resources, old_states, new_states);
 }
 
 static void play_begin_render_pass(trace_data_read &trace_data, command_list *cmd_list)
 {
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<render_pass_render_target_desc> rts(count);
+	render_pass_render_target_desc *const rts = s_frame_arena.allocate<render_pass_render_target_desc>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 	{
 		rts[i] = trace_data.read<render_pass_render_target_desc>();
-		rts[i].view = s_resource_views[rts[i].view.handle];
+		rts[i].view = find_object(s_resource_views, rts[i].view.handle);
 	}
 
 	const bool has_ds = trace_data.read<bool>();
@@ -563,10 +1656,10 @@ static void play_begin_render_pass(trace_data_read &trace_data, command_list *cm
 	if (has_ds)
 	{
 		ds = trace_data.read<render_pass_depth_stencil_desc>();
-		ds.view = s_resource_views[ds.view.handle];
+		ds.view = find_object(s_resource_views, ds.view.handle);
 	}
 
-	cmd_list->begin_render_pass(count, rts.data(), has_ds ? &ds : nullptr);
+	cmd_list->begin_render_pass(count, rts, has_ds ? &ds : nullptr);
 }
 static void play_end_render_pass(trace_data_read &trace_data, command_list *cmd_list)
 {
@@ -576,33 +1669,32 @@ static void play_bind_render_targets_and_depth_stencil(trace_data_read &trace_da
 {
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<resource_view> rtvs(count);
+	resource_view *const rtvs = s_frame_arena.allocate<resource_view>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 	{
-		const auto rtv_handle = trace_data.read<resource_view>().handle;
+		const auto rtv_handle = read_object<resource_view>(trace_data).handle;
 
-		rtvs[i] = s_resource_views[rtv_handle];
+		rtvs[i] = find_object(s_resource_views, rtv_handle);
 	}
 
-	const auto dsv_handle = trace_data.read<resource_view>().handle;
+	const auto dsv_handle = read_object<resource_view>(trace_data).handle;
 
-	cmd_list->bind_render_targets_and_depth_stencil(count, rtvs.data(), s_resource_views[dsv_handle]);
+	cmd_list->bind_render_targets_and_depth_stencil(count, rtvs, find_object(s_resource_views, dsv_handle));
 }
 
 static void play_bind_pipeline(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto stages = trace_data.read<pipeline_stage>();
-	const auto handle = trace_data.read<pipeline>().handle;
+	const auto data = read_compact<trace_event_payload<reshade::addon_event::bind_pipeline>>(trace_data);
 
-	cmd_list->bind_pipeline(stages, s_pipelines[handle]);
+	cmd_list->bind_pipeline(data.stages, find_object(s_pipelines, report_object(data.pipeline).handle));
 }
 static void play_bind_pipeline_states(trace_data_read &trace_data, command_list *cmd_list)
 {
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<dynamic_state> states(count);
-	std::vector<uint32_t> values(count);
+	dynamic_state *const states = s_frame_arena.allocate<dynamic_state>(count);
+	uint32_t *const values = s_frame_arena.allocate<uint32_t>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 	{
@@ -610,52 +1702,49 @@ static void play_bind_pipeline_states(trace_data_read &trace_data, command_list
 		values[i] = trace_data.read<uint32_t>();
 	}
 
-	cmd_list->bind_pipeline_states(count, states.data(), values.data());
+	cmd_list->bind_pipeline_states(count, states, values);
 }
 static void play_bind_viewports(trace_data_read &trace_data, command_list *cmd_list)
 {
 	const auto first = trace_data.read<uint32_t>();
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<viewport> viewports(count);
+	viewport *const viewports = s_frame_arena.allocate<viewport>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 		viewports[i] = trace_data.read<viewport>();
 
-	cmd_list->bind_viewports(first, count, viewports.data());
+	cmd_list->bind_viewports(first, count, viewports);
 }
 static void play_bind_scissor_rects(trace_data_read &trace_data, command_list *cmd_list)
 {
 	const auto first = trace_data.read<uint32_t>();
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<rect> rects(count);
+	rect *const rects = s_frame_arena.allocate<rect>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 		rects[i] = trace_data.read<rect>();
 
-	cmd_list->bind_scissor_rects(first, count, rects.data());
+	cmd_list->bind_scissor_rects(first, count, rects);
 }
 static void play_push_constants(trace_data_read &trace_data, command_list *cmd_list)
 {
 	const auto stages = trace_data.read<shader_stage>();
-	const auto layout = trace_data.read<pipeline_layout>().handle;
+	const auto layout = read_object<pipeline_layout>(trace_data).handle;
 	const auto param = trace_data.read<uint32_t>();
 
 	const auto first = trace_data.read<uint32_t>();
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<uint32_t> values(count);
+	const void *const values = trace_data.read_data(count * sizeof(uint32_t));
 
-	for (uint32_t i = 0; i < count; ++i)
-		values[i] = trace_data.read<uint32_t>();
-
-	cmd_list->push_constants(stages, s_pipeline_layouts[layout], param, first, count, values.data());
+	cmd_list->push_constants(stages, find_object(s_pipeline_layouts, layout), param, first, count, values);
 }
 static void play_push_descriptors(trace_data_read &trace_data, command_list *cmd_list)
 {
 	const auto stages = trace_data.read<shader_stage>();
-	const auto layout = trace_data.read<pipeline_layout>().handle;
+	const auto layout = read_object<pipeline_layout>(trace_data).handle;
 	const auto param = trace_data.read<uint32_t>();
 
 	descriptor_table_update update = {};
@@ -664,458 +1753,533 @@ static void play_push_descriptors(trace_data_read &trace_data, command_list *cmd
 	update.count = trace_data.read<uint32_t>();
 	update.type = trace_data.read<descriptor_type>();
 
-	uint64_t handle[3] = {};
-	std::vector<uint64_t> descriptors(update.count * 3);
-
-	for (uint32_t i = 0; i < update.count; ++i)
-	{
-		switch (update.type)
-		{
-		case descriptor_type::sampler:
-			trace_data.read(handle, sizeof(*handle));
-			descriptors[i] = s_samplers[handle[0]].handle;
-			break;
-		case descriptor_type::shader_resource_view:
-		case descriptor_type::unordered_access_view:
-		case descriptor_type::shader_storage_buffer:
-			trace_data.read(handle, sizeof(*handle));
-			descriptors[i] = s_resource_views[handle[0]].handle;
-			break;
-		case descriptor_type::sampler_with_resource_view:
-			trace_data.read(handle, sizeof(*handle) * 2);
-			descriptors[i * 2 + 0] = s_samplers[handle[0]].handle;
-			descriptors[i * 2 + 1] = s_resource_views[handle[1]].handle;
-			break;
-		case descriptor_type::constant_buffer:
-			trace_data.read(handle, sizeof(*handle) * 3);
-			descriptors[i * 3 + 0] = s_resources[handle[0]].handle;
-			descriptors[i * 3 + 1] = handle[1];
-			descriptors[i * 3 + 2] = handle[2];
-			break;
-		}
-	}
-
-	update.descriptors = descriptors.data();
+	update.descriptors = read_descriptors(trace_data, update.type, update.count);
 
-	cmd_list->push_descriptors(stages, s_pipeline_layouts[layout], param, update);
+	cmd_list->push_descriptors(stages, find_object(s_pipeline_layouts, layout), param, update);
 }
 static void play_bind_descriptor_tables(trace_data_read &trace_data, command_list *cmd_list)
 {
 	const auto stages = trace_data.read<shader_stage>();
-	const auto layout = trace_data.read<pipeline_layout>().handle;
+	const auto layout = read_object<pipeline_layout>(trace_data).handle;
 	const auto first = trace_data.read<uint32_t>();
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<descriptor_table> tables(count);
+	descriptor_table *const tables = s_frame_arena.allocate<descriptor_table>(count);
 	for (uint32_t i = 0; i < count; ++i)
 	{
 		const auto table = trace_data.read<descriptor_table>().handle;
 
-		tables[i] = s_descriptor_tables[table];
+		tables[i] = find_descriptor_table(table);
 	}
 
-	cmd_list->bind_descriptor_tables(stages, s_pipeline_layouts[layout], first, count, tables.data());
+	cmd_list->bind_descriptor_tables(stages, find_object(s_pipeline_layouts, layout), first, count, tables);
 }
 static void play_bind_index_buffer(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto handle = trace_data.read<resource>().handle;
-	const auto offset = trace_data.read<uint64_t>();
-	const auto index_size = trace_data.read<uint32_t>();
+	const auto data = read_compact<trace_event_payload<reshade::addon_event::bind_index_buffer>>(trace_data);
 
-	cmd_list->bind_index_buffer(s_resources[handle], offset, index_size);
+	cmd_list->bind_index_buffer(find_object(s_resources, report_object(data.buffer).handle), data.offset, data.index_size);
 }
 static void play_bind_vertex_buffers(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto first = trace_data.read<uint32_t>();
-	const auto count = trace_data.read<uint32_t>();
+	const auto first = static_cast<uint32_t>(trace_data.read_varint());
+	const auto count = static_cast<uint32_t>(trace_data.read_varint());
 
-	std::vector<resource> buffers(count);
-	std::vector<uint64_t> offsets(count);
-	std::vector<uint32_t> strides(count);
+	resource *const buffers = s_frame_arena.allocate<resource>(count);
+	uint64_t *const offsets = s_frame_arena.allocate<uint64_t>(count);
+	uint32_t *const strides = s_frame_arena.allocate<uint32_t>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 	{
-		const auto handle = trace_data.read<resource>().handle;
+		const auto binding = read_compact<trace_vertex_buffer_binding>(trace_data);
 
-		buffers[i] = s_resources[handle];
-		offsets[i] = trace_data.read<uint64_t>();
-		strides[i] = trace_data.read<uint32_t>();
+		buffers[i] = find_object(s_resources, report_object(binding.buffer).handle);
+		offsets[i] = binding.offset;
+		strides[i] = binding.stride;
 	}
 
-	cmd_list->bind_vertex_buffers(first, count, buffers.data(), offsets.data(), strides.data());
+	cmd_list->bind_vertex_buffers(first, count, buffers, offsets, strides);
 }
 static void play_bind_stream_output_buffers(trace_data_read &trace_data, command_list *cmd_list)
 {
 	const auto first = trace_data.read<uint32_t>();
 	const auto count = trace_data.read<uint32_t>();
 
-	std::vector<resource> buffers(count);
-	std::vector<uint64_t> offsets(count);
-	std::vector<uint64_t> max_sizes(count);
-	std::vector<resource> counter_buffers(count);
-	std::vector<uint64_t> counter_offsets(count);
+	resource *const buffers = s_frame_arena.allocate<resource>(count);
+	uint64_t *const offsets = s_frame_arena.allocate<uint64_t>(count);
+	uint64_t *const max_sizes = s_frame_arena.allocate<uint64_t>(count);
+	resource *const counter_buffers = s_frame_arena.allocate<resource>(count);
+	uint64_t *const counter_offsets = s_frame_arena.allocate<uint64_t>(count);
 
 	for (uint32_t i = 0; i < count; ++i)
 	{
-		const auto handle = trace_data.read<resource>().handle;
+		const auto handle = read_object<resource>(trace_data).handle;
 
-		buffers[i] = s_resources[handle];
+		buffers[i] = find_object(s_resources, handle);
 		offsets[i] = trace_data.read<uint64_t>();
 		max_sizes[i] = trace_data.read<uint64_t>();
 
-		const auto counter_handle = trace_data.read<resource>().handle;
+		const auto counter_handle = read_object<resource>(trace_data).handle;
 
-		counter_buffers[i] = s_resources[counter_handle];
+		counter_buffers[i] = find_object(s_resources, counter_handle);
 		counter_offsets[i] = trace_data.read<uint64_t>();
 	}
 
-	cmd_list->bind_stream_output_buffers(first, count, buffers.data(), offsets.data(), max_sizes.data(), counter_buffers.data(), counter_offsets.data());
+	cmd_list->bind_stream_output_buffers(first, count, buffers, offsets, max_sizes, counter_buffers, counter_offsets);
 }
 
 static void play_draw(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto vertex_count = trace_data.read<uint32_t>();
-	const auto instance_count = trace_data.read<uint32_t>();
-	const auto first_vertex = trace_data.read<uint32_t>();
-	const auto first_instance = trace_data.read<uint32_t>();
+	const auto data = read_compact<trace_event_payload<reshade::addon_event::draw>>(trace_data);
 
-	cmd_list->draw(vertex_count, instance_count, first_vertex, first_instance);
+	cmd_list->draw(data.vertex_count, data.instance_count, data.first_vertex, data.first_instance);
 }
 static void play_draw_indexed(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto index_count = trace_data.read<uint32_t>();
-	const auto instance_count = trace_data.read<uint32_t>();
-	const auto first_index = trace_data.read<uint32_t>();
-	const auto vertex_offset = trace_data.read<int32_t>();
-	const auto first_instance = trace_data.read<uint32_t>();
+	const auto data = read_compact<trace_event_payload<reshade::addon_event::draw_indexed>>(trace_data);
 
-	cmd_list->draw_indexed(index_count, instance_count, first_index, vertex_offset, first_instance);
+	cmd_list->draw_indexed(data.index_count, data.instance_count, data.first_index, data.vertex_offset, data.first_instance);
 }
 static void play_dispatch(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto group_count_x = trace_data.read<uint32_t>();
-	const auto group_count_y = trace_data.read<uint32_t>();
-	const auto group_count_z = trace_data.read<uint32_t>();
+	const auto data = read_compact<trace_event_payload<reshade::addon_event::dispatch>>(trace_data);
 
-	cmd_list->dispatch(group_count_x, group_count_y, group_count_z);
+	cmd_list->dispatch(data.group_count_x, data.group_count_y, data.group_count_z);
 }
 static void play_draw_or_dispatch_indirect(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto type = trace_data.read<indirect_command>();
-	const auto handle = trace_data.read<resource>().handle;
-	const auto offset = trace_data.read<uint64_t>();
-	const auto draw_count = trace_data.read<uint32_t>();
-	const auto stride = trace_data.read<uint32_t>();
+	const auto data = read_compact<trace_event_payload<reshade::addon_event::draw_or_dispatch_indirect>>(trace_data);
 
-	cmd_list->draw_or_dispatch_indirect(type, s_resources[handle], offset, draw_count, stride);
+	cmd_list->draw_or_dispatch_indirect(data.type, find_object(s_resources, report_object(data.buffer).handle), data.offset, data.draw_count, data.stride);
 }
 
 static void play_copy_resource(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto src_handle = trace_data.read<resource>().handle;
-	const auto dst_handle = trace_data.read<resource>().handle;
+	const auto data = trace_data.read<trace_event_payload<reshade::addon_event::copy_resource>>();
 
-	cmd_list->copy_resource(s_resources[src_handle], s_resources[dst_handle]);
+	cmd_list->copy_resource(find_object(s_resources, report_object(data.src).handle), find_object(s_resources, report_object(data.dst).handle));
 }
 static void play_copy_buffer_region(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto src_handle = trace_data.read<resource>().handle;
-	const auto src_offset = trace_data.read<uint64_t>();
-	const auto dst_handle = trace_data.read<resource>().handle;
-	const auto dst_offset = trace_data.read<uint64_t>();
-	const auto size = trace_data.read<uint64_t>();
+	const auto data = trace_data.read<trace_event_payload<reshade::addon_event::copy_buffer_region>>();
 
-	cmd_list->copy_buffer_region(s_resources[src_handle], src_offset, s_resources[dst_handle], dst_offset, size);
+	cmd_list->copy_buffer_region(find_object(s_resources, report_object(data.src).handle), data.src_offset, find_object(s_resources, report_object(data.dst).handle), data.dst_offset, data.size);
 }
 static void play_copy_buffer_to_texture(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto src_handle = trace_data.read<resource>().handle;
+	const auto src_handle = read_object<resource>(trace_data).handle;
 	const auto src_offset = trace_data.read<uint64_t>();
 	const auto row_length = trace_data.read<uint32_t>();
 	const auto slice_height = trace_data.read<uint32_t>();
-	const auto dst_handle = trace_data.read<resource>().handle;
+	const auto dst_handle = read_object<resource>(trace_data).handle;
 	const auto dst_subresource = trace_data.read<uint32_t>();
 	const bool has_dst_box = trace_data.read<bool>();
 	const auto dst_box = has_dst_box ? trace_data.read<subresource_box>() : subresource_box {};
 
-	cmd_list->copy_buffer_to_texture(s_resources[src_handle], src_offset, row_length, slice_height, s_resources[dst_handle], dst_subresource, has_dst_box ? &dst_box : nullptr);
+	cmd_list->copy_buffer_to_texture(find_object(s_resources, src_handle), src_offset, row_length, slice_height, find_object(s_resources, dst_handle), dst_subresource, has_dst_box ? &dst_box : nullptr);
 }
 static void play_copy_texture_region(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto src_handle = trace_data.read<resource>().handle;
+	const auto src_handle = read_object<resource>(trace_data).handle;
 	const auto src_subresource = trace_data.read<uint32_t>();
 	const bool has_src_box = trace_data.read<bool>();
 	const auto src_box = has_src_box ? trace_data.read<subresource_box>() : subresource_box {};
-	const auto dst_handle = trace_data.read<resource>().handle;
+	const auto dst_handle = read_object<resource>(trace_data).handle;
 	const auto dst_subresource = trace_data.read<uint32_t>();
 	const bool has_dst_box = trace_data.read<bool>();
 	const auto dst_box = has_dst_box ? trace_data.read<subresource_box>() : subresource_box {};
 	const auto filter = trace_data.read<filter_mode>();
 
-	cmd_list->copy_texture_region(s_resources[src_handle], src_subresource, has_src_box ? &src_box : nullptr, s_resources[dst_handle], dst_subresource, has_dst_box ? &dst_box : nullptr, filter);
+	cmd_list->copy_texture_region(find_object(s_resources, src_handle), src_subresource, has_src_box ? &src_box : nullptr, find_object(s_resources, dst_handle), dst_subresource, has_dst_box ? &dst_box : nullptr, filter);
 }
 static void play_copy_texture_to_buffer(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto src_handle = trace_data.read<resource>().handle;
+	const auto src_handle = read_object<resource>(trace_data).handle;
 	const auto src_subresource = trace_data.read<uint32_t>();
 	const bool has_src_box = trace_data.read<bool>();
 	const auto src_box = has_src_box ? trace_data.read<subresource_box>() : subresource_box {};
-	const auto dst_handle = trace_data.read<resource>().handle;
+	const auto dst_handle = read_object<resource>(trace_data).handle;
 	const auto dst_offset = trace_data.read<uint64_t>();
 	const auto row_length = trace_data.read<uint32_t>();
 	const auto slice_height = trace_data.read<uint32_t>();
 
-	cmd_list->copy_texture_to_buffer(s_resources[src_handle], src_subresource, has_src_box ? &src_box : nullptr, s_resources[dst_handle], dst_offset, row_length, slice_height);
+	cmd_list->copy_texture_to_buffer(find_object(s_resources, src_handle), src_subresource, has_src_box ? &src_box : nullptr, find_object(s_resources, dst_handle), dst_offset, row_length, slice_height);
 }
 static void play_resolve_texture_region(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto src_handle = trace_data.read<resource>().handle;
+	const auto src_handle = read_object<resource>(trace_data).handle;
 	const auto src_subresource = trace_data.read<uint32_t>();
 	const bool has_src_box = trace_data.read<bool>();
 	const auto src_box = has_src_box ? trace_data.read<subresource_box>() : subresource_box {};
-	const auto dst_handle = trace_data.read<resource>().handle;
+	const auto dst_handle = read_object<resource>(trace_data).handle;
 	const auto dst_subresource = trace_data.read<uint32_t>();
 	const auto dst_x = trace_data.read<int32_t>();
 	const auto dst_y = trace_data.read<int32_t>();
 	const auto dst_z = trace_data.read<int32_t>();
 	const auto resolve_format = trace_data.read<format>();
 
-	cmd_list->resolve_texture_region(s_resources[src_handle], src_subresource, has_src_box ? &src_box : nullptr, s_resources[dst_handle], dst_subresource, dst_x, dst_y, dst_z, resolve_format);
+	cmd_list->resolve_texture_region(find_object(s_resources, src_handle), src_subresource, has_src_box ? &src_box : nullptr, find_object(s_resources, dst_handle), dst_subresource, dst_x, dst_y, dst_z, resolve_format);
 }
 
 static void play_clear_depth_stencil_view(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto dsv_handle = trace_data.read<resource_view>().handle;
+	const auto dsv_handle = read_object<resource_view>(trace_data).handle;
 	const bool has_depth = trace_data.read<bool>();
 	const auto depth = has_depth ? trace_data.read<float>() : 0.0f;
 	const bool has_stencil = trace_data.read<bool>();
 	const auto stencil = has_stencil ? trace_data.read<uint8_t>() : uint8_t(0);
 
-	cmd_list->clear_depth_stencil_view(s_resource_views[dsv_handle], has_depth ? &depth : nullptr, has_stencil ? &stencil : nullptr);
+	cmd_list->clear_depth_stencil_view(find_object(s_resource_views, dsv_handle), has_depth ? &depth : nullptr, has_stencil ? &stencil : nullptr);
 }
 static void play_clear_render_target_view(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto rtv_handle = trace_data.read<resource_view>().handle;
-	float color[4] = {};
-	trace_data.read(color, sizeof(color));
+	const auto data = trace_data.read<trace_event_payload<reshade::addon_event::clear_render_target_view>>();
 
-	cmd_list->clear_render_target_view(s_resource_views[rtv_handle], color);
+	cmd_list->clear_render_target_view(find_object(s_resource_views, report_object(data.rtv).handle), data.color);
 }
 static void play_clear_unordered_access_view_uint(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto uav_handle = trace_data.read<resource_view>().handle;
-	uint32_t values[4] = {};
-	trace_data.read(values, sizeof(values));
+	const auto data = trace_data.read<trace_event_payload<reshade::addon_event::clear_unordered_access_view_uint>>();
 
-	cmd_list->clear_unordered_access_view_uint(s_resource_views[uav_handle], values);
+	cmd_list->clear_unordered_access_view_uint(find_object(s_resource_views, report_object(data.uav).handle), data.values);
 }
 static void play_clear_unordered_access_view_float(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto uav_handle = trace_data.read<resource_view>().handle;
-	float values[4] = {};
-	trace_data.read(values, sizeof(values));
+	const auto data = trace_data.read<trace_event_payload<reshade::addon_event::clear_unordered_access_view_float>>();
 
-	cmd_list->clear_unordered_access_view_float(s_resource_views[uav_handle], values);
+	cmd_list->clear_unordered_access_view_float(find_object(s_resource_views, report_object(data.uav).handle), data.values);
 }
 
 static void play_generate_mipmaps(trace_data_read &trace_data, command_list *cmd_list)
 {
-	const auto srv_handle = trace_data.read<resource_view>().handle;
+	const auto data = trace_data.read<trace_event_payload<reshade::addon_event::generate_mipmaps>>();
 
-	cmd_list->generate_mipmaps(s_resource_views[srv_handle]);
+	cmd_list->generate_mipmaps(find_object(s_resource_views, report_object(data.srv).handle));
 }
 
-bool play_frame(trace_data_read &trace_data, command_list *cmd_list, effect_runtime *runtime)
+// Commands recorded on separate command lists are played back on the immediate command list, which is submitted wherever the application executed a command list
+// The ReShade API does not allow creating command lists to record them on in parallel, but this way the number and order of submissions at least match
+// Neither does it allow creating additional queues, so submissions to compute and copy queues are played back in order on the same queue too
+static void play_execute_command_list(trace_data_read &trace_data, command_queue *queue)
+{
+	const auto data = trace_data.read<trace_event_payload<reshade::addon_event::execute_command_list>>();
+	report_command_queue(data.queue_id);
+
+	queue->flush_immediate_command_list();
+}
+
+static bool play_event(trace_data_read &trace_data, reshade::addon_event ev, command_list *cmd_list, command_queue *queue, effect_runtime *runtime)
 {
 	device *const device = cmd_list->get_device();
 
-	for (reshade::addon_event ev; trace_data.read(&ev, sizeof(ev));)
+	switch (ev)
 	{
-		switch (ev)
-		{
-		case reshade::addon_event::init_swapchain:
-			play_init_swapchain(trace_data, runtime);
-			break;
-		case reshade::addon_event::destroy_swapchain:
-			play_destroy_swapchain(trace_data, runtime);
-			break;
+	case reshade::addon_event::init_command_queue:
+		play_init_command_queue(trace_data);
+		break;
+	case reshade::addon_event::destroy_command_queue:
+		play_destroy_command_queue(trace_data);
+		break;
+
+	case reshade::addon_event::init_swapchain:
+		play_init_swapchain(trace_data, device, runtime);
+		break;
+	case reshade::addon_event::destroy_swapchain:
+		play_destroy_swapchain(trace_data);
+		break;
+
+	case reshade::addon_event::init_sampler:
+		play_init_sampler(trace_data, device);
+		break;
+	case reshade::addon_event::destroy_sampler:
+		play_destroy_sampler(trace_data, device);
+		break;
+	case reshade::addon_event::init_resource:
+		play_init_resource(trace_data, device);
+		break;
+	case reshade::addon_event::destroy_resource:
+		play_destroy_resource(trace_data, device);
+		break;
+	case reshade::addon_event::init_resource_view:
+		play_init_resource_view(trace_data, device);
+		break;
+	case reshade::addon_event::destroy_resource_view:
+		play_destroy_resource_view(trace_data, device);
+		break;
+
+	case reshade::addon_event::map_buffer_region:
+		play_map_buffer_region(trace_data, device);
+		break;
+	case reshade::addon_event::unmap_buffer_region:
+		play_unmap_buffer_region(trace_data, device);
+		break;
+	case reshade::addon_event::map_texture_region:
+		play_map_texture_region(trace_data, device);
+		break;
+	case reshade::addon_event::unmap_texture_region:
+		play_unmap_texture_region(trace_data, device);
+		break;
+	case reshade::addon_event::update_buffer_region:
+		play_update_buffer_region(trace_data, device);
+		break;
+	case reshade::addon_event::update_texture_region:
+		play_update_texture_region(trace_data, device);
+		break;
+
+	case reshade::addon_event::init_pipeline:
+		play_init_pipeline(trace_data, device);
+		break;
+	case reshade::addon_event::destroy_pipeline:
+		play_destroy_pipeline(trace_data, device);
+		break;
+	case reshade::addon_event::init_pipeline_layout:
+		play_init_pipeline_layout(trace_data, device);
+		break;
+	case reshade::addon_event::destroy_pipeline_layout:
+		play_destroy_pipeline_layout(trace_data, device);
+		break;
+
+	case reshade::addon_event::copy_descriptor_tables:
+		play_copy_descriptor_tables(trace_data, device);
+		break;
+	case reshade::addon_event::update_descriptor_tables:
+		play_update_descriptor_tables(trace_data, device);
+		break;
+
+	case reshade::addon_event::init_query_heap:
+		break;
+	case reshade::addon_event::destroy_query_heap:
+		break;
+	case reshade::addon_event::get_query_heap_results:
+		break;
+
+	case reshade::addon_event::barrier:
+		play_barrier(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::begin_render_pass:
+		play_begin_render_pass(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::end_render_pass:
+		play_end_render_pass(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::bind_render_targets_and_depth_stencil:
+		play_bind_render_targets_and_depth_stencil(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::bind_pipeline:
+		play_bind_pipeline(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::bind_pipeline_states:
+		play_bind_pipeline_states(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::bind_viewports:
+		play_bind_viewports(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::bind_scissor_rects:
+		play_bind_scissor_rects(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::push_constants:
+		play_push_constants(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::push_descriptors:
+		play_push_descriptors(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::bind_descriptor_tables:
+		play_bind_descriptor_tables(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::bind_index_buffer:
+		play_bind_index_buffer(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::bind_vertex_buffers:
+		play_bind_vertex_buffers(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::bind_stream_output_buffers:
+		play_bind_stream_output_buffers(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::draw:
+		play_draw(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::draw_indexed:
+		play_draw_indexed(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::dispatch:
+		play_dispatch(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::draw_or_dispatch_indirect:
+		play_draw_or_dispatch_indirect(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::copy_resource:
+		play_copy_resource(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::copy_buffer_region:
+		play_copy_buffer_region(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::copy_buffer_to_texture:
+		play_copy_buffer_to_texture(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::copy_texture_region:
+		play_copy_texture_region(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::copy_texture_to_buffer:
+		play_copy_texture_to_buffer(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::resolve_texture_region:
+		play_resolve_texture_region(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::clear_depth_stencil_view:
+		play_clear_depth_stencil_view(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::clear_render_target_view:
+		play_clear_render_target_view(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::clear_unordered_access_view_uint:
+		play_clear_unordered_access_view_uint(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::clear_unordered_access_view_float:
+		play_clear_unordered_access_view_float(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::generate_mipmaps:
+		play_generate_mipmaps(trace_data, cmd_list);
+		break;
+	case reshade::addon_event::begin_query:
+		break;
+	case reshade::addon_event::end_query:
+		break;
+	case reshade::addon_event::copy_query_heap_results:
+		break;
+
+	case reshade::addon_event::reset_command_list:
+		break;
+	case reshade::addon_event::close_command_list:
+		break;
+	case reshade::addon_event::execute_command_list:
+		play_execute_command_list(trace_data, queue);
+		break;
+	case reshade::addon_event::execute_secondary_command_list:
+		break;
+
+	case reshade::addon_event::present:
+		if (s_resource_pool != nullptr)
+			s_resource_pool->end_frame();
+		return true;
+
+	case static_cast<reshade::addon_event>(trace_snapshot_data_event):
+		skip_snapshot_data(trace_data);
+		break;
+
+	default:
+		assert(false);
+		break;
+	}
 
-		case reshade::addon_event::init_sampler:
-			play_init_sampler(trace_data, device);
-			break;
-		case reshade::addon_event::destroy_sampler:
-			play_destroy_sampler(trace_data, device);
-			break;
-		case reshade::addon_event::init_resource:
-			play_init_resource(trace_data, device);
-			break;
-		case reshade::addon_event::destroy_resource:
-			play_destroy_resource(trace_data, device);
-			break;
-		case reshade::addon_event::init_resource_view:
-			play_init_resource_view(trace_data, device);
-			break;
-		case reshade::addon_event::destroy_resource_view:
-			play_destroy_resource_view(trace_data, device);
-			break;
+	return false;
+}
 
-		case reshade::addon_event::map_buffer_region:
-			play_map_buffer_region(trace_data, device);
-			break;
-		case reshade::addon_event::unmap_buffer_region:
-			play_unmap_buffer_region(trace_data, device);
-			break;
-		case reshade::addon_event::map_texture_region:
-			play_map_texture_region(trace_data, device);
-			break;
-		case reshade::addon_event::unmap_texture_region:
-			play_unmap_texture_region(trace_data, device);
-			break;
-		case reshade::addon_event::update_buffer_region:
-			play_update_buffer_region(trace_data, device);
-			break;
-		case reshade::addon_event::update_texture_region:
-			play_update_texture_region(trace_data, device);
-			break;
+// Restores the contents resources had when the capture started, which are only written to the trace after the first frames
+static void play_snapshot_data(trace_data_read &trace_data, const trace_index &index, command_list *cmd_list, effect_runtime *runtime)
+{
+	for (const uint64_t offset : index.snapshot_offsets)
+	{
+		trace_data.seek(offset + sizeof(trace_event_tag));
+		trace_data.release_data();
+		play_event(trace_data, trace_data.read_event(), cmd_list, runtime->get_command_queue(), runtime);
+		s_frame_arena.reset();
+	}
+}
 
-		case reshade::addon_event::init_pipeline:
-			play_init_pipeline(trace_data, device);
-			break;
-		case reshade::addon_event::destroy_pipeline:
-			play_destroy_pipeline(trace_data, device);
-			break;
-		case reshade::addon_event::init_pipeline_layout:
-			play_init_pipeline_layout(trace_data, device);
-			break;
-		case reshade::addon_event::destroy_pipeline_layout:
-			play_destroy_pipeline_layout(trace_data, device);
-			break;
+// Plays back the event at the specified offset on its own, for tools that look at events individually
+void play_event_at(trace_data_read &trace_data, uint64_t offset, command_list *cmd_list, command_queue *queue, effect_runtime *runtime)
+{
+	trace_data.seek(offset);
+	trace_data.release_data();
+	play_event(trace_data, trace_data.read_event(), cmd_list, queue, runtime);
+	s_frame_arena.reset();
+}
+// Contents that delta encoded mappings of the buffer with the specified ID are currently applied to (empty if there were none yet)
+const std::vector<uint8_t> &get_buffer_contents(uint64_t id)
+{
+	static const std::vector<uint8_t> empty;
+	return id < s_buffer_contents.size() ? s_buffer_contents[id] : empty;
+}
+command_queue_type get_command_queue_type(uint64_t id)
+{
+	return id < s_command_queue_types.size() ? s_command_queue_types[id] : command_queue_type::graphics;
+}
+void set_object_callback(void(*callback)(trace_object_type type, uint64_t id, void *user_data), void *user_data)
+{
+	s_object_callback = callback;
+	s_object_callback_data = user_data;
+}
 
-		case reshade::addon_event::copy_descriptor_tables:
-			play_copy_descriptor_tables(trace_data, device);
-			break;
-		case reshade::addon_event::update_descriptor_tables:
-			play_update_descriptor_tables(trace_data, device);
-			break;
+// The callback is called with the type and trace offset of each event before it is played back, so that tools can attribute what happens on the device to it
+bool play_frame(trace_data_read &trace_data, command_list *cmd_list, command_queue *queue, effect_runtime *runtime, void(*callback)(reshade::addon_event ev, uint64_t offset, void *user_data), void *user_data)
+{
+	if (s_prefetcher != nullptr)
+		s_prefetcher->advance(trace_data.tell());
 
-		case reshade::addon_event::init_query_heap:
-			break;
-		case reshade::addon_event::destroy_query_heap:
-			break;
-		case reshade::addon_event::get_query_heap_results:
-			break;
+	// Have the next frame read in the background while this one is played back
+	trace_data.read_ahead_frames(1);
 
-		case reshade::addon_event::barrier:
-			play_barrier(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::begin_render_pass:
-			play_begin_render_pass(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::end_render_pass:
-			play_end_render_pass(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::bind_render_targets_and_depth_stencil:
-			play_bind_render_targets_and_depth_stencil(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::bind_pipeline:
-			play_bind_pipeline(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::bind_pipeline_states:
-			play_bind_pipeline_states(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::bind_viewports:
-			play_bind_viewports(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::bind_scissor_rects:
-			play_bind_scissor_rects(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::push_constants:
-			play_push_constants(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::push_descriptors:
-			play_push_descriptors(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::bind_descriptor_tables:
-			play_bind_descriptor_tables(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::bind_index_buffer:
-			play_bind_index_buffer(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::bind_vertex_buffers:
-			play_bind_vertex_buffers(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::bind_stream_output_buffers:
-			play_bind_stream_output_buffers(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::draw:
-			play_draw(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::draw_indexed:
-			play_draw_indexed(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::dispatch:
-			play_dispatch(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::draw_or_dispatch_indirect:
-			play_draw_or_dispatch_indirect(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::copy_resource:
-			play_copy_resource(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::copy_buffer_region:
-			play_copy_buffer_region(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::copy_buffer_to_texture:
-			play_copy_buffer_to_texture(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::copy_texture_region:
-			play_copy_texture_region(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::copy_texture_to_buffer:
-			play_copy_texture_to_buffer(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::resolve_texture_region:
-			play_resolve_texture_region(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::clear_depth_stencil_view:
-			play_clear_depth_stencil_view(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::clear_render_target_view:
-			play_clear_render_target_view(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::clear_unordered_access_view_uint:
-			play_clear_unordered_access_view_uint(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::clear_unordered_access_view_float:
-			play_clear_unordered_access_view_float(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::generate_mipmaps:
-			play_generate_mipmaps(trace_data, cmd_list);
-			break;
-		case reshade::addon_event::begin_query:
-			break;
-		case reshade::addon_event::end_query:
-			break;
-		case reshade::addon_event::copy_query_heap_results:
-			break;
+	for (reshade::addon_event ev; trace_data.read_event(ev);)
+	{
+		// Data returned by 'read_data' is only used while playing back the event it belongs to
+		trace_data.release_data();
 
-		case reshade::addon_event::reset_command_list:
-			break;
-		case reshade::addon_event::close_command_list:
-			break;
-		case reshade::addon_event::execute_command_list:
-			break;
-		case reshade::addon_event::execute_secondary_command_list:
-			break;
+		if (callback != nullptr)
+			callback(ev, trace_data.tell() - sizeof(trace_event_tag), user_data);
 
-		case reshade::addon_event::present:
+		if (play_event(trace_data, ev, cmd_list, queue, runtime))
+		{
+			s_frame_arena.reset();
 			return true;
+		}
+	}
 
-		default:
-			assert(false);
+	s_frame_arena.reset();
+	return false;
+}
+bool play_frame(trace_data_read &trace_data, command_list *cmd_list, effect_runtime *runtime)
+{
+	return play_frame(trace_data, cmd_list, runtime->get_command_queue(), runtime, nullptr, nullptr);
+}
+
+bool seek_frame(trace_data_read &trace_data, const trace_index &index, uint64_t frame, command_list *cmd_list, effect_runtime *runtime)
+{
+	if (frame >= index.frame_offsets.size())
+		return false;
+
+	const uint64_t frame_offset = index.frame_offsets[static_cast<size_t>(frame)];
+
+	if (s_prefetcher != nullptr)
+		s_prefetcher->reset();
+
+	// Seeking backwards has to replay everything from the start again, which recreates objects in place since their IDs are the same
+	const uint64_t position = frame_offset >= trace_data.tell() ? trace_data.tell() : 0;
+
+	// Resource contents of the snapshot apply right after the objects created before the first frame (unless those were already played back)
+	bool snapshot_restored = position > index.frame_offsets[0];
+
+	// Only replay the device-level events of all previous frames, to recreate the objects that are alive at the start of the requested frame
+	for (const uint64_t offset : index.state_offsets)
+	{
+		if (offset >= frame_offset)
 			break;
+		if (!snapshot_restored && offset >= index.frame_offsets[0])
+		{
+			play_snapshot_data(trace_data, index, cmd_list, runtime);
+			snapshot_restored = true;
 		}
+		if (offset < position)
+			continue;
+
+		trace_data.seek(offset);
+		trace_data.release_data();
+		play_event(trace_data, trace_data.read_event(), cmd_list, runtime->get_command_queue(), runtime);
+		s_frame_arena.reset();
 	}
 
-	return false;
+	if (!snapshot_restored)
+		play_snapshot_data(trace_data, index, cmd_list, runtime);
+
+	trace_data.seek(frame_offset);
+	return true;
 }
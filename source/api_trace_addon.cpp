@@ -4,132 +4,1357 @@
  */
 
 #include "trace_data.hpp"
-#include <reshade.hpp>
+#include "trace_events.hpp"
 #include <string>
 #include <vector>
+#include <utility>
 #include <algorithm>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
 #include <shared_mutex>
+#include <cstdio>
+#include <intrin.h>
 
 using namespace reshade::api;
 
-struct __declspec(uuid("589E9521-a7c5-4e07-9c64-1175b0cf3ab4")) device_data : trace_data_write
+struct mapping
+{
+	resource resource;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t subresource;
+	bool has_box;
+	subresource_box box;
+	map_access access;
+	subresource_data data;
+	uint64_t ref = 1;
+	// Set once the data of this mapping was written to the trace while it was still mapped
+	bool flushed = false;
+	// Hashes of the pages of mappings too large to keep a copy of, as of the last time they were written, allocated on the first flush
+	std::vector<uint64_t> page_hashes;
+};
+
+struct mapping_key
+{
+	uint64_t resource;
+	uint32_t subresource;
+
+	bool operator==(const mapping_key &other) const { return resource == other.resource && subresource == other.subresource; }
+};
+struct mapping_key_hash
+{
+	size_t operator()(const mapping_key &key) const { return std::hash<uint64_t>()(key.resource ^ (uint64_t(key.subresource) * 0x9e3779b97f4a7c15ull)); }
+};
+
+// Objects are written to the trace as sequential IDs per object type instead of their handles, so that playback can store them in flat arrays
+// IDs of destroyed objects are reused to keep those arrays dense, zero is reserved for the null handle
+template <typename T>
+struct object_ids
+{
+	T assign(T handle)
+	{
+		if (handle.handle == 0)
+			return { 0 };
+
+		uint64_t &id = ids[handle.handle];
+		if (id == 0)
+		{
+			if (free_ids.empty())
+			{
+				id = next_id++;
+			}
+			else
+			{
+				id = free_ids.back();
+				free_ids.pop_back();
+			}
+		}
+
+		return { id };
+	}
+	T release(T handle)
+	{
+		const auto it = ids.find(handle.handle);
+		if (it == ids.end())
+			return { 0 };
+
+		const uint64_t id = it->second;
+		ids.erase(it);
+		free_ids.push_back(id);
+
+		return { id };
+	}
+
+	T operator[](T handle) const
+	{
+		const auto it = ids.find(handle.handle);
+		return { it != ids.end() ? it->second : 0 };
+	}
+
+private:
+	std::unordered_map<uint64_t, uint64_t> ids;
+	std::vector<uint64_t> free_ids;
+	uint64_t next_id = 1;
+};
+
+template <typename T>
+static void write_descriptors(T &trace_data, descriptor_type type, uint32_t count, const void *descriptors)
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		switch (type)
+		{
+		case descriptor_type::sampler:
+			trace_data.write(trace_data.id(static_cast<const sampler *>(descriptors)[i]));
+			break;
+		case descriptor_type::sampler_with_resource_view:
+		{
+			const auto &descriptor = static_cast<const sampler_with_resource_view *>(descriptors)[i];
+			trace_data.write(trace_data.id(descriptor.sampler));
+			trace_data.write(trace_data.id(descriptor.view));
+			break;
+		}
+		case descriptor_type::buffer_shader_resource_view:
+		case descriptor_type::buffer_unordered_access_view:
+		case descriptor_type::texture_shader_resource_view:
+		case descriptor_type::texture_unordered_access_view:
+			trace_data.write(trace_data.id(static_cast<const resource_view *>(descriptors)[i]));
+			break;
+		case descriptor_type::constant_buffer:
+		case descriptor_type::shader_storage_buffer:
+		{
+			const auto &descriptor = static_cast<const buffer_range *>(descriptors)[i];
+			trace_data.write(trace_data.id(descriptor.buffer));
+			trace_data.write(descriptor.offset);
+			trace_data.write(descriptor.size);
+			break;
+		}
+		default:
+			assert(false);
+			break;
+		}
+	}
+}
+
+static inline size_t descriptor_size(descriptor_type type)
+{
+	switch (type)
+	{
+	case descriptor_type::sampler:
+		return sizeof(sampler);
+	case descriptor_type::sampler_with_resource_view:
+		return sizeof(sampler_with_resource_view);
+	case descriptor_type::buffer_shader_resource_view:
+	case descriptor_type::buffer_unordered_access_view:
+	case descriptor_type::texture_shader_resource_view:
+	case descriptor_type::texture_unordered_access_view:
+		return sizeof(resource_view);
+	case descriptor_type::constant_buffer:
+	case descriptor_type::shader_storage_buffer:
+		return sizeof(buffer_range);
+	default:
+		return 0;
+	}
+}
+
+static inline uint64_t calc_texture_size(const resource_desc &desc, uint32_t subresource, const subresource_data &data, const subresource_box *box = nullptr)
 {
+	const uint32_t level = (desc.texture.levels != 0) ? subresource % desc.texture.levels : subresource;
+
+	switch (desc.type)
+	{
+	case resource_type::texture_1d:
+		return format_row_pitch(desc.texture.format,
+			box != nullptr ? box->width() : std::max(desc.texture.width >> level, 1u));
+	case resource_type::texture_2d:
+		assert(data.row_pitch != 0);
+		return format_slice_pitch(desc.texture.format, data.row_pitch,
+			box != nullptr ? box->height() : std::max(desc.texture.height >> level, 1u));
+	case resource_type::texture_3d:
+		assert(data.slice_pitch != 0);
+		return data.slice_pitch * (box != nullptr ? box->depth() : desc.texture.depth_or_layers);
+	default:
+		return 0;
+	}
+}
+
+// Copies memory with streaming loads where supported, since mapped upload memory is usually write-combined, which is uncached and very slow to read with regular loads
+static void copy_streaming(void *dst, const void *src, size_t size)
+{
+	static const bool has_sse41 = []() { int info[4]; __cpuid(info, 1); return (info[2] & (1 << 19)) != 0; }();
+
+	const auto src_bytes = static_cast<const uint8_t *>(src);
+	const auto dst_bytes = static_cast<uint8_t *>(dst);
+
+	size_t offset = 0;
+	if (has_sse41)
+	{
+		// Streaming loads need 16-byte aligned addresses, so copy any unaligned bytes at the start normally
+		offset = std::min(size, (16 - (reinterpret_cast<uintptr_t>(src) & 15)) & 15);
+		std::memcpy(dst_bytes, src_bytes, offset);
+
+		for (; offset + 64 <= size; offset += 64)
+		{
+			const auto src_vec = reinterpret_cast<__m128i *>(const_cast<uint8_t *>(src_bytes + offset));
+			const __m128i v0 = _mm_stream_load_si128(src_vec + 0);
+			const __m128i v1 = _mm_stream_load_si128(src_vec + 1);
+			const __m128i v2 = _mm_stream_load_si128(src_vec + 2);
+			const __m128i v3 = _mm_stream_load_si128(src_vec + 3);
+
+			const auto dst_vec = reinterpret_cast<__m128i *>(dst_bytes + offset);
+			_mm_storeu_si128(dst_vec + 0, v0);
+			_mm_storeu_si128(dst_vec + 1, v1);
+			_mm_storeu_si128(dst_vec + 2, v2);
+			_mm_storeu_si128(dst_vec + 3, v3);
+		}
+	}
+
+	std::memcpy(dst_bytes + offset, src_bytes + offset, size - offset);
+}
+
+// Writes the row pitch, slice pitch and data of a texture region
+// If a buffer to pack rows into is passed, the padding at the end of every row and slice is dropped and the region is written with the tightest pitches instead, which playback copies back out with whatever pitches the mapping there has
+template <typename T>
+static void write_texture_data(T &trace_data, const resource_desc &desc, uint32_t subresource, const subresource_data &data, const subresource_box *box, std::vector<uint8_t> *packed_rows)
+{
+	const uint64_t size = calc_texture_size(desc, subresource, data, box);
+	assert(size <= std::numeric_limits<size_t>::max());
+
+	if (packed_rows == nullptr || desc.type == resource_type::texture_1d || data.row_pitch == 0)
+	{
+		trace_data.write(data.row_pitch);
+		trace_data.write(data.slice_pitch);
+		trace_data.write(size);
+		trace_data.write_blob(data.data, static_cast<size_t>(size));
+		return;
+	}
+
+	const uint32_t level = (desc.texture.levels != 0) ? subresource % desc.texture.levels : subresource;
+	const uint32_t width = box != nullptr ? box->width() : std::max(desc.texture.width >> level, 1u);
+	const uint32_t height = box != nullptr ? box->height() : std::max(desc.texture.height >> level, 1u);
+	const uint32_t slices = desc.type == resource_type::texture_3d ? (box != nullptr ? box->depth() : std::max<uint32_t>(desc.texture.depth_or_layers >> level, 1u)) : 1;
+
+	const uint32_t row_size = std::min(format_row_pitch(desc.texture.format, width), data.row_pitch);
+	// Block compressed formats have one row per four texel rows
+	const uint32_t rows = format_slice_pitch(desc.texture.format, data.row_pitch, height) / data.row_pitch;
+	const uint32_t slice_size = row_size * rows;
+
+	packed_rows->resize(static_cast<size_t>(slice_size) * slices);
+	for (uint32_t slice = 0; slice < slices; ++slice)
+	{
+		const auto src = static_cast<const uint8_t *>(data.data) + static_cast<size_t>(slice) * data.slice_pitch;
+		for (uint32_t row = 0; row < rows; ++row)
+			copy_streaming(packed_rows->data() + static_cast<size_t>(slice) * slice_size + static_cast<size_t>(row) * row_size, src + static_cast<size_t>(row) * data.row_pitch, row_size);
+	}
+
+	trace_data.write(row_size);
+	trace_data.write(slice_size);
+	trace_data.write(static_cast<uint64_t>(packed_rows->size()));
+	trace_data.write_blob(packed_rows->data(), packed_rows->size());
+}
+
+// Kinds of objects that are kept track of while not capturing, in the order they have to be recreated in when a capture starts
+enum class object_kind
+{
+	command_queue,
+	swapchain,
+	sampler,
+	resource,
+	resource_view,
+	pipeline_layout,
+	pipeline,
+	count
+};
+
+// Time spent in each event callback, how long it waited for 's_mutex' and how many bytes it added to the trace, to measure how much capturing slows down the application
+// Only collected when 'OverheadCounters' is enabled, since reading the timer around every callback is not free either
+struct overhead_counters
+{
+	struct event_counters
+	{
+		std::atomic<uint64_t> calls;
+		std::atomic<uint64_t> ticks;
+		std::atomic<uint64_t> lock_wait_ticks;
+		std::atomic<uint64_t> bytes;
+	};
+
+	void sample_pending_blocks(size_t count)
+	{
+		if (count > max_pending_blocks.load(std::memory_order_relaxed))
+			max_pending_blocks.store(count, std::memory_order_relaxed);
+	}
+
+	event_counters &operator[](reshade::addon_event ev)
+	{
+		assert(static_cast<size_t>(ev) < std::size(events));
+		return events[static_cast<size_t>(ev)];
+	}
+
+	event_counters events[trace_event_type_count];
+	// Most blocks queued up for the I/O thread of the trace seen at any present
+	std::atomic<size_t> max_pending_blocks;
+};
+
+static bool s_count_overhead = false;
+static overhead_counters s_overhead;
+// Lock wait time and trace bytes of the callback currently running on this thread, which 'counted_scope' then adds to the counters of its event
+static thread_local uint64_t s_thread_lock_wait_ticks = 0;
+static thread_local uint64_t s_thread_bytes = 0;
+
+static inline uint64_t query_ticks()
+{
+	LARGE_INTEGER ticks;
+	QueryPerformanceCounter(&ticks);
+	return ticks.QuadPart;
+}
+
+class counted_scope
+{
+public:
+	explicit counted_scope(reshade::addon_event ev) :
+		_counters(s_overhead[ev]), _outer_lock_wait_ticks(std::exchange(s_thread_lock_wait_ticks, 0)), _outer_bytes(std::exchange(s_thread_bytes, 0)), _start(query_ticks())
+	{
+	}
+	~counted_scope()
+	{
+		_counters.calls.fetch_add(1, std::memory_order_relaxed);
+		_counters.ticks.fetch_add(query_ticks() - _start, std::memory_order_relaxed);
+		_counters.lock_wait_ticks.fetch_add(s_thread_lock_wait_ticks, std::memory_order_relaxed);
+		_counters.bytes.fetch_add(s_thread_bytes, std::memory_order_relaxed);
+
+		// Events invoked from within another callback keep their lock wait time and bytes to themselves, but their time is part of the outer callback too
+		s_thread_lock_wait_ticks = _outer_lock_wait_ticks;
+		s_thread_bytes = _outer_bytes;
+	}
+
+private:
+	overhead_counters::event_counters &_counters;
+	const uint64_t _outer_lock_wait_ticks;
+	const uint64_t _outer_bytes;
+	const uint64_t _start;
+};
+
+// Wraps an event callback to count it, the callback itself is registered directly while overhead counters are disabled
+template <reshade::addon_event ev, auto callback>
+struct counted_callback;
+template <reshade::addon_event ev, typename R, typename... Args, R(*callback)(Args...)>
+struct counted_callback<ev, callback>
+{
+	static_assert(static_cast<size_t>(ev) < trace_event_type_count);
+
+	static R invoke(Args... args)
+	{
+		const counted_scope scope(ev);
+		return callback(args...);
+	}
+};
+
+template <reshade::addon_event ev, auto callback>
+static void register_callback()
+{
+	if (s_count_overhead)
+		reshade::register_event<ev>(counted_callback<ev, callback>::invoke);
+	else
+		reshade::register_event<ev>(callback);
+}
+
+// Shared mutex that adds the time spent waiting for it to the lock wait time of the calling thread
+// Locking it is tried first, so that the timer is only read when another thread actually holds it
+class counted_mutex
+{
+public:
+	void lock()
+	{
+		if (_mutex.try_lock())
+			return;
+		const uint64_t start = query_ticks();
+		_mutex.lock();
+		s_thread_lock_wait_ticks += query_ticks() - start;
+	}
+	bool try_lock() { return _mutex.try_lock(); }
+	void unlock() { _mutex.unlock(); }
+
+	void lock_shared()
+	{
+		if (_mutex.try_lock_shared())
+			return;
+		const uint64_t start = query_ticks();
+		_mutex.lock_shared();
+		s_thread_lock_wait_ticks += query_ticks() - start;
+	}
+	bool try_lock_shared() { return _mutex.try_lock_shared(); }
+	void unlock_shared() { _mutex.unlock_shared(); }
+
+private:
+	std::shared_mutex _mutex;
+};
+
+struct __declspec(uuid("589E9521-a7c5-4e07-9c64-1175b0cf3ab4")) device_data
+{
+	// Devices are numbered in the order they were created, each writes a trace file of its own, since playback replays a single device
 	static inline unsigned int index = 0;
 
-	device_data(device_api graphics_api) : trace_data_write(("api_trace_log" + (++index > 1 ? "_" + std::to_string(index) : "") + ".bin").c_str())
+	// Frames to wait after copying resources at the start of a capture before mapping the copies, so that the GPU finished them
+	static constexpr uint64_t snapshot_readback_latency = 4;
+	// Amount of resource data read back per frame, to spread the cost of a snapshot over several frames
+	static constexpr uint64_t snapshot_readback_budget = 64 * 1024 * 1024;
+	// Buffers larger than this are not delta encoded, to limit the memory used for their contents
+	static constexpr uint64_t delta_max_buffer_size = 16 * 1024 * 1024;
+	static constexpr size_t delta_block_size = 64;
+	// Mappings larger than 'delta_max_buffer_size' are flushed in pages of this size instead, so that only those that changed are written and staged at a time
+	static constexpr uint64_t flush_page_size = 64 * 1024;
+
+	explicit device_data(device *device) : _device(device), _graphics_api(device->get_api()), _index(++index)
+	{
+		load_capture_config();
+
+		reshade::get_config_value(nullptr, "APITRACE", "FilterRedundantState", filter_redundant_state);
+		reshade::get_config_value(nullptr, "APITRACE", "DeltaBufferUploads", _delta_buffer_uploads);
+		reshade::get_config_value(nullptr, "APITRACE", "PackTextureRows", _pack_texture_rows);
+
+		// Without any trigger configured the whole session is captured, same as when the capture range starts at the first frame
+		if (capture_key == 0 && _capture_first_frame == UINT64_MAX)
+			begin_capture(UINT64_MAX, nullptr);
+		else if (_capture_first_frame == 0)
+			begin_capture(_capture_frame_count, nullptr);
+	}
+	~device_data()
+	{
+		// The command queue may already be gone at this point, so resource contents that were not read back yet are lost
+		for (const snapshot_readback &readback : _snapshot_readbacks)
+			_device->destroy_resource(readback.staging);
+		_snapshot_readbacks.clear();
+
+		end_capture();
+	}
+
+	// The trace file stays open after the last captured frame until all resource contents of the snapshot were read back
+	bool capturing() const { return _trace != nullptr && _frame < _capture_end_frame; }
+	// Number of captures started so far, state bound before the current one started is not part of it
+	uint64_t capture_count() const { return _capture_count; }
+
+	// Captures the specified number of frames into a new trace file, starting with a snapshot of all live objects
+	void begin_capture(uint64_t frame_count, command_queue *queue)
+	{
+		assert(_trace == nullptr);
+
+		std::string filename = "api_trace_log";
+		if (_index > 1)
+			filename += '_' + std::to_string(_index);
+		if (frame_count != UINT64_MAX)
+			filename += "_frame" + std::to_string(_frame);
+		filename += ".bin";
+
+		_trace = std::make_unique<trace_data_write>(filename.c_str(), compress_enabled());
+		_capture_count++;
+		// Playback starts without any buffer contents to apply deltas to, so open mappings have to be written as a whole again too
+		_buffer_contents.clear();
+		for (auto &[key, stack] : mappings)
+		{
+			for (mapping &mapping : stack)
+			{
+				mapping.flushed = false;
+				mapping.page_hashes.clear();
+			}
+		}
+		_capture_end_frame = frame_count != UINT64_MAX ? _frame + frame_count : UINT64_MAX;
+		_capture_requested = false;
+
+		write(_graphics_api);
+
+		for (const std::unordered_map<uint64_t, trace_data_buffer> &objects : _objects)
+			for (const auto &object : objects)
+				write_state_event(object.second);
+
+		for (const auto &table : _descriptor_tables)
+		{
+			write_state_event(reshade::addon_event::update_descriptor_tables);
+			write(static_cast<uint32_t>(table.second.size()));
+			for (const auto &entry : table.second)
+			{
+				write(descriptor_table { table.first });
+				write(static_cast<uint32_t>(entry.first >> 32));
+				write(static_cast<uint32_t>(entry.first));
+				write(static_cast<uint32_t>(1));
+				write(entry.second.type);
+				write_descriptors(*this, entry.second.type, 1, entry.second.data);
+			}
+		}
+
+		if (queue != nullptr)
+			copy_snapshot_resources(queue);
+
+		_frame_index.frame_offsets.push_back(tell());
+	}
+	void end_capture()
+	{
+		if (_trace == nullptr)
+			return;
+
+		_trace->write_index(_frame_index);
+		_trace.reset();
+		_frame_index = {};
+	}
+	void request_capture()
+	{
+		if (_trace == nullptr)
+			_capture_requested = true;
+	}
+
+	// Bytes are counted where they are first written, so appending recorded command lists to the trace does not count them again
+	template <typename T>
+	void write(T &&value)
+	{
+		const uint64_t offset = tell();
+		_trace->write(std::forward<T>(value));
+		s_thread_bytes += tell() - offset;
+	}
+	void write(const void *data, size_t size)
+	{
+		_trace->write(data, size);
+		s_thread_bytes += size;
+	}
+	void append(const trace_data_buffer &data)
+	{
+		_trace->append(data);
+	}
+	void write_blob(const void *data, size_t size)
+	{
+		const uint64_t offset = tell();
+		_trace->write_blob(data, size);
+		s_thread_bytes += tell() - offset;
+	}
+
+	uint64_t tell() const { return _trace->tell(); }
+	size_t pending_blocks() const { return _trace != nullptr ? _trace->pending_blocks() : 0; }
+
+	void write_state_event(reshade::addon_event ev)
+	{
+		_frame_index.state_offsets.push_back(tell());
+		write(ev);
+	}
+	template <reshade::addon_event ev>
+	void write_state_event(const trace_event_payload<ev> &payload)
+	{
+		_frame_index.state_offsets.push_back(tell());
+		write(make_trace_event<ev>(payload));
+	}
+	void write_state_event(const trace_data_buffer &event)
+	{
+		const uint64_t offset = tell();
+		_frame_index.state_offsets.push_back(offset);
+		append(event);
+		s_thread_bytes += tell() - offset;
+	}
+	void end_frame(command_queue *queue)
+	{
+		if (capturing())
+		{
+			write(reshade::addon_event::present);
+			_frame_index.frame_offsets.push_back(tell());
+		}
+
+		_frame++;
+
+		if (!_snapshot_readbacks.empty())
+			read_snapshot_resources();
+
+		if (_trace != nullptr && _frame >= _capture_end_frame && _snapshot_readbacks.empty())
+			end_capture();
+
+		if (_trace == nullptr && (_frame == _capture_first_frame || _capture_requested))
+			begin_capture(_frame == _capture_first_frame ? _capture_frame_count : _capture_key_frame_count, queue);
+	}
+
+	// Live objects are remembered as their init event, so that it can be written again as part of the snapshot when a capture starts
+	trace_data_buffer &init_object(object_kind kind, uint64_t handle, reshade::addon_event ev)
+	{
+		trace_data_buffer &event = _objects[static_cast<size_t>(kind)][handle];
+		event.clear();
+		event.write(ev);
+		return event;
+	}
+	void destroy_object(object_kind kind, uint64_t handle)
+	{
+		_objects[static_cast<size_t>(kind)].erase(handle);
+
+		if (kind == object_kind::resource)
+		{
+			_resource_states.erase(handle);
+			_buffer_contents.erase(handle);
+
+			// Applications may destroy resources that are still mapped, the mapped memory is gone with them and must not be flushed anymore
+			for (auto it = mappings.begin(); it != mappings.end();)
+			{
+				if (it->first.resource == handle)
+					it = mappings.erase(it);
+				else
+					++it;
+			}
+		}
+	}
+
+	// Returns the buffer to pack texture rows into, or null if texture data is written with its original pitches
+	std::vector<uint8_t> *packed_rows() { return _pack_texture_rows ? &_packed_rows : nullptr; }
+
+	// Writes the data of a buffer mapping, as the ranges that changed since the buffer was last mapped if delta encoding is enabled (or the mapping was written before while still mapped)
+	// The mapped memory is copied to a cached staging buffer first, so that hashing, comparing and writing it do not each read from write-combined memory again
+	void write_buffer_data(resource buffer, uint64_t offset, uint64_t size, const void *mapped_data, bool persistent = false)
+	{
+		stage_buffer_data(mapped_data, size);
+
+		if (offset + size > delta_max_buffer_size || (!persistent && !_delta_buffer_uploads))
+		{
+			write(trace_buffer_encoding::raw);
+			write_blob(_mapped_data.data(), static_cast<size_t>(size));
+			return;
+		}
+
+		write_delta_data(buffer, offset, size, find_changed_ranges(buffer, offset, size));
+	}
+
+	// Buffers may stay mapped while the GPU reads from them (persistently mapped upload heaps) and are then only unmapped much later or never, so what was written to them would be missing before that
+	// Instead, the ranges of all mapped buffers that changed since they were last written are written as an unmap event before every submission and present, while the mapping itself stays open
+	// This reads every open mapping back from write-combined memory and keeps a copy of it to compare against, except for mappings larger than 'delta_max_buffer_size', of which only a hash per page is kept
+	void flush_mappings()
+	{
+		if (!capturing())
+			return;
+
+		for (auto &[key, stack] : mappings)
+		{
+			mapping &mapping = stack.back();
+			// Texture mappings have no size, those are not tracked
+			if (mapping.size == 0 || mapping.access == map_access::read_only)
+				continue;
+
+			if (mapping.offset + mapping.size > delta_max_buffer_size)
+			{
+				flush_mapping_pages(mapping);
+				continue;
+			}
+
+			stage_buffer_data(mapping.data.data, mapping.size);
+
+			const size_t changed_size = find_changed_ranges(mapping.resource, mapping.offset, mapping.size);
+			if (changed_size == 0 && mapping.flushed)
+				continue;
+
+			// Only the first write may discard the previous contents of the buffer during playback
+			write_state_event<reshade::addon_event::unmap_buffer_region>({ id(mapping.resource), mapping.offset, mapping.size, mapping.flushed ? map_access::write_only : mapping.access });
+			write_delta_data(mapping.resource, mapping.offset, mapping.size, changed_size);
+
+			mapping.flushed = true;
+		}
+	}
+	// Writes each page of a large mapping whose hash changed since it was last flushed (all of them the first time) as an unmap event of its own, which also splits mappings too large for a single blob or delta range
+	void flush_mapping_pages(mapping &mapping)
+	{
+		const bool first = mapping.page_hashes.empty();
+		if (first)
+			mapping.page_hashes.resize(static_cast<size_t>((mapping.size + flush_page_size - 1) / flush_page_size));
+
+		for (size_t page = 0; page < mapping.page_hashes.size(); ++page)
+		{
+			const uint64_t page_offset = page * flush_page_size;
+			const uint64_t page_size = std::min(flush_page_size, mapping.size - page_offset);
+
+			stage_buffer_data(static_cast<const uint8_t *>(mapping.data.data) + page_offset, page_size);
+
+			const uint64_t hash = trace_blob_hash(_mapped_data.data(), _mapped_data.size());
+			if (!first && hash == mapping.page_hashes[page])
+				continue;
+			mapping.page_hashes[page] = hash;
+
+			write_state_event<reshade::addon_event::unmap_buffer_region>({ id(mapping.resource), mapping.offset + page_offset, page_size, mapping.flushed ? map_access::write_only : mapping.access });
+			write(trace_buffer_encoding::raw);
+			write_blob(_mapped_data.data(), _mapped_data.size());
+
+			mapping.flushed = true;
+		}
+	}
+
+	// The state of each resource as of the last submission, which is tracked while not capturing too, so that the barriers of a snapshot start from the state resources are actually in
+	void set_resource_state(resource handle, resource_usage state)
+	{
+		_resource_states[handle.handle] = state;
+	}
+	void apply_resource_states(const std::vector<std::pair<uint64_t, resource_usage>> &states)
+	{
+		for (const std::pair<uint64_t, resource_usage> &state : states)
+			if (const auto it = _resource_states.find(state.first); it != _resource_states.end())
+				it->second = state.second;
+	}
+
+	void update_descriptors(const descriptor_table_update &update)
+	{
+		const size_t size = descriptor_size(update.type);
+
+		auto &table = _descriptor_tables[update.table.handle];
+		for (uint32_t i = 0; i < update.count; ++i)
+		{
+			descriptor &entry = table[descriptor_key(update.binding, update.array_offset + i)];
+			entry.type = update.type;
+			std::memcpy(entry.data, static_cast<const uint8_t *>(update.descriptors) + i * size, size);
+		}
+	}
+	void copy_descriptors(const descriptor_table_copy &copy)
+	{
+		for (uint32_t i = 0; i < copy.count; ++i)
+		{
+			const uint64_t dest_key = descriptor_key(copy.dest_binding, copy.dest_array_offset + i);
+
+			if (const descriptor *const source = find_descriptor(copy.source_table.handle, descriptor_key(copy.source_binding, copy.source_array_offset + i)))
+			{
+				const descriptor entry = *source;
+				_descriptor_tables[copy.dest_table.handle][dest_key] = entry;
+			}
+			else if (const auto it = _descriptor_tables.find(copy.dest_table.handle); it != _descriptor_tables.end())
+			{
+				it->second.erase(dest_key);
+			}
+		}
+	}
+
+	// Mapping a subresource again while it is still mapped with the same pointer only increases the reference count, mappings with different pointers are unmapped in reverse order
+	void push_mapping(const mapping &mapping)
+	{
+		std::vector<::mapping> &stack = mappings[{ mapping.resource.handle, mapping.subresource }];
+		if (!stack.empty() && stack.back().data.data == mapping.data.data)
+			stack.back().ref++;
+		else
+			stack.push_back(mapping);
+	}
+	mapping *find_mapping(resource resource, uint32_t subresource)
+	{
+		const auto it = mappings.find({ resource.handle, subresource });
+		return it != mappings.end() ? &it->second.back() : nullptr;
+	}
+	void pop_mapping(resource resource, uint32_t subresource)
+	{
+		const auto it = mappings.find({ resource.handle, subresource });
+		assert(it != mappings.end());
+
+		if (--it->second.back().ref == 0)
+		{
+			it->second.pop_back();
+			if (it->second.empty())
+				mappings.erase(it);
+		}
+	}
+
+	sampler id(sampler handle) const { return samplers[handle]; }
+	resource id(resource handle) const { return resources[handle]; }
+	resource_view id(resource_view handle) const { return resource_views[handle]; }
+	pipeline id(pipeline handle) const { return pipelines[handle]; }
+	pipeline_layout id(pipeline_layout handle) const { return pipeline_layouts[handle]; }
+
+	object_ids<sampler> samplers;
+	object_ids<resource> resources;
+	object_ids<resource_view> resource_views;
+	object_ids<pipeline> pipelines;
+	object_ids<pipeline_layout> pipeline_layouts;
+
+	// Virtual key code of the keyboard shortcut that starts a capture, or zero if there is none
+	uint32_t capture_key = 0;
+	// Skip binds that do not change the state currently bound on a command list
+	bool filter_redundant_state = false;
+	// Command lists are identified by the order they were created in
+	uint64_t command_list_count = 0;
+	// Command queues are identified the same way, so that submissions can be attributed to the queue they were executed on
+	uint64_t command_queue_count = 0;
+	std::unordered_map<uintptr_t, uint64_t> command_queue_ids;
+
+private:
+	void stage_buffer_data(const void *mapped_data, uint64_t size)
+	{
+		_mapped_data.resize(static_cast<size_t>(size));
+		copy_streaming(_mapped_data.data(), mapped_data, _mapped_data.size());
+	}
+
+	// Compares the staged data of a buffer mapping with the contents of the buffer as of the last time it was written, in blocks, which keeps the number of ranges low and lets 'memcmp' use vector instructions
+	size_t find_changed_ranges(resource buffer, uint64_t offset, uint64_t size)
+	{
+		std::vector<uint8_t> &contents = _buffer_contents[buffer.handle];
+		if (contents.size() < offset + size)
+			contents.resize(static_cast<size_t>(offset + size));
+
+		const uint8_t *const new_data = _mapped_data.data();
+		const uint8_t *const old_data = contents.data() + offset;
+
+		_delta_ranges.clear();
+		size_t changed_size = 0;
+		for (size_t block_offset = 0; block_offset < size; block_offset += delta_block_size)
+		{
+			const size_t block_size = std::min(delta_block_size, static_cast<size_t>(size) - block_offset);
+			if (std::memcmp(new_data + block_offset, old_data + block_offset, block_size) == 0)
+				continue;
+
+			if (!_delta_ranges.empty() && _delta_ranges.back().first + _delta_ranges.back().second == block_offset)
+				_delta_ranges.back().second += static_cast<uint32_t>(block_size);
+			else
+				_delta_ranges.emplace_back(static_cast<uint32_t>(block_offset), static_cast<uint32_t>(block_size));
+
+			changed_size += block_size;
+		}
+
+		return changed_size;
+	}
+	// Writes the staged data of a buffer mapping as the ranges found by 'find_changed_ranges', or as a whole if most of it changed, and remembers it as the new contents of the buffer
+	void write_delta_data(resource buffer, uint64_t offset, uint64_t size, size_t changed_size)
+	{
+		const uint8_t *const new_data = _mapped_data.data();
+
+		if (changed_size > size / 2)
+		{
+			write(trace_buffer_encoding::raw_and_keep);
+			write_blob(new_data, static_cast<size_t>(size));
+		}
+		else
+		{
+			write(trace_buffer_encoding::delta);
+			write(static_cast<uint32_t>(_delta_ranges.size()));
+			for (const std::pair<uint32_t, uint32_t> &range : _delta_ranges)
+			{
+				write(range.first);
+				write(range.second);
+				write(new_data + range.first, range.second);
+			}
+		}
+
+		std::memcpy(_buffer_contents[buffer.handle].data() + offset, new_data, static_cast<size_t>(size));
+	}
+
+	struct descriptor
+	{
+		descriptor_type type;
+		uint8_t data[sizeof(buffer_range)];
+	};
+	struct snapshot_readback
+	{
+		resource id;
+		resource staging;
+		resource_desc desc;
+	};
+
+	// Copies all live resources into CPU-accessible memory at once, so that their contents are consistent with the first captured frame
+	void copy_snapshot_resources(command_queue *queue)
+	{
+		command_list *const cmd_list = queue->get_immediate_command_list();
+
+		for (const auto &object : _objects[static_cast<size_t>(object_kind::resource)])
+		{
+			const resource resource = { object.first };
+			const resource_desc desc = _device->get_resource_desc(resource);
+
+			// Buffers the application can map may have been filled before the capture started without being mapped since, so those are read directly where the API allows it (unless still mapped, then the next flush of mappings writes them)
+			if (desc.type == resource_type::buffer && desc.heap != memory_heap::gpu_only && (find_mapping(resource, 0) != nullptr || read_mappable_buffer(resource, desc)))
+				continue;
+			// Mappable textures are written through mappings, and multisampled textures cannot be copied to CPU-accessible memory
+			if (desc.type != resource_type::buffer && (desc.heap != memory_heap::gpu_only || desc.texture.samples > 1))
+				continue;
+
+			resource_desc staging_desc = desc;
+			staging_desc.heap = memory_heap::gpu_to_cpu;
+			staging_desc.usage = resource_usage::copy_dest;
+			staging_desc.flags = resource_flags::none;
+
+			reshade::api::resource staging = {};
+			if (!_device->create_resource(staging_desc, nullptr, resource_usage::copy_dest, &staging))
+				continue;
+
+			const resource_usage state = _resource_states[resource.handle];
+			cmd_list->barrier(resource, state, resource_usage::copy_source);
+			cmd_list->copy_resource(resource, staging);
+			cmd_list->barrier(resource, resource_usage::copy_source, state);
+
+			_snapshot_readbacks.push_back({ id(resource), staging, desc });
+		}
+
+		queue->flush_immediate_command_list();
+
+		_snapshot_frame = _frame;
+	}
+	// Writes the contents of a buffer in CPU-accessible memory to the trace right away, which fails where the API does not allow reading it (dynamic buffers in D3D11), so that it is copied to a staging buffer instead
+	bool read_mappable_buffer(resource resource, const resource_desc &desc)
+	{
+		void *data = nullptr;
+		if (!_device->map_buffer_region(resource, 0, UINT64_MAX, map_access::read_only, &data))
+			return false;
+
+		begin_snapshot_data<reshade::addon_event::update_buffer_region>({ id(resource), 0, desc.buffer.size });
+		assert(desc.buffer.size <= std::numeric_limits<size_t>::max());
+		stage_buffer_data(data, desc.buffer.size);
+		write_blob(_mapped_data.data(), static_cast<size_t>(desc.buffer.size));
+
+		_device->unmap_buffer_region(resource);
+		return true;
+	}
+	// Writes the contents of the copied resources to the trace, a few each frame once the copies finished
+	void read_snapshot_resources()
+	{
+		if (_frame < _snapshot_frame + snapshot_readback_latency)
+			return;
+
+		uint64_t bytes_read = 0;
+
+		while (!_snapshot_readbacks.empty() && bytes_read < snapshot_readback_budget)
+		{
+			const snapshot_readback readback = _snapshot_readbacks.back();
+			_snapshot_readbacks.pop_back();
+
+			if (readback.desc.type == resource_type::buffer)
+			{
+				void *data = nullptr;
+				if (_device->map_buffer_region(readback.staging, 0, UINT64_MAX, map_access::read_only, &data))
+				{
+					begin_snapshot_data<reshade::addon_event::update_buffer_region>({ readback.id, 0, readback.desc.buffer.size });
+					assert(readback.desc.buffer.size <= std::numeric_limits<size_t>::max());
+					write_blob(data, static_cast<size_t>(readback.desc.buffer.size));
+
+					_device->unmap_buffer_region(readback.staging);
+
+					bytes_read += readback.desc.buffer.size;
+				}
+			}
+			else
+			{
+				const uint32_t levels = (readback.desc.texture.levels != 0) ? readback.desc.texture.levels : 1;
+				const uint32_t layers = (readback.desc.type != resource_type::texture_3d) ? readback.desc.texture.depth_or_layers : 1;
+
+				for (uint32_t subresource = 0; subresource < levels * layers; ++subresource)
+				{
+					subresource_data data = {};
+					if (!_device->map_texture_region(readback.staging, subresource, nullptr, map_access::read_only, &data))
+						continue;
+
+					begin_snapshot_data<reshade::addon_event::update_texture_region>({ readback.id, subresource, false });
+					write_texture_data(*this, readback.desc, subresource, data, nullptr, packed_rows());
+
+					_device->unmap_texture_region(readback.staging, subresource);
+
+					bytes_read += calc_texture_size(readback.desc, subresource, data);
+				}
+			}
+
+			_device->destroy_resource(readback.staging);
+		}
+	}
+	template <reshade::addon_event ev>
+	void begin_snapshot_data(const trace_event_payload<ev> &payload)
+	{
+		_frame_index.snapshot_offsets.push_back(tell());
+		write(static_cast<reshade::addon_event>(trace_snapshot_data_event));
+		write(make_trace_event<ev>(payload));
+	}
+
+	static uint64_t descriptor_key(uint32_t binding, uint32_t array_offset) { return (static_cast<uint64_t>(binding) << 32) | array_offset; }
+
+	const descriptor *find_descriptor(uint64_t table, uint64_t key) const
+	{
+		const auto table_it = _descriptor_tables.find(table);
+		if (table_it == _descriptor_tables.end())
+			return nullptr;
+		const auto it = table_it->second.find(key);
+		return it != table_it->second.end() ? &it->second : nullptr;
+	}
+
+	static bool compress_enabled()
+	{
+		bool compress = false;
+		reshade::get_config_value(nullptr, "APITRACE", "Compress", compress);
+		return compress;
+	}
+
+	// Parses a frame range of the form "first" or "first-last"
+	static bool parse_frame_range(const char *value, uint64_t &first, uint64_t &count)
+	{
+		char *end = nullptr;
+		first = strtoull(value, &end, 10);
+		if (end == value)
+			return false;
+
+		uint64_t last = first;
+		if (*end == '-')
+			last = strtoull(end + 1, nullptr, 10);
+
+		count = last >= first ? last - first + 1 : 1;
+		return true;
+	}
+
+	void load_capture_config()
+	{
+		reshade::get_config_value(nullptr, "APITRACE", "CaptureKey", capture_key);
+		reshade::get_config_value(nullptr, "APITRACE", "CaptureKeyFrames", _capture_key_frame_count);
+
+		// The environment variable takes precedence over the config, so that a range can be set for a single run
+		char value[64] = "";
+		size_t value_size = sizeof(value);
+		if (GetEnvironmentVariableA("APITRACE_CAPTURE_FRAMES", value, sizeof(value)) == 0 &&
+			!reshade::get_config_value(nullptr, "APITRACE", "CaptureFrames", value, &value_size))
+			return;
+
+		if (!parse_frame_range(value, _capture_first_frame, _capture_frame_count))
+			_capture_first_frame = UINT64_MAX;
+	}
+
+	device *const _device;
+	const device_api _graphics_api;
+	const unsigned int _index;
+	std::unique_ptr<trace_data_write> _trace;
+	trace_index _frame_index;
+	uint64_t _frame = 0;
+	uint64_t _capture_end_frame = UINT64_MAX;
+	uint64_t _capture_first_frame = UINT64_MAX;
+	uint64_t _capture_frame_count = 1;
+	uint64_t _capture_key_frame_count = 1;
+	bool _capture_requested = false;
+	uint64_t _capture_count = 0;
+	uint64_t _snapshot_frame = 0;
+	std::vector<snapshot_readback> _snapshot_readbacks;
+	std::unordered_map<uint64_t, resource_usage> _resource_states;
+	bool _delta_buffer_uploads = false;
+	// Contents of mapped buffers as of the last time they were unmapped during the current capture
+	std::unordered_map<uint64_t, std::vector<uint8_t>> _buffer_contents;
+	std::vector<std::pair<uint32_t, uint32_t>> _delta_ranges;
+	std::vector<uint8_t> _mapped_data;
+	bool _pack_texture_rows = false;
+	std::vector<uint8_t> _packed_rows;
+	std::unordered_map<uint64_t, trace_data_buffer> _objects[static_cast<size_t>(object_kind::count)];
+	// Descriptor tables are never created or destroyed through events, so their contents are remembered per binding and array element
+	std::unordered_map<uint64_t, std::unordered_map<uint64_t, descriptor>> _descriptor_tables;
+	// Only accessed while holding an exclusive lock on 's_mutex', which map and unmap events take anyway to update it
+	std::unordered_map<mapping_key, std::vector<mapping>, mapping_key_hash> mappings;
+};
+
+static counted_mutex s_mutex;
+
+struct __declspec(uuid("0ff8e0a5-53c5-4a3e-8d0b-6b4e2b8c1f37")) command_list_data : trace_data_buffer
+{
+	// Only D3D12 and Vulkan command lists are recorded separately and appended to the trace on submission, everything else executes in order with device calls
+	command_list_data(device_api graphics_api) : immediate(graphics_api != device_api::d3d12 && graphics_api != device_api::vulkan), pipeline_resets_states(graphics_api == device_api::vulkan)
+	{
+	}
+
+	// Returns whether binding the pipeline to the specified stages changes anything, pipelines bound to overlapping stages are replaced
+	bool bind_pipeline(pipeline_stage stages, pipeline handle)
+	{
+		for (const std::pair<pipeline_stage, uint64_t> &binding : bound_pipelines)
+			if (binding.first == stages && binding.second == handle.handle)
+				return false;
+
+		bound_pipelines.erase(std::remove_if(bound_pipelines.begin(), bound_pipelines.end(),
+			[stages](const std::pair<pipeline_stage, uint64_t> &binding) { return (binding.first & stages) != 0; }), bound_pipelines.end());
+		bound_pipelines.emplace_back(stages, handle.handle);
+
+		// Vulkan pipelines without dynamic state overwrite it, so it is unknown afterwards
+		if (pipeline_resets_states)
+			bound_states.clear();
+
+		return true;
+	}
+	bool bind_pipeline_states(uint32_t count, const dynamic_state *states, const uint32_t *values)
+	{
+		bool changed = false;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const auto it = bound_states.find(states[i]);
+			changed |= it == bound_states.end() || it->second != values[i];
+		}
+
+		if (changed)
+			for (uint32_t i = 0; i < count; ++i)
+				bound_states[states[i]] = values[i];
+
+		return changed;
+	}
+	bool bind_viewports(uint32_t first, uint32_t count, const viewport *viewports)
 	{
-		constexpr uint64_t MAGIC = (uint64_t('A') << 0) | (uint64_t('P') << 8) | (uint64_t('I') << 16) | (uint64_t('T') << 24) | (uint64_t('R') << 32) | (uint64_t('A') << 40) | (uint64_t('C') << 48) | (uint64_t('E') << 56);
-		write(MAGIC);
-		write(graphics_api);
+		if (first == first_viewport && count == bound_viewports.size() && std::memcmp(viewports, bound_viewports.data(), count * sizeof(viewport)) == 0)
+			return false;
+
+		first_viewport = first;
+		bound_viewports.assign(viewports, viewports + count);
+		return true;
 	}
-};
+	bool bind_scissor_rects(uint32_t first, uint32_t count, const rect *rects)
+	{
+		if (first == first_scissor_rect && count == bound_scissor_rects.size() && std::memcmp(rects, bound_scissor_rects.data(), count * sizeof(rect)) == 0)
+			return false;
 
-static std::shared_mutex s_mutex;
+		first_scissor_rect = first;
+		bound_scissor_rects.assign(rects, rects + count);
+		return true;
+	}
 
-struct mapping
-{
-	resource resource;
-	uint64_t offset;
-	uint64_t size;
-	uint32_t subresource;
-	bool has_box;
-	subresource_box box;
-	map_access access;
-	subresource_data data;
-	uint64_t ref = 1;
+	void reset_bound_state()
+	{
+		bound_pipelines.clear();
+		bound_states.clear();
+		first_viewport = UINT32_MAX;
+		bound_viewports.clear();
+		first_scissor_rect = UINT32_MAX;
+		bound_scissor_rects.clear();
+	}
+
+	const bool immediate;
+	const bool pipeline_resets_states;
+	uint64_t id = 0;
+
+	// States resources transition to in this command list, in the order of its barriers, which are applied to the device when it is executed
+	std::vector<std::pair<uint64_t, resource_usage>> resource_states;
+
+	// Only compared against while filtering redundant state, and reset whenever it may no longer match what is actually bound
+	uint64_t bound_capture_count = 0;
+	std::vector<std::pair<pipeline_stage, uint64_t>> bound_pipelines;
+	std::unordered_map<dynamic_state, uint32_t> bound_states;
+	uint32_t first_viewport = UINT32_MAX;
+	std::vector<viewport> bound_viewports;
+	uint32_t first_scissor_rect = UINT32_MAX;
+	std::vector<rect> bound_scissor_rects;
 };
-static std::vector<mapping> mappings;
 
-static inline uint64_t calc_texture_size(const resource_desc &desc, uint32_t subresource, const subresource_data &data, const subresource_box *box = nullptr)
+class command_list_writer
 {
-	const uint32_t level = (desc.texture.levels != 0) ? subresource % desc.texture.levels : subresource;
+public:
+	// Holds a shared lock while recording, so that object IDs can be looked up while other threads create or destroy objects
+	// Commands of separately recorded command lists are always recorded, since they may be submitted only once a capture started, immediate ones are skipped while not capturing
+	explicit command_list_writer(command_list *cmd_list) :
+		_lock(s_mutex), _device_data(cmd_list->get_device()->get_private_data<device_data>()), _data(cmd_list->get_private_data<command_list_data>()), _enabled(!_data.immediate || _device_data.capturing()), _begin_size(_data.buffer.size())
+	{
+		// Immediate command lists are not recorded in between captures, so their bound state is unknown when a new one starts
+		if (_data.immediate && _data.bound_capture_count != _device_data.capture_count())
+		{
+			_data.reset_bound_state();
+			_data.bound_capture_count = _device_data.capture_count();
+		}
+	}
+	~command_list_writer()
+	{
+		s_thread_bytes += _data.buffer.size() - _begin_size;
 
-	switch (desc.type)
+		_lock.unlock();
+
+		if (!_data.immediate || _data.empty())
+			return;
+
+		const std::unique_lock<counted_mutex> lock(s_mutex);
+
+		if (_device_data.capturing())
+			_device_data.append(_data);
+		_data.clear();
+	}
+
+	template <typename T>
+	T id(T handle) const
 	{
-	case resource_type::texture_1d:
-		return format_row_pitch(desc.texture.format,
-			box != nullptr ? box->width() : std::max(desc.texture.width >> level, 1u));
-	case resource_type::texture_2d:
-		assert(data.row_pitch != 0);
-		return format_slice_pitch(desc.texture.format, data.row_pitch,
-			box != nullptr ? box->height() : std::max(desc.texture.height >> level, 1u));
-	case resource_type::texture_3d:
-		assert(data.slice_pitch != 0);
-		return data.slice_pitch * (box != nullptr ? box->depth() : desc.texture.depth_or_layers);
-	default:
-		return 0;
+		return _enabled ? _device_data.id(handle) : T { 0 };
 	}
-}
+
+	template <typename T>
+	void write(T &&value)
+	{
+		if (_enabled)
+			_data.write(std::forward<T>(value));
+	}
+	void write(const void *data, size_t size)
+	{
+		if (_enabled)
+			_data.write(data, size);
+	}
+	void write_varint(uint64_t value)
+	{
+		if (_enabled)
+			_data.write_varint(value);
+	}
+	void append(const trace_data_buffer &data)
+	{
+		if (_enabled)
+			_data.write(data.buffer.data(), data.buffer.size());
+	}
+
+	// Returns the command list data to check binds against, or null if those should all be recorded
+	command_list_data *bound_state() const
+	{
+		return _enabled && _device_data.filter_redundant_state ? &_data : nullptr;
+	}
+
+private:
+	std::shared_lock<counted_mutex> _lock;
+	device_data &_device_data;
+	command_list_data &_data;
+	const bool _enabled;
+	const size_t _begin_size;
+};
 
 static void on_init_device(device *device)
 {
-	device->create_private_data<device_data>(device->get_api());
+	device->create_private_data<device_data>(device);
 }
 static void on_destroy_device(device *device)
 {
 	device->destroy_private_data<device_data>();
+
+	if (!s_count_overhead)
+		return;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	const double ms_per_tick = 1000.0 / frequency.QuadPart;
+
+	char message[256];
+	for (size_t i = 0; i < std::size(s_overhead.events); ++i)
+	{
+		const overhead_counters::event_counters &counters = s_overhead.events[i];
+		if (counters.calls == 0)
+			continue;
+
+		std::snprintf(message, sizeof(message), "%s: %llu calls, %.3f ms in callback, %.3f ms waiting for lock, %llu bytes written",
+			trace_event_name(static_cast<reshade::addon_event>(i)), static_cast<unsigned long long>(counters.calls), counters.ticks * ms_per_tick, counters.lock_wait_ticks * ms_per_tick, static_cast<unsigned long long>(counters.bytes));
+		reshade::log_message(reshade::log_level::info, message);
+	}
+
+	std::snprintf(message, sizeof(message), "At most %zu of %zu blocks were queued up for writing at present", s_overhead.max_pending_blocks.load(), trace_data_write::max_pending_blocks);
+	reshade::log_message(reshade::log_level::info, message);
 }
 
 static void on_init_command_list(command_list *cmd_list)
 {
+	auto &cmd_data = cmd_list->create_private_data<command_list_data>(cmd_list->get_device()->get_api());
+
+	const std::unique_lock<counted_mutex> lock(s_mutex);
+
+	cmd_data.id = ++cmd_list->get_device()->get_private_data<device_data>().command_list_count;
 }
 static void on_destroy_command_list(command_list *cmd_list)
 {
+	cmd_list->destroy_private_data<command_list_data>();
+}
+
+static void on_init_command_queue(command_queue *queue)
+{
+	device *const device = queue->get_device();
+
+	const std::unique_lock<counted_mutex> lock(s_mutex);
+
+	auto &trace_data = device->get_private_data<device_data>();
+	const uint64_t id = ++trace_data.command_queue_count;
+	trace_data.command_queue_ids[reinterpret_cast<uintptr_t>(queue)] = id;
+
+	trace_data_buffer &event = trace_data.init_object(object_kind::command_queue, reinterpret_cast<uintptr_t>(queue), reshade::addon_event::init_command_queue);
+	event.write(id);
+	event.write(queue->get_type());
+
+	if (trace_data.capturing())
+		trace_data.write_state_event(event);
+}
+static void on_destroy_command_queue(command_queue *queue)
+{
+	device *const device = queue->get_device();
+
+	const std::unique_lock<counted_mutex> lock(s_mutex);
+
+	auto &trace_data = device->get_private_data<device_data>();
+	trace_data.destroy_object(object_kind::command_queue, reinterpret_cast<uintptr_t>(queue));
+
+	const auto it = trace_data.command_queue_ids.find(reinterpret_cast<uintptr_t>(queue));
+	if (it == trace_data.command_queue_ids.end())
+		return;
+	const uint64_t id = it->second;
+	trace_data.command_queue_ids.erase(it);
+
+	if (!trace_data.capturing())
+		return;
+
+	trace_data.write_state_event(reshade::addon_event::destroy_command_queue);
+	trace_data.write(id);
+}
+
+static inline bool back_buffer_is_view(device *device)
+{
+	return device->get_api() == device_api::d3d9 || device->get_api() == device_api::opengl;
 }
 
 static void on_init_swapchain(swapchain *swapchain)
 {
 	device *const device = swapchain->get_device();
 
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::init_swapchain);
+	trace_data_buffer &event = trace_data.init_object(object_kind::swapchain, reinterpret_cast<uintptr_t>(swapchain), reshade::addon_event::init_swapchain);
 	const uint32_t buffer_count = swapchain->get_back_buffer_count();
-	trace_data.write(buffer_count);
+	event.write(buffer_count);
 	for (uint32_t i = 0; i < buffer_count; ++i)
-		trace_data.write(swapchain->get_back_buffer(i));
+	{
+		const resource back_buffer = swapchain->get_back_buffer(i);
+		event.write(trace_data.resources.assign(back_buffer));
+		// Back buffers are also used as render target views in D3D9 and OpenGL
+		event.write(back_buffer_is_view(device) ? trace_data.resource_views.assign({ back_buffer.handle }) : resource_view { 0 });
+	}
+
+	if (trace_data.capturing())
+		trace_data.write_state_event(event);
 }
 static void on_destroy_swapchain(swapchain *swapchain)
 {
 	device *const device = swapchain->get_device();
 
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::destroy_swapchain);
+	trace_data.destroy_object(object_kind::swapchain, reinterpret_cast<uintptr_t>(swapchain));
+
+	trace_data_buffer event;
+	event.write(reshade::addon_event::destroy_swapchain);
 	const uint32_t buffer_count = swapchain->get_back_buffer_count();
-	trace_data.write(buffer_count);
+	event.write(buffer_count);
 	for (uint32_t i = 0; i < buffer_count; ++i)
-		trace_data.write(swapchain->get_back_buffer(i));
+	{
+		const resource back_buffer = swapchain->get_back_buffer(i);
+		event.write(trace_data.resources.release(back_buffer));
+		event.write(back_buffer_is_view(device) ? trace_data.resource_views.release({ back_buffer.handle }) : resource_view { 0 });
+	}
+
+	if (trace_data.capturing())
+		trace_data.write_state_event(event);
 }
 
 static void on_init_sampler(device *device, const sampler_desc &desc, sampler handle)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::init_sampler);
-	trace_data.write(desc);
-	trace_data.write(handle);
+	trace_data_buffer &event = trace_data.init_object(object_kind::sampler, handle.handle, reshade::addon_event::init_sampler);
+	event.write(desc);
+	event.write(trace_data.samplers.assign(handle));
+
+	if (trace_data.capturing())
+		trace_data.write_state_event(event);
 }
 static void on_destroy_sampler(device *device, sampler handle)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::destroy_sampler);
-	trace_data.write(handle);
+	trace_data.destroy_object(object_kind::sampler, handle.handle);
+	const auto id = trace_data.samplers.release(handle);
+
+	if (!trace_data.capturing())
+		return;
+
+	trace_data.write_state_event(reshade::addon_event::destroy_sampler);
+	trace_data.write(id);
 }
 
-static void on_init_resource(device *device, const resource_desc &desc, const subresource_data *initial_data, resource_usage initial_state, resource handle)
+template <typename T>
+static void write_init_resource(T &trace_data, const resource_desc &desc, const subresource_data *initial_data, resource_usage initial_state, resource id, resource handle, std::vector<uint8_t> *packed_rows)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::init_resource);
 	trace_data.write(desc);
 	trace_data.write(initial_state);
+	trace_data.write(id);
+	// Handles of the OpenGL default framebuffer are the same in every process, which playback relies on
 	trace_data.write(handle);
 
 	if (desc.type == resource_type::buffer)
@@ -141,7 +1366,7 @@ static void on_init_resource(device *device, const resource_desc &desc, const su
 		{
 			const subresource_data &subresource_data = *initial_data;
 
-			trace_data.write(subresource_data.data, static_cast<size_t>(desc.buffer.size));
+			trace_data.write_blob(subresource_data.data, static_cast<size_t>(desc.buffer.size));
 		}
 	}
 	else
@@ -160,58 +1385,93 @@ static void on_init_resource(device *device, const resource_desc &desc, const su
 				if (subresource >= subresources)
 					break;
 
-				const subresource_data &subresource_data = initial_data[subresource];
-				trace_data.write(subresource_data.row_pitch);
-				trace_data.write(subresource_data.slice_pitch);
-
-				const uint64_t size = calc_texture_size(desc, subresource, subresource_data);
-				trace_data.write(size);
-				trace_data.write(subresource_data.data, static_cast<size_t>(size));
+				write_texture_data(trace_data, desc, subresource, initial_data[subresource], nullptr, packed_rows);
 			}
 		}
 	}
 }
+
+static void on_init_resource(device *device, const resource_desc &desc, const subresource_data *initial_data, resource_usage initial_state, resource handle)
+{
+	const std::unique_lock<counted_mutex> lock(s_mutex);
+
+	auto &trace_data = device->get_private_data<device_data>();
+	const resource id = trace_data.resources.assign(handle);
+	trace_data.set_resource_state(handle, initial_state);
+
+	// Initial data is not kept around for later captures, to keep the memory overhead of tracking live objects low
+	trace_data_buffer &event = trace_data.init_object(object_kind::resource, handle.handle, reshade::addon_event::init_resource);
+	write_init_resource(event, desc, nullptr, initial_state, id, handle, nullptr);
+
+	if (!trace_data.capturing())
+		return;
+
+	if (initial_data == nullptr)
+	{
+		trace_data.write_state_event(event);
+		return;
+	}
+
+	trace_data.write_state_event(reshade::addon_event::init_resource);
+	write_init_resource(trace_data, desc, initial_data, initial_state, id, handle, trace_data.packed_rows());
+}
 static void on_destroy_resource(device *device, resource handle)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::destroy_resource);
-	trace_data.write(handle);
+	trace_data.destroy_object(object_kind::resource, handle.handle);
+	const auto id = trace_data.resources.release(handle);
+
+	if (!trace_data.capturing())
+		return;
+
+	trace_data.write_state_event(reshade::addon_event::destroy_resource);
+	trace_data.write(id);
 }
 
 static void on_init_resource_view(device *device, resource resource, resource_usage usage_type, const resource_view_desc &desc, resource_view handle)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::init_resource_view);
-	trace_data.write(resource);
-	trace_data.write(usage_type);
-	trace_data.write(desc);
-	trace_data.write(handle);
+	trace_data_buffer &event = trace_data.init_object(object_kind::resource_view, handle.handle, reshade::addon_event::init_resource_view);
+	event.write(trace_data.id(resource));
+	event.write(usage_type);
+	event.write(desc);
+	event.write(trace_data.resource_views.assign(handle));
+	event.write(handle);
+
+	if (trace_data.capturing())
+		trace_data.write_state_event(event);
 }
 static void on_destroy_resource_view(device *device, resource_view handle)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::destroy_resource_view);
-	trace_data.write(handle);
+	trace_data.destroy_object(object_kind::resource_view, handle.handle);
+	const auto id = trace_data.resource_views.release(handle);
+
+	if (!trace_data.capturing())
+		return;
+
+	trace_data.write_state_event(reshade::addon_event::destroy_resource_view);
+	trace_data.write(id);
 }
 
 static void on_init_pipeline(device *device, pipeline_layout layout, uint32_t subobject_count, const pipeline_subobject *subobjects, pipeline handle)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::init_pipeline);
-	trace_data.write(layout);
-	trace_data.write(subobject_count);
+	trace_data_buffer &event = trace_data.init_object(object_kind::pipeline, handle.handle, reshade::addon_event::init_pipeline);
+	event.write(trace_data.id(layout));
+	event.write(subobject_count);
 
 	for (uint32_t i = 0; i < subobject_count; ++i)
 	{
-		trace_data.write(subobjects[i].type);
+		event.write(subobjects[i].type);
 
 		switch (subobjects[i].type)
 		{
@@ -226,33 +1486,33 @@ static void on_init_pipeline(device *device, pipeline_layout layout, uint32_t su
 			const auto desc = static_cast<const shader_desc *>(subobjects[i].data);
 
 			const uint64_t code_size = desc->code_size;
-			trace_data.write(code_size);
-			trace_data.write(desc->code, static_cast<size_t>(code_size));
+			event.write(code_size);
+			event.write_blob(desc->code, static_cast<size_t>(code_size));
 
 			const uint32_t entry_point_length = desc->entry_point != nullptr ? static_cast<uint32_t>(strlen(desc->entry_point)) : 0;
-			trace_data.write(entry_point_length);
-			trace_data.write(desc->entry_point, entry_point_length);
+			event.write(entry_point_length);
+			event.write(desc->entry_point, entry_point_length);
 			break;
 		}
 		case pipeline_subobject_type::input_layout:
 		{
-			trace_data.write(subobjects[i].count);
+			event.write(subobjects[i].count);
 			const auto desc = static_cast<const input_element *>(subobjects[i].data);
 
 			for (uint32_t k = 0; k < subobjects[i].count; ++k)
 			{
-				trace_data.write(desc[k].location);
+				event.write(desc[k].location);
 
 				const uint32_t semantic_length = desc[k].semantic != nullptr ? static_cast<uint32_t>(strlen(desc[k].semantic)) : 0;
-				trace_data.write(semantic_length);
-				trace_data.write(desc[k].semantic, semantic_length);
-				trace_data.write(desc[k].semantic_index);
-
-				trace_data.write(desc[k].format);
-				trace_data.write(desc[k].buffer_binding);
-				trace_data.write(desc[k].offset);
-				trace_data.write(desc[k].stride);
-				trace_data.write(desc[k].instance_step_rate);
+				event.write(semantic_length);
+				event.write(desc[k].semantic, semantic_length);
+				event.write(desc[k].semantic_index);
+
+				event.write(desc[k].format);
+				event.write(desc[k].buffer_binding);
+				event.write(desc[k].offset);
+				event.write(desc[k].stride);
+				event.write(desc[k].instance_step_rate);
 			}
 			break;
 		}
@@ -261,7 +1521,7 @@ static void on_init_pipeline(device *device, pipeline_layout layout, uint32_t su
 			assert(subobjects[i].count == 1);
 			const auto desc = static_cast<const blend_desc *>(subobjects[i].data);
 
-			trace_data.write(*desc);
+			event.write(*desc);
 			break;
 		}
 		case pipeline_subobject_type::rasterizer_state:
@@ -269,7 +1529,7 @@ static void on_init_pipeline(device *device, pipeline_layout layout, uint32_t su
 			assert(subobjects[i].count == 1);
 			const auto desc = static_cast<const rasterizer_desc *>(subobjects[i].data);
 
-			trace_data.write(*desc);
+			event.write(*desc);
 			break;
 		}
 		case pipeline_subobject_type::depth_stencil_state:
@@ -277,7 +1537,7 @@ static void on_init_pipeline(device *device, pipeline_layout layout, uint32_t su
 			assert(subobjects[i].count == 1);
 			const auto desc = static_cast<const depth_stencil_desc *>(subobjects[i].data);
 
-			trace_data.write(*desc);
+			event.write(*desc);
 			break;
 		}
 		case pipeline_subobject_type::stream_output_state:
@@ -293,68 +1553,92 @@ static void on_init_pipeline(device *device, pipeline_layout layout, uint32_t su
 		}
 	}
 
-	trace_data.write(handle.handle);
+	event.write(trace_data.pipelines.assign(handle));
+
+	if (trace_data.capturing())
+		trace_data.write_state_event(event);
 }
 static void on_destroy_pipeline(device *device, pipeline handle)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::destroy_pipeline);
-	trace_data.write(handle);
+	trace_data.destroy_object(object_kind::pipeline, handle.handle);
+	const auto id = trace_data.pipelines.release(handle);
+
+	if (!trace_data.capturing())
+		return;
+
+	trace_data.write_state_event(reshade::addon_event::destroy_pipeline);
+	trace_data.write(id);
 }
 
 static void on_init_pipeline_layout(device *device, uint32_t param_count, const pipeline_layout_param *params, pipeline_layout handle)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::init_pipeline_layout);
-	trace_data.write(param_count);
+	trace_data_buffer &event = trace_data.init_object(object_kind::pipeline_layout, handle.handle, reshade::addon_event::init_pipeline_layout);
+	event.write(param_count);
 	for (uint32_t i = 0; i < param_count; ++i)
 	{
-		trace_data.write(params[i].type);
+		event.write(params[i].type);
 
 		switch (params[i].type)
 		{
 		case pipeline_layout_param_type::push_constants:
-			trace_data.write(params[i].push_constants);
+			event.write(params[i].push_constants);
 			break;
 		case pipeline_layout_param_type::push_descriptors:
-			trace_data.write(params[i].push_descriptors);
+			event.write(params[i].push_descriptors);
 			break;
 		case pipeline_layout_param_type::descriptor_table:
 		case pipeline_layout_param_type::push_descriptors_with_ranges:
-			trace_data.write(params[i].descriptor_table.count);
+			event.write(params[i].descriptor_table.count);
 			for (uint32_t k = 0; k < params[i].descriptor_table.count; ++k)
-				trace_data.write(params[i].descriptor_table.ranges[k]);
+				event.write(params[i].descriptor_table.ranges[k]);
 			break;
 		case pipeline_layout_param_type::descriptor_table_with_static_samplers:
 		case pipeline_layout_param_type::push_descriptors_with_static_samplers:
-			trace_data.write(params[i].descriptor_table_with_static_samplers.count);
+			event.write(params[i].descriptor_table_with_static_samplers.count);
 			for (uint32_t k = 0; k < params[i].descriptor_table_with_static_samplers.count; ++k)
-				trace_data.write(params[i].descriptor_table_with_static_samplers.ranges[k]);
+				event.write(params[i].descriptor_table_with_static_samplers.ranges[k]);
 			break;
 		}
 	}
 
-	trace_data.write(handle);
+	event.write(trace_data.pipeline_layouts.assign(handle));
+
+	if (trace_data.capturing())
+		trace_data.write_state_event(event);
 }
 static void on_destroy_pipeline_layout(device *device, pipeline_layout handle)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::destroy_pipeline_layout);
-	trace_data.write(handle);
+	trace_data.destroy_object(object_kind::pipeline_layout, handle.handle);
+	const auto id = trace_data.pipeline_layouts.release(handle);
+
+	if (!trace_data.capturing())
+		return;
+
+	trace_data.write_state_event(reshade::addon_event::destroy_pipeline_layout);
+	trace_data.write(id);
 }
 
 static bool on_copy_descriptor_tables(device *device, uint32_t count, const descriptor_table_copy *copies)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::copy_descriptor_tables);
+	for (uint32_t i = 0; i < count; ++i)
+		trace_data.copy_descriptors(copies[i]);
+
+	if (!trace_data.capturing())
+		return false;
+
+	trace_data.write_state_event(reshade::addon_event::copy_descriptor_tables);
 	trace_data.write(count);
 	for (uint32_t i = 0; i < count; ++i)
 		trace_data.write(copies[i]);
@@ -363,10 +1647,16 @@ static bool on_copy_descriptor_tables(device *device, uint32_t count, const desc
 }
 static bool on_update_descriptor_tables(device *device, uint32_t count, const descriptor_table_update *updates)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::update_descriptor_tables);
+	for (uint32_t i = 0; i < count; ++i)
+		trace_data.update_descriptors(updates[i]);
+
+	if (!trace_data.capturing())
+		return false;
+
+	trace_data.write_state_event(reshade::addon_event::update_descriptor_tables);
 	trace_data.write(count);
 	for (uint32_t i = 0; i < count; ++i)
 	{
@@ -377,22 +1667,7 @@ static bool on_update_descriptor_tables(device *device, uint32_t count, const de
 		trace_data.write(update.array_offset);
 		trace_data.write(update.count);
 		trace_data.write(update.type);
-
-		switch (update.type)
-		{
-		case descriptor_type::sampler:
-		case descriptor_type::shader_resource_view:
-		case descriptor_type::unordered_access_view:
-		case descriptor_type::shader_storage_buffer:
-			trace_data.write(static_cast<const uint64_t *>(update.descriptors) + i * 1, sizeof(uint64_t) * 1);
-			break;
-		case descriptor_type::sampler_with_resource_view:
-			trace_data.write(static_cast<const uint64_t *>(update.descriptors) + i * 2, sizeof(uint64_t) * 2);
-			break;
-		case descriptor_type::constant_buffer:
-			trace_data.write(static_cast<const uint64_t *>(update.descriptors) + i * 3, sizeof(uint64_t) * 3);
-			break;
-		}
+		write_descriptors(trace_data, update.type, update.count, update.descriptors);
 	}
 
 	return false;
@@ -403,79 +1678,91 @@ static void on_map_buffer_region(device *device, resource resource, uint64_t off
 	if (UINT64_MAX == size)
 		size = device->get_resource_desc(resource).buffer.size;
 
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::map_buffer_region);
-	trace_data.write(resource);
-	trace_data.write(offset);
-	trace_data.write(size);
-	trace_data.write(access);
+	// Mappings are tracked even while not capturing, since a capture may start before the resource is unmapped again
+	trace_data.push_mapping({ resource, offset, size, 0, false, subresource_box {}, access, subresource_data { *data } });
+
+	if (!trace_data.capturing())
+		return;
 
-	mappings.push_back({ resource, offset, size, 0, false, subresource_box {}, access, subresource_data { *data } });
+	trace_data.write_state_event<reshade::addon_event::map_buffer_region>({ trace_data.id(resource), offset, size, access });
 }
 static void on_unmap_buffer_region(device *device, resource resource)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::unmap_buffer_region);
-	trace_data.write(resource);
 
-	const auto mapping_it = std::find_if(mappings.begin(), mappings.end(), [resource](const auto &mapping) { return mapping.resource == resource; });
-	assert(mapping_it != mappings.end());
-	const mapping &mapping = *mapping_it;
+	mapping *const mapping_data = trace_data.find_mapping(resource, 0);
+	assert(mapping_data != nullptr);
+	mapping &mapping = *mapping_data;
 
-	trace_data.write(mapping.offset);
-	trace_data.write(mapping.size);
-	trace_data.write(mapping.access);
+	if (!trace_data.capturing())
+	{
+		trace_data.pop_mapping(resource, 0);
+		return;
+	}
+
+	// Large mappings that were flushed before only need the pages written that changed since
+	if (!mapping.page_hashes.empty())
+	{
+		trace_data.flush_mapping_pages(mapping);
+		trace_data.pop_mapping(resource, 0);
+		return;
+	}
+
+	trace_data.write_state_event<reshade::addon_event::unmap_buffer_region>({ trace_data.id(resource), mapping.offset, mapping.size, mapping.flushed ? map_access::write_only : mapping.access });
 
 	if (mapping.access != map_access::read_only)
 	{
 		assert(mapping.size <= std::numeric_limits<size_t>::max());
-		trace_data.write(mapping.data.data, static_cast<size_t>(mapping.size));
+		trace_data.write_buffer_data(resource, mapping.offset, mapping.size, mapping.data.data, mapping.flushed);
 	}
 
-	mappings.erase(mapping_it);
+	trace_data.pop_mapping(resource, 0);
 }
 static void on_map_texture_region(device *device, resource resource, uint32_t subresource, const subresource_box *box, map_access access, subresource_data *data)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::map_texture_region);
-	trace_data.write(resource);
-	trace_data.write(subresource);
 	const bool has_box = box != nullptr;
+	trace_data.push_mapping({ resource, 0, 0, subresource, has_box, has_box ? *box : subresource_box {}, access, *data });
+
+	if (!trace_data.capturing())
+		return;
+
+	trace_data.write_state_event(reshade::addon_event::map_texture_region);
+	trace_data.write(trace_data.id(resource));
+	trace_data.write(subresource);
 	trace_data.write(has_box);
 	if (has_box)
 		trace_data.write(*box);
 	trace_data.write(access);
-
-	const auto mapping_it = std::find_if(mappings.begin(), mappings.end(), [resource, subresource](const auto &mapping) { return mapping.resource == resource && mapping.subresource == subresource; });
-	if (mapping_it != mappings.end() && mapping_it->data.data == data->data)
-	{
-		mapping_it->ref++;
-	}
-	else
-	{
-		mappings.push_back({ resource, 0, 0, subresource, has_box, has_box ? *box : subresource_box {}, access, *data });
-	}
 }
 static void on_unmap_texture_region(device *device, resource resource, uint32_t subresource)
 {
 	const auto desc = device->get_resource_desc(resource);
 
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::unmap_texture_region);
-	trace_data.write(resource);
-	trace_data.write(subresource);
 
-	const auto mapping_it = std::find_if(mappings.rbegin(), mappings.rend(), [resource, subresource](const auto &mapping) { return mapping.resource == resource && mapping.subresource == subresource; });
-	assert(mapping_it != mappings.rend());
-	const mapping &mapping = *mapping_it;
+	const mapping *const mapping_data = trace_data.find_mapping(resource, subresource);
+	assert(mapping_data != nullptr);
+	const mapping &mapping = *mapping_data;
+
+	if (!trace_data.capturing())
+	{
+		trace_data.pop_mapping(resource, subresource);
+		return;
+	}
+
+	trace_data.write_state_event(reshade::addon_event::unmap_texture_region);
+	trace_data.write(trace_data.id(resource));
+	trace_data.write(subresource);
 
 	trace_data.write(mapping.has_box);
 	if (mapping.has_box)
@@ -483,15 +1770,9 @@ static void on_unmap_texture_region(device *device, resource resource, uint32_t
 	trace_data.write(mapping.access);
 
 	if (mapping.access != map_access::read_only)
-	{
-		const uint64_t size = calc_texture_size(desc, subresource, mapping.data, mapping.has_box ? &mapping.box : nullptr);
-		trace_data.write(size);
-		assert(size <= std::numeric_limits<size_t>::max());
-		trace_data.write(mapping.data.data, static_cast<size_t>(size));
-	}
+		write_texture_data(trace_data, desc, subresource, mapping.data, mapping.has_box ? &mapping.box : nullptr, trace_data.packed_rows());
 
-	if (--mapping_it->ref == 0)
-		mappings.erase((mapping_it + 1).base());
+	trace_data.pop_mapping(resource, subresource);
 
 }
 static bool on_update_buffer_region(device *device, const void *data, resource resource, uint64_t offset, uint64_t size)
@@ -499,16 +1780,16 @@ static bool on_update_buffer_region(device *device, const void *data, resource r
 	if (UINT64_MAX == size)
 		size = device->get_resource_desc(resource).buffer.size;
 
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::update_buffer_region);
-	trace_data.write(resource);
-	trace_data.write(offset);
-	trace_data.write(size);
+	if (!trace_data.capturing())
+		return false;
+
+	trace_data.write_state_event<reshade::addon_event::update_buffer_region>({ trace_data.id(resource), offset, size });
 
 	assert(size <= std::numeric_limits<size_t>::max());
-	trace_data.write(data, static_cast<size_t>(size));
+	trace_data.write_blob(data, static_cast<size_t>(size));
 
 	return false;
 }
@@ -516,92 +1797,86 @@ static bool on_update_texture_region(device *device, const subresource_data &dat
 {
 	const auto desc = device->get_resource_desc(resource);
 
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::update_texture_region);
-	trace_data.write(resource);
-	trace_data.write(subresource);
+	if (!trace_data.capturing())
+		return false;
+
 	const bool has_box = box != nullptr;
-	trace_data.write(has_box);
+	trace_data.write_state_event<reshade::addon_event::update_texture_region>({ trace_data.id(resource), subresource, has_box });
 	if (has_box)
 		trace_data.write(*box);
 
-	trace_data.write(data.row_pitch);
-	trace_data.write(data.slice_pitch);
-
-	const uint64_t size = calc_texture_size(desc, subresource, data, box);
-	trace_data.write(size);
-	assert(size <= std::numeric_limits<size_t>::max());
-	trace_data.write(data.data, static_cast<size_t>(size));
+	write_texture_data(trace_data, desc, subresource, data, box, trace_data.packed_rows());
 
 	return false;
 }
 
 static void on_barrier(command_list *cmd_list, uint32_t count, const resource *resources, const resource_usage *old_states, const resource_usage *new_states)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::barrier);
-	trace_data.write(count);
+	trace_data.write_varint(count);
 	for (uint32_t i = 0; i < count; ++i)
-	{
-		trace_data.write(resources[i]);
-		trace_data.write(old_states[i]);
-		trace_data.write(new_states[i]);
-	}
+		write_compact(trace_data, trace_resource_barrier { trace_data.id(resources[i]), old_states[i], new_states[i] });
+
+	// Only D3D12 and Vulkan need the state of a resource to copy it
+	auto &cmd_data = cmd_list->get_private_data<command_list_data>();
+	if (!cmd_data.immediate)
+		for (uint32_t i = 0; i < count; ++i)
+			cmd_data.resource_states.emplace_back(resources[i].handle, new_states[i]);
 }
 
 static void on_begin_render_pass(command_list *cmd_list, uint32_t count, const render_pass_render_target_desc *rts, const render_pass_depth_stencil_desc *ds)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::begin_render_pass);
 	trace_data.write(count);
 	for (uint32_t i = 0; i < count; ++i)
 	{
-		trace_data.write(rts[i]);
+		render_pass_render_target_desc rt = rts[i];
+		rt.view = trace_data.id(rt.view);
+		trace_data.write(rt);
 	}
 	const bool has_ds = ds != nullptr;
 	trace_data.write(has_ds);
 	if (has_ds)
-		trace_data.write(*ds);
+	{
+		render_pass_depth_stencil_desc ds_desc = *ds;
+		ds_desc.view = trace_data.id(ds_desc.view);
+		trace_data.write(ds_desc);
+	}
 }
 static void on_end_render_pass(command_list *cmd_list)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::end_render_pass);
 }
 static void on_bind_render_targets_and_depth_stencil(command_list *cmd_list, uint32_t count, const resource_view *rtvs, resource_view dsv)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::bind_render_targets_and_depth_stencil);
 	trace_data.write(count);
 	for (uint32_t i = 0; i < count; ++i)
-		trace_data.write(rtvs[i]);
-	trace_data.write(dsv);
+		trace_data.write(trace_data.id(rtvs[i]));
+	trace_data.write(trace_data.id(dsv));
 }
 
 static void on_bind_pipeline(command_list *cmd_list, pipeline_stage type, pipeline pipeline)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	command_list_writer trace_data(cmd_list);
+	if (command_list_data *const state = trace_data.bound_state(); state != nullptr && !state->bind_pipeline(type, pipeline))
+		return;
 
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::bind_pipeline);
-	trace_data.write(type);
-	trace_data.write(pipeline);
+	write_compact_event<reshade::addon_event::bind_pipeline>(trace_data, { type, trace_data.id(pipeline) });
 }
 static void on_bind_pipeline_states(command_list *cmd_list, uint32_t count, const dynamic_state *states, const uint32_t *values)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	command_list_writer trace_data(cmd_list);
+	if (command_list_data *const state = trace_data.bound_state(); state != nullptr && !state->bind_pipeline_states(count, states, values))
+		return;
 
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
 	trace_data.write(reshade::addon_event::bind_pipeline_states);
 	trace_data.write(count);
 	for (uint32_t i = 0; i < count; ++i)
@@ -612,9 +1887,10 @@ static void on_bind_pipeline_states(command_list *cmd_list, uint32_t count, cons
 }
 static void on_bind_viewports(command_list *cmd_list, uint32_t first, uint32_t count, const viewport *viewports)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	command_list_writer trace_data(cmd_list);
+	if (command_list_data *const state = trace_data.bound_state(); state != nullptr && !state->bind_viewports(first, count, viewports))
+		return;
 
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
 	trace_data.write(reshade::addon_event::bind_viewports);
 	trace_data.write(first);
 	trace_data.write(count);
@@ -623,9 +1899,10 @@ static void on_bind_viewports(command_list *cmd_list, uint32_t first, uint32_t c
 }
 static void on_bind_scissor_rects(command_list *cmd_list, uint32_t first, uint32_t count, const rect *rects)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	command_list_writer trace_data(cmd_list);
+	if (command_list_data *const state = trace_data.bound_state(); state != nullptr && !state->bind_scissor_rects(first, count, rects))
+		return;
 
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
 	trace_data.write(reshade::addon_event::bind_scissor_rects);
 	trace_data.write(first);
 	trace_data.write(count);
@@ -634,12 +1911,10 @@ static void on_bind_scissor_rects(command_list *cmd_list, uint32_t first, uint32
 }
 static void on_push_constants(command_list *cmd_list, shader_stage stages, pipeline_layout layout, uint32_t param_index, uint32_t first, uint32_t count, const void *values)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::push_constants);
 	trace_data.write(stages);
-	trace_data.write(layout);
+	trace_data.write(trace_data.id(layout));
 	trace_data.write(param_index);
 	trace_data.write(first);
 	trace_data.write(count);
@@ -648,44 +1923,23 @@ static void on_push_constants(command_list *cmd_list, shader_stage stages, pipel
 }
 static void on_push_descriptors(command_list *cmd_list, shader_stage stages, pipeline_layout layout, uint32_t param_index, const descriptor_table_update &update)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::push_descriptors);
 	trace_data.write(stages);
-	trace_data.write(layout);
+	trace_data.write(trace_data.id(layout));
 	trace_data.write(param_index);
 	trace_data.write(update.binding);
 	trace_data.write(update.array_offset);
 	trace_data.write(update.count);
 	trace_data.write(update.type);
-	for (uint32_t i = 0; i < update.count; ++i)
-	{
-		switch (update.type)
-		{
-		case descriptor_type::sampler:
-		case descriptor_type::shader_resource_view:
-		case descriptor_type::unordered_access_view:
-		case descriptor_type::shader_storage_buffer:
-			trace_data.write(static_cast<const uint64_t *>(update.descriptors) + i * 1, sizeof(uint64_t) * 1);
-			break;
-		case descriptor_type::sampler_with_resource_view:
-			trace_data.write(static_cast<const uint64_t *>(update.descriptors) + i * 2, sizeof(uint64_t) * 2);
-			break;
-		case descriptor_type::constant_buffer:
-			trace_data.write(static_cast<const uint64_t *>(update.descriptors) + i * 3, sizeof(uint64_t) * 3);
-			break;
-		}
-	}
+	write_descriptors(trace_data, update.type, update.count, update.descriptors);
 }
 static void on_bind_descriptor_tables(command_list *cmd_list, shader_stage stages, pipeline_layout layout, uint32_t first, uint32_t count, const descriptor_table *tables)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::bind_descriptor_tables);
 	trace_data.write(stages);
-	trace_data.write(layout);
+	trace_data.write(trace_data.id(layout));
 	trace_data.write(first);
 	trace_data.write(count);
 	for (uint32_t i = 0; i < count; ++i)
@@ -693,137 +1947,86 @@ static void on_bind_descriptor_tables(command_list *cmd_list, shader_stage stage
 }
 static void on_bind_index_buffer(command_list *cmd_list, resource buffer, uint64_t offset, uint32_t index_size)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::bind_index_buffer);
-	trace_data.write(buffer);
-	trace_data.write(offset);
-	trace_data.write(index_size);
+	command_list_writer trace_data(cmd_list);
+	write_compact_event<reshade::addon_event::bind_index_buffer>(trace_data, { trace_data.id(buffer), offset, index_size });
 }
 static void on_bind_vertex_buffers(command_list *cmd_list, uint32_t first, uint32_t count, const resource *buffers, const uint64_t *offsets, const uint32_t *strides)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::bind_vertex_buffers);
-	trace_data.write(first);
-	trace_data.write(count);
+	trace_data.write_varint(first);
+	trace_data.write_varint(count);
 	for (uint32_t i = 0; i < count; ++i)
-	{
-		trace_data.write(buffers[i]);
-		trace_data.write(offsets[i]);
-		trace_data.write(strides != nullptr ? strides[i] : 0u);
-	}
+		write_compact(trace_data, trace_vertex_buffer_binding { trace_data.id(buffers[i]), offsets[i], strides != nullptr ? strides[i] : 0u });
 }
 static void on_bind_stream_output_buffers(command_list *cmd_list, uint32_t first, uint32_t count, const resource *buffers, const uint64_t *offsets, const uint64_t *max_sizes, const resource *counter_buffers, const uint64_t *counter_offsets)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::bind_stream_output_buffers);
 	trace_data.write(first);
 	trace_data.write(count);
 	for (uint32_t i = 0; i < count; ++i)
 	{
-		trace_data.write(buffers[i]);
+		trace_data.write(trace_data.id(buffers[i]));
 		trace_data.write(offsets[i]);
 		trace_data.write(max_sizes != nullptr ? max_sizes[i] : 0u);
-		trace_data.write(counter_buffers != nullptr ? counter_buffers[i] : resource { 0 });
+		trace_data.write(counter_buffers != nullptr ? trace_data.id(counter_buffers[i]) : resource { 0 });
 		trace_data.write(counter_offsets != nullptr ? counter_offsets[i] : 0u);
 	}
 }
 
 static bool on_draw(command_list *cmd_list, uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::draw);
-	trace_data.write(vertex_count);
-	trace_data.write(instance_count);
-	trace_data.write(first_vertex);
-	trace_data.write(first_instance);
+	command_list_writer trace_data(cmd_list);
+	write_compact_event<reshade::addon_event::draw>(trace_data, { vertex_count, instance_count, first_vertex, first_instance });
 
 	return false;
 }
 static bool on_draw_indexed(command_list *cmd_list, uint32_t index_count, uint32_t instance_count, uint32_t first_index, int32_t vertex_offset, uint32_t first_instance)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::draw_indexed);
-	trace_data.write(index_count);
-	trace_data.write(instance_count);
-	trace_data.write(first_index);
-	trace_data.write(vertex_offset);
-	trace_data.write(first_instance);
+	command_list_writer trace_data(cmd_list);
+	write_compact_event<reshade::addon_event::draw_indexed>(trace_data, { index_count, instance_count, first_index, vertex_offset, first_instance });
 
 	return false;
 }
 static bool on_dispatch(command_list *cmd_list, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::dispatch);
-	trace_data.write(group_count_x);
-	trace_data.write(group_count_y);
-	trace_data.write(group_count_z);
+	command_list_writer trace_data(cmd_list);
+	write_compact_event<reshade::addon_event::dispatch>(trace_data, { group_count_x, group_count_y, group_count_z });
 
 	return false;
 }
 static bool on_draw_or_dispatch_indirect(command_list *cmd_list, indirect_command type, resource buffer, uint64_t offset, uint32_t draw_count, uint32_t stride)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::draw_or_dispatch_indirect);
-	trace_data.write(type);
-	trace_data.write(buffer);
-	trace_data.write(offset);
-	trace_data.write(draw_count);
-	trace_data.write(stride);
+	command_list_writer trace_data(cmd_list);
+	write_compact_event<reshade::addon_event::draw_or_dispatch_indirect>(trace_data, { type, trace_data.id(buffer), offset, draw_count, stride });
 
 	return false;
 }
 
 static bool on_copy_resource(command_list *cmd_list, resource src, resource dst)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::copy_resource);
-	trace_data.write(src);
-	trace_data.write(dst);
+	command_list_writer trace_data(cmd_list);
+	trace_data.write(make_trace_event<reshade::addon_event::copy_resource>({ trace_data.id(src), trace_data.id(dst) }));
 
 	return false;
 }
 static bool on_copy_buffer_region(command_list *cmd_list, resource src, uint64_t src_offset, resource dst, uint64_t dst_offset, uint64_t size)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::copy_buffer_region);
-	trace_data.write(src);
-	trace_data.write(src_offset);
-	trace_data.write(dst);
-	trace_data.write(dst_offset);
-	trace_data.write(size);
+	command_list_writer trace_data(cmd_list);
+	trace_data.write(make_trace_event<reshade::addon_event::copy_buffer_region>({ trace_data.id(src), src_offset, trace_data.id(dst), dst_offset, size }));
 
 	return false;
 }
 static bool on_copy_buffer_to_texture(command_list *cmd_list, resource src, uint64_t src_offset, uint32_t row_length, uint32_t slice_height, resource dst, uint32_t dst_subresource, const subresource_box *dst_box)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::copy_buffer_to_texture);
-	trace_data.write(src);
+	trace_data.write(trace_data.id(src));
 	trace_data.write(src_offset);
 	trace_data.write(row_length);
 	trace_data.write(slice_height);
-	trace_data.write(dst);
+	trace_data.write(trace_data.id(dst));
 	trace_data.write(dst_subresource);
 	const bool has_dst_box = dst_box != nullptr;
 	trace_data.write(has_dst_box);
@@ -834,17 +2037,15 @@ static bool on_copy_buffer_to_texture(command_list *cmd_list, resource src, uint
 }
 static bool on_copy_texture_region(command_list *cmd_list, resource src, uint32_t src_subresource, const subresource_box *src_box, resource dst, uint32_t dst_subresource, const subresource_box *dst_box, filter_mode filter)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::copy_texture_region);
-	trace_data.write(src);
+	trace_data.write(trace_data.id(src));
 	trace_data.write(src_subresource);
 	const bool has_src_box = src_box != nullptr;
 	trace_data.write(has_src_box);
 	if (has_src_box)
 		trace_data.write(*src_box);
-	trace_data.write(dst);
+	trace_data.write(trace_data.id(dst));
 	trace_data.write(dst_subresource);
 	const bool has_dst_box = dst_box != nullptr;
 	trace_data.write(has_dst_box);
@@ -856,17 +2057,15 @@ static bool on_copy_texture_region(command_list *cmd_list, resource src, uint32_
 }
 static bool on_copy_texture_to_buffer(command_list *cmd_list, resource src, uint32_t src_subresource, const subresource_box *src_box, resource dst, uint64_t dst_offset, uint32_t row_length, uint32_t slice_height)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::copy_texture_to_buffer);
-	trace_data.write(src);
+	trace_data.write(trace_data.id(src));
 	trace_data.write(src_subresource);
 	const bool has_src_box = src_box != nullptr;
 	trace_data.write(has_src_box);
 	if (has_src_box)
 		trace_data.write(*src_box);
-	trace_data.write(dst);
+	trace_data.write(trace_data.id(dst));
 	trace_data.write(dst_offset);
 	trace_data.write(row_length);
 	trace_data.write(slice_height);
@@ -875,17 +2074,15 @@ static bool on_copy_texture_to_buffer(command_list *cmd_list, resource src, uint
 }
 static bool on_resolve_texture_region(command_list *cmd_list, resource src, uint32_t src_subresource, const subresource_box *src_box, resource dst, uint32_t dst_subresource, int32_t dst_x, int32_t dst_y, int32_t dst_z, format format)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::resolve_texture_region);
-	trace_data.write(src);
+	trace_data.write(trace_data.id(src));
 	trace_data.write(src_subresource);
 	const bool has_src_box = src_box != nullptr;
 	trace_data.write(has_src_box);
 	if (has_src_box)
 		trace_data.write(*src_box);
-	trace_data.write(dst);
+	trace_data.write(trace_data.id(dst));
 	trace_data.write(dst_subresource);
 	trace_data.write(dst_x);
 	trace_data.write(dst_y);
@@ -897,11 +2094,9 @@ static bool on_resolve_texture_region(command_list *cmd_list, resource src, uint
 
 static bool on_clear_depth_stencil_view(command_list *cmd_list, resource_view dsv, const float *depth, const uint8_t *stencil, uint32_t, const rect *)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
+	command_list_writer trace_data(cmd_list);
 	trace_data.write(reshade::addon_event::clear_depth_stencil_view);
-	trace_data.write(dsv);
+	trace_data.write(trace_data.id(dsv));
 	const bool has_depth = depth != nullptr;
 	trace_data.write(has_depth);
 	if (has_depth)
@@ -915,45 +2110,30 @@ static bool on_clear_depth_stencil_view(command_list *cmd_list, resource_view ds
 }
 static bool on_clear_render_target_view(command_list *cmd_list, resource_view rtv, const float color[4], uint32_t, const rect *)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::clear_render_target_view);
-	trace_data.write(rtv);
-	trace_data.write(color, sizeof(float) * 4);
+	command_list_writer trace_data(cmd_list);
+	trace_data.write(make_trace_event<reshade::addon_event::clear_render_target_view>({ trace_data.id(rtv), { color[0], color[1], color[2], color[3] } }));
 
 	return false;
 }
 static bool on_clear_unordered_access_view_uint(command_list *cmd_list, resource_view uav, const uint32_t values[4], uint32_t, const rect *)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::clear_unordered_access_view_uint);
-	trace_data.write(uav);
-	trace_data.write(values, sizeof(uint32_t) * 4);
+	command_list_writer trace_data(cmd_list);
+	trace_data.write(make_trace_event<reshade::addon_event::clear_unordered_access_view_uint>({ trace_data.id(uav), { values[0], values[1], values[2], values[3] } }));
 
 	return false;
 }
 static bool on_clear_unordered_access_view_float(command_list *cmd_list, resource_view uav, const float values[4], uint32_t, const rect *)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::clear_unordered_access_view_float);
-	trace_data.write(uav);
-	trace_data.write(values, sizeof(float) * 4);
+	command_list_writer trace_data(cmd_list);
+	trace_data.write(make_trace_event<reshade::addon_event::clear_unordered_access_view_float>({ trace_data.id(uav), { values[0], values[1], values[2], values[3] } }));
 
 	return false;
 }
 
 static bool on_generate_mipmaps(command_list *cmd_list, resource_view srv)
 {
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
-
-	auto &trace_data = cmd_list->get_device()->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::generate_mipmaps);
-	trace_data.write(srv);
+	command_list_writer trace_data(cmd_list);
+	trace_data.write(make_trace_event<reshade::addon_event::generate_mipmaps>({ trace_data.id(srv) }));
 
 	return false;
 }
@@ -973,26 +2153,83 @@ static bool on_copy_query_heap_results(command_list *cmd_list, query_heap heap,
 
 static void on_reset_command_list(command_list *cmd_list)
 {
+	auto &cmd_data = cmd_list->get_private_data<command_list_data>();
+	cmd_data.clear();
+	cmd_data.reset_bound_state();
+	cmd_data.resource_states.clear();
 }
 static void on_execute_command_list(command_queue *queue, command_list *cmd_list)
 {
+	auto &cmd_data = cmd_list->get_private_data<command_list_data>();
+	if (cmd_data.immediate || cmd_data.empty())
+		return;
+
+	device *const device = queue->get_device();
+
+	const std::unique_lock<counted_mutex> lock(s_mutex);
+
+	// Keep the recorded commands around, since a closed command list may be submitted multiple times before it is reset
+	auto &trace_data = device->get_private_data<device_data>();
+	trace_data.apply_resource_states(cmd_data.resource_states);
+
+	if (!trace_data.capturing())
+		return;
+
+	trace_data.flush_mappings();
+
+	// The commands are followed by the submission, to preserve which command list they were recorded on and the order command lists were executed in
+	trace_data.append(cmd_data);
+	// Queues that were created before the add-on was loaded are not known and written as zero
+	const auto queue_it = trace_data.command_queue_ids.find(reinterpret_cast<uintptr_t>(queue));
+	const uint64_t queue_id = queue_it != trace_data.command_queue_ids.end() ? queue_it->second : 0;
+	trace_data.write(make_trace_event<reshade::addon_event::execute_command_list>({ queue_id, cmd_data.id }));
 }
 static void on_execute_secondary_command_list(command_list *cmd_list, command_list *secondary_cmd_list)
 {
+	const auto &secondary_cmd_data = secondary_cmd_list->get_private_data<command_list_data>();
+
+	command_list_writer trace_data(cmd_list);
+	if (!secondary_cmd_data.immediate)
+		trace_data.append(secondary_cmd_data);
+
+	auto &cmd_data = cmd_list->get_private_data<command_list_data>();
+	if (!cmd_data.immediate)
+		cmd_data.resource_states.insert(cmd_data.resource_states.end(), secondary_cmd_data.resource_states.begin(), secondary_cmd_data.resource_states.end());
+
+	// The secondary command list may have bound anything (or reset all state, as D3D11 deferred contexts do)
+	if (command_list_data *const state = trace_data.bound_state())
+		state->reset_bound_state();
 }
 
 static void on_present(command_queue *queue, swapchain *, const rect *, const rect *, uint32_t, const rect *)
 {
 	device *const device = queue->get_device();
 
-	const std::unique_lock<std::shared_mutex> lock(s_mutex);
+	const std::unique_lock<counted_mutex> lock(s_mutex);
 
 	auto &trace_data = device->get_private_data<device_data>();
-	trace_data.write(reshade::addon_event::present);
+	trace_data.flush_mappings();
+
+	if (s_count_overhead)
+		s_overhead.sample_pending_blocks(trace_data.pending_blocks());
+
+	trace_data.end_frame(queue);
+}
+
+static void on_reshade_present(effect_runtime *runtime)
+{
+	auto &trace_data = runtime->get_device()->get_private_data<device_data>();
+	if (trace_data.capture_key == 0 || !runtime->is_key_pressed(trace_data.capture_key))
+		return;
+
+	const std::unique_lock<counted_mutex> lock(s_mutex);
+
+	// The capture starts with the next frame
+	trace_data.request_capture();
 }
 
 extern "C" __declspec(dllexport) const char *NAME = "API Trace";
-extern "C" __declspec(dllexport) const char *DESCRIPTION = "Example add-on that logs the graphics API calls done by the application of the next frame after pressing a keyboard shortcut.";
+extern "C" __declspec(dllexport) const char *DESCRIPTION = "Example add-on that logs the graphics API calls done by the application, either for the whole session or for a range of frames or the next frames after pressing a keyboard shortcut.";
 
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
 {
@@ -1002,71 +2239,77 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
 		if (!reshade::register_addon(hModule))
 			return FALSE;
 
-		reshade::register_event<reshade::addon_event::init_device>(on_init_device);
-		reshade::register_event<reshade::addon_event::destroy_device>(on_destroy_device);
-		reshade::register_event<reshade::addon_event::init_command_list>(on_init_command_list);
-		reshade::register_event<reshade::addon_event::destroy_command_list>(on_destroy_command_list);
-		reshade::register_event<reshade::addon_event::init_swapchain>(on_init_swapchain);
-		reshade::register_event<reshade::addon_event::destroy_swapchain>(on_destroy_swapchain);
-		reshade::register_event<reshade::addon_event::init_sampler>(on_init_sampler);
-		reshade::register_event<reshade::addon_event::destroy_sampler>(on_destroy_sampler);
-		reshade::register_event<reshade::addon_event::init_resource>(on_init_resource);
-		reshade::register_event<reshade::addon_event::destroy_resource>(on_destroy_resource);
-		reshade::register_event<reshade::addon_event::init_resource_view>(on_init_resource_view);
-		reshade::register_event<reshade::addon_event::destroy_resource_view>(on_destroy_resource_view);
-		reshade::register_event<reshade::addon_event::init_pipeline>(on_init_pipeline);
-		reshade::register_event<reshade::addon_event::destroy_pipeline>(on_destroy_pipeline);
-		reshade::register_event<reshade::addon_event::init_pipeline_layout>(on_init_pipeline_layout);
-		reshade::register_event<reshade::addon_event::destroy_pipeline_layout>(on_destroy_pipeline_layout);
-
-		reshade::register_event<reshade::addon_event::copy_descriptor_tables>(on_copy_descriptor_tables);
-		reshade::register_event<reshade::addon_event::update_descriptor_tables>(on_update_descriptor_tables);
-
-		reshade::register_event<reshade::addon_event::map_buffer_region>(on_map_buffer_region);
-		reshade::register_event<reshade::addon_event::unmap_buffer_region>(on_unmap_buffer_region);
-		reshade::register_event<reshade::addon_event::map_texture_region>(on_map_texture_region);
-		reshade::register_event<reshade::addon_event::unmap_texture_region>(on_unmap_texture_region);
-		reshade::register_event<reshade::addon_event::update_buffer_region>(on_update_buffer_region);
-		reshade::register_event<reshade::addon_event::update_texture_region>(on_update_texture_region);
-
-		reshade::register_event<reshade::addon_event::barrier>(on_barrier);
-		reshade::register_event<reshade::addon_event::begin_render_pass>(on_begin_render_pass);
-		reshade::register_event<reshade::addon_event::end_render_pass>(on_end_render_pass);
-		reshade::register_event<reshade::addon_event::bind_render_targets_and_depth_stencil>(on_bind_render_targets_and_depth_stencil);
-		reshade::register_event<reshade::addon_event::bind_pipeline>(on_bind_pipeline);
-		reshade::register_event<reshade::addon_event::bind_pipeline_states>(on_bind_pipeline_states);
-		reshade::register_event<reshade::addon_event::bind_viewports>(on_bind_viewports);
-		reshade::register_event<reshade::addon_event::bind_scissor_rects>(on_bind_scissor_rects);
-		reshade::register_event<reshade::addon_event::push_constants>(on_push_constants);
-		reshade::register_event<reshade::addon_event::push_descriptors>(on_push_descriptors);
-		reshade::register_event<reshade::addon_event::bind_descriptor_tables>(on_bind_descriptor_tables);
-		reshade::register_event<reshade::addon_event::bind_index_buffer>(on_bind_index_buffer);
-		reshade::register_event<reshade::addon_event::bind_vertex_buffers>(on_bind_vertex_buffers);
-		reshade::register_event<reshade::addon_event::bind_stream_output_buffers>(on_bind_stream_output_buffers);
-		reshade::register_event<reshade::addon_event::draw>(on_draw);
-		reshade::register_event<reshade::addon_event::draw_indexed>(on_draw_indexed);
-		reshade::register_event<reshade::addon_event::dispatch>(on_dispatch);
-		reshade::register_event<reshade::addon_event::draw_or_dispatch_indirect>(on_draw_or_dispatch_indirect);
-		reshade::register_event<reshade::addon_event::copy_resource>(on_copy_resource);
-		reshade::register_event<reshade::addon_event::copy_buffer_region>(on_copy_buffer_region);
-		reshade::register_event<reshade::addon_event::copy_buffer_to_texture>(on_copy_buffer_to_texture);
-		reshade::register_event<reshade::addon_event::copy_texture_region>(on_copy_texture_region);
-		reshade::register_event<reshade::addon_event::copy_texture_to_buffer>(on_copy_texture_to_buffer);
-		reshade::register_event<reshade::addon_event::resolve_texture_region>(on_resolve_texture_region);
-		reshade::register_event<reshade::addon_event::clear_depth_stencil_view>(on_clear_depth_stencil_view);
-		reshade::register_event<reshade::addon_event::clear_render_target_view>(on_clear_render_target_view);
-		reshade::register_event<reshade::addon_event::clear_unordered_access_view_uint>(on_clear_unordered_access_view_uint);
-		reshade::register_event<reshade::addon_event::clear_unordered_access_view_float>(on_clear_unordered_access_view_float);
-		reshade::register_event<reshade::addon_event::generate_mipmaps>(on_generate_mipmaps);
-		reshade::register_event<reshade::addon_event::begin_query>(on_begin_query);
-		reshade::register_event<reshade::addon_event::end_query>(on_end_query);
-		reshade::register_event<reshade::addon_event::copy_query_heap_results>(on_copy_query_heap_results);
-
-		reshade::register_event<reshade::addon_event::reset_command_list>(on_reset_command_list);
-		reshade::register_event<reshade::addon_event::execute_command_list>(on_execute_command_list);
-		reshade::register_event<reshade::addon_event::execute_secondary_command_list>(on_execute_secondary_command_list);
-
-		reshade::register_event<reshade::addon_event::present>(on_present);
+		// Has to be known before registering the callbacks, since it decides whether they are wrapped to be counted
+		reshade::get_config_value(nullptr, "APITRACE", "OverheadCounters", s_count_overhead);
+
+		register_callback<reshade::addon_event::init_device, on_init_device>();
+		register_callback<reshade::addon_event::destroy_device, on_destroy_device>();
+		register_callback<reshade::addon_event::init_command_list, on_init_command_list>();
+		register_callback<reshade::addon_event::destroy_command_list, on_destroy_command_list>();
+		register_callback<reshade::addon_event::init_command_queue, on_init_command_queue>();
+		register_callback<reshade::addon_event::destroy_command_queue, on_destroy_command_queue>();
+		register_callback<reshade::addon_event::init_swapchain, on_init_swapchain>();
+		register_callback<reshade::addon_event::destroy_swapchain, on_destroy_swapchain>();
+		register_callback<reshade::addon_event::init_sampler, on_init_sampler>();
+		register_callback<reshade::addon_event::destroy_sampler, on_destroy_sampler>();
+		register_callback<reshade::addon_event::init_resource, on_init_resource>();
+		register_callback<reshade::addon_event::destroy_resource, on_destroy_resource>();
+		register_callback<reshade::addon_event::init_resource_view, on_init_resource_view>();
+		register_callback<reshade::addon_event::destroy_resource_view, on_destroy_resource_view>();
+		register_callback<reshade::addon_event::init_pipeline, on_init_pipeline>();
+		register_callback<reshade::addon_event::destroy_pipeline, on_destroy_pipeline>();
+		register_callback<reshade::addon_event::init_pipeline_layout, on_init_pipeline_layout>();
+		register_callback<reshade::addon_event::destroy_pipeline_layout, on_destroy_pipeline_layout>();
+
+		register_callback<reshade::addon_event::copy_descriptor_tables, on_copy_descriptor_tables>();
+		register_callback<reshade::addon_event::update_descriptor_tables, on_update_descriptor_tables>();
+
+		register_callback<reshade::addon_event::map_buffer_region, on_map_buffer_region>();
+		register_callback<reshade::addon_event::unmap_buffer_region, on_unmap_buffer_region>();
+		register_callback<reshade::addon_event::map_texture_region, on_map_texture_region>();
+		register_callback<reshade::addon_event::unmap_texture_region, on_unmap_texture_region>();
+		register_callback<reshade::addon_event::update_buffer_region, on_update_buffer_region>();
+		register_callback<reshade::addon_event::update_texture_region, on_update_texture_region>();
+
+		register_callback<reshade::addon_event::barrier, on_barrier>();
+		register_callback<reshade::addon_event::begin_render_pass, on_begin_render_pass>();
+		register_callback<reshade::addon_event::end_render_pass, on_end_render_pass>();
+		register_callback<reshade::addon_event::bind_render_targets_and_depth_stencil, on_bind_render_targets_and_depth_stencil>();
+		register_callback<reshade::addon_event::bind_pipeline, on_bind_pipeline>();
+		register_callback<reshade::addon_event::bind_pipeline_states, on_bind_pipeline_states>();
+		register_callback<reshade::addon_event::bind_viewports, on_bind_viewports>();
+		register_callback<reshade::addon_event::bind_scissor_rects, on_bind_scissor_rects>();
+		register_callback<reshade::addon_event::push_constants, on_push_constants>();
+		register_callback<reshade::addon_event::push_descriptors, on_push_descriptors>();
+		register_callback<reshade::addon_event::bind_descriptor_tables, on_bind_descriptor_tables>();
+		register_callback<reshade::addon_event::bind_index_buffer, on_bind_index_buffer>();
+		register_callback<reshade::addon_event::bind_vertex_buffers, on_bind_vertex_buffers>();
+		register_callback<reshade::addon_event::bind_stream_output_buffers, on_bind_stream_output_buffers>();
+		register_callback<reshade::addon_event::draw, on_draw>();
+		register_callback<reshade::addon_event::draw_indexed, on_draw_indexed>();
+		register_callback<reshade::addon_event::dispatch, on_dispatch>();
+		register_callback<reshade::addon_event::draw_or_dispatch_indirect, on_draw_or_dispatch_indirect>();
+		register_callback<reshade::addon_event::copy_resource, on_copy_resource>();
+		register_callback<reshade::addon_event::copy_buffer_region, on_copy_buffer_region>();
+		register_callback<reshade::addon_event::copy_buffer_to_texture, on_copy_buffer_to_texture>();
+		register_callback<reshade::addon_event::copy_texture_region, on_copy_texture_region>();
+		register_callback<reshade::addon_event::copy_texture_to_buffer, on_copy_texture_to_buffer>();
+		register_callback<reshade::addon_event::resolve_texture_region, on_resolve_texture_region>();
+		register_callback<reshade::addon_event::clear_depth_stencil_view, on_clear_depth_stencil_view>();
+		register_callback<reshade::addon_event::clear_render_target_view, on_clear_render_target_view>();
+		register_callback<reshade::addon_event::clear_unordered_access_view_uint, on_clear_unordered_access_view_uint>();
+		register_callback<reshade::addon_event::clear_unordered_access_view_float, on_clear_unordered_access_view_float>();
+		register_callback<reshade::addon_event::generate_mipmaps, on_generate_mipmaps>();
+		register_callback<reshade::addon_event::begin_query, on_begin_query>();
+		register_callback<reshade::addon_event::end_query, on_end_query>();
+		register_callback<reshade::addon_event::copy_query_heap_results, on_copy_query_heap_results>();
+
+		register_callback<reshade::addon_event::reset_command_list, on_reset_command_list>();
+		register_callback<reshade::addon_event::execute_command_list, on_execute_command_list>();
+		register_callback<reshade::addon_event::execute_secondary_command_list, on_execute_secondary_command_list>();
+
+		register_callback<reshade::addon_event::present, on_present>();
+		register_callback<reshade::addon_event::reshade_present, on_reshade_present>();
 		break;
 	case DLL_PROCESS_DETACH:
 		reshade::unregister_addon(hModule);
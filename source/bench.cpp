@@ -0,0 +1,561 @@
+/*
+ * Copyright (C) 2024 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "null_device.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cinttypes>
+
+using namespace reshade::api;
+
+extern bool play_frame(trace_data_read &trace_data, command_list *cmd_list, command_queue *queue, effect_runtime *runtime, void(*callback)(reshade::addon_event ev, uint64_t offset, void *user_data), void *user_data);
+
+struct timing_stats
+{
+	double min = 0.0;
+	double avg = 0.0;
+	double p99 = 0.0;
+};
+
+struct screenshot_result
+{
+	uint64_t frame;
+	bool match;
+	uint32_t max_difference;
+	uint64_t different_bytes;
+};
+
+struct trace_result
+{
+	std::string name;
+	uint64_t bytes = 0;
+	uint64_t frames = 0;
+	double decode_mib_per_s = 0.0;
+	double write_mib_per_s = 0.0;
+	double write_compressed_mib_per_s = 0.0;
+	// Only filled in if the trace was replayed on a device by the playback application
+	bool replayed = false;
+	uint64_t replayed_frames = 0;
+	timing_stats cpu_ms;
+	timing_stats gpu_ms;
+	timing_stats frame_ms;
+	std::vector<screenshot_result> screenshots;
+	bool failed = false;
+};
+
+static double elapsed_ms(const LARGE_INTEGER &start)
+{
+	LARGE_INTEGER end = {}, frequency = {};
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	return (end.QuadPart - start.QuadPart) * 1000.0 / static_cast<double>(frequency.QuadPart);
+}
+
+static double mib_per_s(uint64_t bytes, double ms)
+{
+	return ms > 0.0 ? (bytes / (1024.0 * 1024.0)) / (ms / 1000.0) : 0.0;
+}
+
+static timing_stats compute_statistics(std::vector<double> values)
+{
+	timing_stats stats;
+	if (values.empty())
+		return stats;
+
+	std::sort(values.begin(), values.end());
+
+	for (const double value : values)
+		stats.avg += value;
+	stats.avg /= values.size();
+
+	stats.min = values.front();
+	stats.p99 = values[std::min(values.size() - 1, (values.size() * 99 + 99) / 100 - 1)];
+	return stats;
+}
+
+static void on_event(reshade::addon_event, uint64_t offset, void *user_data)
+{
+	static_cast<std::vector<uint64_t> *>(user_data)->push_back(offset);
+}
+
+// Decodes all frames on a device that does nothing, which measures how fast playback gets through the trace on its own
+static bool measure_decode(const char *path, trace_result &result)
+{
+	trace_data_read trace_data(path);
+	if (!trace_data.is_open())
+		return false;
+
+	const auto graphics_api = trace_data.read<device_api>();
+
+	trace_index index;
+	trace_data.read_index(index);
+
+	null_device device(graphics_api);
+	null_command_list cmd_list(&device);
+	null_command_queue queue(&device, &cmd_list);
+
+	const uint64_t begin_offset = trace_data.tell();
+
+	LARGE_INTEGER start = {};
+	QueryPerformanceCounter(&start);
+
+	while (play_frame(trace_data, &cmd_list, &queue, nullptr, nullptr, nullptr))
+		result.frames++;
+
+	const double ms = elapsed_ms(start);
+
+	result.bytes = trace_data.tell() - begin_offset;
+	result.decode_mib_per_s = mib_per_s(result.bytes, ms);
+	return true;
+}
+
+// Writes the events of the trace through the same writer the add-on uses, one event at a time like during capture, which measures the throughput of buffering, compressing and writing blocks
+// The events are copied as they are stored, so this does not include encoding them in the first place, in particular hashing blobs to find duplicates and writing command events as varints
+// Events are found by decoding each frame first, which is not part of the measured time
+static bool measure_write(const char *path, bool compress, double &result)
+{
+	trace_data_read trace_data(path);
+	trace_data_read raw_data(path);
+	if (!trace_data.is_open() || !raw_data.is_open())
+		return false;
+
+	const auto graphics_api = trace_data.read<device_api>();
+
+	trace_index index;
+	trace_data.read_index(index);
+
+	null_device device(graphics_api);
+	null_command_list cmd_list(&device);
+	null_command_queue queue(&device, &cmd_list);
+
+	char output_path[MAX_PATH] = "";
+	GetTempPathA(MAX_PATH, output_path);
+	strcat_s(output_path, "api_bench_write.bin");
+
+	auto output = std::make_unique<trace_data_write>(output_path, compress);
+	if (!output->is_open())
+		return false;
+
+	uint64_t bytes = 0;
+	double ms = 0.0;
+	std::vector<uint64_t> event_offsets;
+	std::vector<uint8_t> frame_data;
+
+	for (bool present = true; present;)
+	{
+		const uint64_t frame_begin = trace_data.tell();
+
+		event_offsets.clear();
+		present = play_frame(trace_data, &cmd_list, &queue, nullptr, on_event, &event_offsets);
+
+		const uint64_t frame_end = trace_data.tell();
+		if (event_offsets.empty() || event_offsets.front() != frame_begin)
+			event_offsets.insert(event_offsets.begin(), frame_begin);
+		event_offsets.push_back(frame_end);
+
+		frame_data.resize(static_cast<size_t>(frame_end - frame_begin));
+		raw_data.seek(frame_begin);
+		raw_data.read(frame_data.data(), frame_data.size());
+
+		LARGE_INTEGER start = {};
+		QueryPerformanceCounter(&start);
+
+		for (size_t i = 0; i + 1 < event_offsets.size(); ++i)
+			output->write(frame_data.data() + (event_offsets[i] - frame_begin), static_cast<size_t>(event_offsets[i + 1] - event_offsets[i]));
+
+		ms += elapsed_ms(start);
+		bytes += frame_end - frame_begin;
+	}
+
+	// Closing the file waits for all blocks to be compressed and written, which is part of the cost too
+	LARGE_INTEGER start = {};
+	QueryPerformanceCounter(&start);
+	output.reset();
+	ms += elapsed_ms(start);
+
+	DeleteFileA(output_path);
+
+	result = mib_per_s(bytes, ms);
+	return true;
+}
+
+static bool run_playback(const std::string &playback_path, const std::string &arguments)
+{
+	std::string command_line = '\"' + playback_path + "\" " + arguments;
+
+	STARTUPINFOA startup_info = { sizeof(startup_info) };
+	PROCESS_INFORMATION process_info = {};
+	if (!CreateProcessA(nullptr, command_line.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup_info, &process_info))
+		return false;
+
+	WaitForSingleObject(process_info.hProcess, INFINITE);
+
+	DWORD exit_code = 1;
+	GetExitCodeProcess(process_info.hProcess, &exit_code);
+
+	CloseHandle(process_info.hThread);
+	CloseHandle(process_info.hProcess);
+
+	return exit_code == EXIT_SUCCESS;
+}
+
+// Replays the trace in benchmark mode of the playback application and reads back the frame times it wrote
+static bool measure_replay(const std::string &playback_path, const std::string &trace_path, uint32_t loops, trace_result &result)
+{
+	char csv_path[MAX_PATH] = "";
+	GetTempPathA(MAX_PATH, csv_path);
+	strcat_s(csv_path, "api_bench_frames.csv");
+
+	if (!run_playback(playback_path, "--benchmark --loops " + std::to_string(loops) + " --csv \"" + csv_path + "\" \"" + trace_path + '\"'))
+		return false;
+
+	FILE *file = nullptr;
+	if (fopen_s(&file, csv_path, "r") != 0 || file == nullptr)
+		return false;
+
+	std::vector<double> values[3];
+
+	char line[256];
+	// Skip the header
+	fgets(line, sizeof(line), file);
+	while (fgets(line, sizeof(line), file) != nullptr)
+	{
+		unsigned int loop = 0;
+		unsigned long long frame = 0;
+		double cpu_ms = 0.0, gpu_ms = 0.0, frame_ms = 0.0;
+		if (sscanf_s(line, "%u,%llu,%lf,%lf,%lf", &loop, &frame, &cpu_ms, &gpu_ms, &frame_ms) != 5)
+			continue;
+
+		values[0].push_back(cpu_ms);
+		values[1].push_back(gpu_ms);
+		values[2].push_back(frame_ms);
+	}
+
+	fclose(file);
+	DeleteFileA(csv_path);
+
+	result.replayed = true;
+	result.replayed_frames = values[0].size();
+	result.cpu_ms = compute_statistics(values[0]);
+	result.gpu_ms = compute_statistics(values[1]);
+	result.frame_ms = compute_statistics(values[2]);
+	return true;
+}
+
+static bool read_file(const std::string &path, std::vector<uint8_t> &data)
+{
+	FILE *file = nullptr;
+	if (fopen_s(&file, path.c_str(), "rb") != 0 || file == nullptr)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	data.resize(static_cast<size_t>(ftell(file)));
+	fseek(file, 0, SEEK_SET);
+	const bool success = fread(data.data(), 1, data.size(), file) == data.size();
+
+	fclose(file);
+	return success;
+}
+
+// Screenshots start with their width, height and format, which have to match exactly, the pixels may differ by up to the tolerance per byte
+static screenshot_result compare_screenshot(uint64_t frame, const std::string &path, const std::string &golden_path, uint32_t tolerance)
+{
+	constexpr size_t header_size = 3 * sizeof(uint32_t);
+
+	screenshot_result result = { frame, false, 0, 0 };
+
+	std::vector<uint8_t> data, golden_data;
+	if (!read_file(path, data) || !read_file(golden_path, golden_data) || data.size() != golden_data.size() || data.size() < header_size || std::memcmp(data.data(), golden_data.data(), header_size) != 0)
+	{
+		result.max_difference = UINT8_MAX;
+		return result;
+	}
+
+	for (size_t i = header_size; i < data.size(); ++i)
+	{
+		const uint32_t difference = static_cast<uint32_t>(std::abs(static_cast<int>(data[i]) - static_cast<int>(golden_data[i])));
+		if (difference != 0)
+		{
+			result.different_bytes++;
+			result.max_difference = std::max(result.max_difference, difference);
+		}
+	}
+
+	result.match = result.max_difference <= tolerance;
+	return result;
+}
+
+// Frames to compare are the ones there are golden screenshots for, which are stored as 'golden\<trace name>\frameN.raw' next to the traces
+static std::vector<uint64_t> find_golden_frames(const std::string &golden_dir)
+{
+	std::vector<uint64_t> frames;
+
+	WIN32_FIND_DATAA find_data;
+	const HANDLE find_handle = FindFirstFileA((golden_dir + "\\frame*.raw").c_str(), &find_data);
+	if (find_handle == INVALID_HANDLE_VALUE)
+		return frames;
+
+	do
+		frames.push_back(_strtoui64(find_data.cFileName + 5, nullptr, 10));
+	while (FindNextFileA(find_handle, &find_data));
+
+	FindClose(find_handle);
+
+	std::sort(frames.begin(), frames.end());
+	return frames;
+}
+
+static std::string screenshot_arguments(const std::vector<uint64_t> &frames, const std::string &dir, const std::string &trace_path)
+{
+	char csv_path[MAX_PATH] = "";
+	GetTempPathA(MAX_PATH, csv_path);
+	strcat_s(csv_path, "api_bench_screenshots.csv");
+
+	std::string arguments = "--benchmark --loops 1 --csv \"" + std::string(csv_path) + "\" --screenshot-dir \"" + dir + '\"';
+	for (const uint64_t frame : frames)
+		arguments += " --screenshot " + std::to_string(frame);
+	arguments += " \"" + trace_path + '\"';
+	return arguments;
+}
+
+// Screenshots are taken in a separate run, since reading them back stalls the GPU and would skew the measured frame times
+static bool compare_screenshots(const std::string &playback_path, const std::string &trace_path, const std::string &golden_dir, uint32_t tolerance, trace_result &result)
+{
+	const std::vector<uint64_t> frames = find_golden_frames(golden_dir);
+	if (frames.empty())
+		return true;
+
+	char screenshot_dir[MAX_PATH] = "";
+	GetTempPathA(MAX_PATH, screenshot_dir);
+	strcat_s(screenshot_dir, "api_bench_screenshots");
+	CreateDirectoryA(screenshot_dir, nullptr);
+
+	const bool success = run_playback(playback_path, screenshot_arguments(frames, screenshot_dir, trace_path));
+
+	for (const uint64_t frame : frames)
+	{
+		const std::string file_name = "\\frame" + std::to_string(frame) + ".raw";
+		result.screenshots.push_back(compare_screenshot(frame, screenshot_dir + file_name, golden_dir + file_name, tolerance));
+		DeleteFileA((screenshot_dir + file_name).c_str());
+	}
+
+	RemoveDirectoryA(screenshot_dir);
+	return success;
+}
+
+static std::string json_string(const std::string &value)
+{
+	std::string result = "\"";
+	for (const char c : value)
+	{
+		if (c == '\"' || c == '\\')
+			result += '\\';
+		result += c;
+	}
+	return result + '\"';
+}
+
+static void write_timing_stats(FILE *file, const char *name, const timing_stats &stats)
+{
+	fprintf(file, ",\"%s\":{\"min\":%.4f,\"avg\":%.4f,\"p99\":%.4f}", name, stats.min, stats.avg, stats.p99);
+}
+
+static bool write_results(const std::vector<trace_result> &results, const char *json_path)
+{
+	FILE *file = nullptr;
+	if (fopen_s(&file, json_path, "w") != 0 || file == nullptr)
+		return false;
+
+	fprintf(file, "{\"version\":%u,\"traces\":[", trace_version);
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const trace_result &result = results[i];
+
+		if (i != 0)
+			fputs(",", file);
+		fprintf(file, "\n{\"name\":%s,\"failed\":%s,\"bytes\":%" PRIu64 ",\"frames\":%" PRIu64 ",\"decode_mib_per_s\":%.2f,\"write_mib_per_s\":%.2f,\"write_compressed_mib_per_s\":%.2f",
+			json_string(result.name).c_str(), result.failed ? "true" : "false", result.bytes, result.frames, result.decode_mib_per_s, result.write_mib_per_s, result.write_compressed_mib_per_s);
+
+		if (result.replayed)
+		{
+			fprintf(file, ",\"replay\":{\"frames\":%" PRIu64, result.replayed_frames);
+			write_timing_stats(file, "cpu_ms", result.cpu_ms);
+			write_timing_stats(file, "gpu_ms", result.gpu_ms);
+			write_timing_stats(file, "frame_ms", result.frame_ms);
+			fputs("}", file);
+		}
+
+		fputs(",\"screenshots\":[", file);
+		for (size_t k = 0; k < result.screenshots.size(); ++k)
+		{
+			const screenshot_result &screenshot = result.screenshots[k];
+			fprintf(file, "%s{\"frame\":%" PRIu64 ",\"match\":%s,\"max_difference\":%u,\"different_bytes\":%" PRIu64 "}", k != 0 ? "," : "", screenshot.frame, screenshot.match ? "true" : "false", screenshot.max_difference, screenshot.different_bytes);
+		}
+		fputs("]}", file);
+	}
+	fputs("\n]}\n", file);
+
+	fclose(file);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *trace_dir = ".";
+	const char *json_path = "bench.json";
+	std::string playback_path;
+	uint32_t loops = 3;
+	uint32_t tolerance = 0;
+	bool replay = true;
+	bool update_goldens = false;
+	std::vector<uint64_t> golden_frames;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			json_path = argv[++i];
+		else if (strcmp(argv[i], "--playback") == 0 && i + 1 < argc)
+			playback_path = argv[++i];
+		else if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc)
+			loops = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+			tolerance = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--no-replay") == 0)
+			replay = false;
+		else if (strcmp(argv[i], "--update-goldens") == 0)
+			update_goldens = true;
+		else if (strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc)
+			golden_frames.push_back(_strtoui64(argv[++i], nullptr, 10));
+		else
+			trace_dir = argv[i];
+	}
+
+	// The playback application is built to the same directory by default
+	if (playback_path.empty())
+	{
+		char module_path[MAX_PATH] = "";
+		GetModuleFileNameA(nullptr, module_path, MAX_PATH);
+		playback_path = module_path;
+		playback_path.erase(playback_path.find_last_of('\\') + 1);
+		playback_path += "api_playback.exe";
+	}
+	if (replay && GetFileAttributesA(playback_path.c_str()) == INVALID_FILE_ATTRIBUTES)
+	{
+		fprintf(stderr, "Playback application '%s' not found, only measuring decode and write throughput.\n", playback_path.c_str());
+		replay = false;
+	}
+	if (update_goldens && !replay)
+	{
+		fprintf(stderr, "Golden screenshots can only be taken with the playback application.\n");
+		return 1;
+	}
+
+	std::vector<std::string> trace_names;
+	{
+		WIN32_FIND_DATAA find_data;
+		const HANDLE find_handle = FindFirstFileA((std::string(trace_dir) + "\\*.bin").c_str(), &find_data);
+		if (find_handle != INVALID_HANDLE_VALUE)
+		{
+			do
+				trace_names.push_back(find_data.cFileName);
+			while (FindNextFileA(find_handle, &find_data));
+
+			FindClose(find_handle);
+		}
+	}
+	std::sort(trace_names.begin(), trace_names.end());
+
+	if (trace_names.empty())
+	{
+		fprintf(stderr, "No trace files found in '%s'.\n", trace_dir);
+		return 2;
+	}
+
+	bool success = true;
+	std::vector<trace_result> results;
+
+	for (const std::string &trace_name : trace_names)
+	{
+		const std::string trace_path = std::string(trace_dir) + '\\' + trace_name;
+		const std::string golden_dir = std::string(trace_dir) + "\\golden\\" + trace_name.substr(0, trace_name.size() - 4);
+
+		trace_result &result = results.emplace_back();
+		result.name = trace_name;
+
+		printf("%s\n", trace_name.c_str());
+
+		if (!measure_decode(trace_path.c_str(), result) ||
+			!measure_write(trace_path.c_str(), false, result.write_mib_per_s) ||
+			!measure_write(trace_path.c_str(), true, result.write_compressed_mib_per_s))
+		{
+			fprintf(stderr, "Failed to read trace file '%s'.\n", trace_path.c_str());
+			result.failed = true;
+			success = false;
+			continue;
+		}
+
+		printf("  %" PRIu64 " frames, %.2f MiB, decode %.1f MiB/s, write %.1f MiB/s (compressed %.1f MiB/s)\n", result.frames, result.bytes / (1024.0 * 1024.0), result.decode_mib_per_s, result.write_mib_per_s, result.write_compressed_mib_per_s);
+
+		if (!replay)
+			continue;
+
+		if (update_goldens)
+		{
+			// Without any frames specified, the existing golden screenshots of the trace are taken again
+			const std::vector<uint64_t> frames = !golden_frames.empty() ? golden_frames : find_golden_frames(golden_dir);
+			if (frames.empty())
+			{
+				fprintf(stderr, "No frames to take golden screenshots of for '%s', pass them with --screenshot N.\n", trace_path.c_str());
+				result.failed = true;
+				success = false;
+				continue;
+			}
+
+			CreateDirectoryA((std::string(trace_dir) + "\\golden").c_str(), nullptr);
+			CreateDirectoryA(golden_dir.c_str(), nullptr);
+
+			if (!run_playback(playback_path, screenshot_arguments(frames, golden_dir, trace_path)))
+			{
+				fprintf(stderr, "Failed to take golden screenshots of '%s'.\n", trace_path.c_str());
+				result.failed = true;
+				success = false;
+			}
+			continue;
+		}
+
+		if (!measure_replay(playback_path, trace_path, loops, result))
+		{
+			fprintf(stderr, "Failed to replay trace file '%s'.\n", trace_path.c_str());
+			result.failed = true;
+			success = false;
+			continue;
+		}
+
+		printf("  frame time min %.3f ms, avg %.3f ms, p99 %.3f ms (GPU avg %.3f ms)\n", result.frame_ms.min, result.frame_ms.avg, result.frame_ms.p99, result.gpu_ms.avg);
+
+		if (!compare_screenshots(playback_path, trace_path, golden_dir, tolerance, result))
+		{
+			result.failed = true;
+			success = false;
+		}
+
+		for (const screenshot_result &screenshot : result.screenshots)
+		{
+			printf("  frame %" PRIu64 " %s (%" PRIu64 " bytes differ, by up to %u)\n", screenshot.frame, screenshot.match ? "matches" : "DIFFERS", screenshot.different_bytes, screenshot.max_difference);
+			success &= screenshot.match;
+		}
+	}
+
+	if (!write_results(results, json_path))
+	{
+		fprintf(stderr, "Failed to write '%s'.\n", json_path);
+		return 1;
+	}
+
+	return success ? 0 : 1;
+}
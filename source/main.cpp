@@ -6,8 +6,410 @@
 #include "main.hpp"
 #include "reshade.hpp"
 #include "trace_data.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
 
 extern bool play_frame(trace_data_read &trace_data, reshade::api::command_list *cmd_list, reshade::api::effect_runtime *runtime);
+extern bool play_frame(trace_data_read &trace_data, reshade::api::command_list *cmd_list, reshade::api::command_queue *queue, reshade::api::effect_runtime *runtime, void(*callback)(reshade::addon_event ev, uint64_t offset, void *user_data), void *user_data);
+extern bool seek_frame(trace_data_read &trace_data, const trace_index &index, uint64_t frame, reshade::api::command_list *cmd_list, reshade::api::effect_runtime *runtime);
+extern void enable_prefetch(const char *path, const trace_index &index, reshade::api::device *device);
+extern void disable_prefetch();
+extern void warm_up_pipelines(const char *path, const trace_index &index, reshade::api::device *device);
+extern void release_pipeline_cache();
+extern void enable_resource_pool(reshade::api::device *device);
+extern void release_resource_pool();
+
+struct frame_timing
+{
+	uint32_t loop;
+	uint64_t frame;
+	double cpu_ms;
+	double gpu_ms;
+	double frame_ms;
+};
+
+static void compute_statistics(std::vector<double> values, double &min, double &avg, double &p99)
+{
+	min = avg = p99 = 0.0;
+	if (values.empty())
+		return;
+
+	std::sort(values.begin(), values.end());
+
+	for (const double value : values)
+		avg += value;
+	avg /= values.size();
+
+	min = values.front();
+	p99 = values[std::min(values.size() - 1, (values.size() * 99 + 99) / 100 - 1)];
+}
+
+static bool write_benchmark_results(const std::vector<frame_timing> &timings, const char *csv_path)
+{
+	std::vector<double> values[3];
+	for (const frame_timing &timing : timings)
+	{
+		values[0].push_back(timing.cpu_ms);
+		values[1].push_back(timing.gpu_ms);
+		values[2].push_back(timing.frame_ms);
+	}
+
+	// Print summary to the console the application was started from (if any)
+	if (AttachConsole(ATTACH_PARENT_PROCESS))
+	{
+		FILE *console = nullptr;
+		if (fopen_s(&console, "CONOUT$", "w") == 0)
+		{
+			fprintf(console, "\n%llu frames\n", static_cast<unsigned long long>(timings.size()));
+
+			const char *const names[3] = { "CPU submit", "GPU", "Frame" };
+			for (int i = 0; i < 3; ++i)
+			{
+				double min, avg, p99;
+				compute_statistics(values[i], min, avg, p99);
+				fprintf(console, "%-10s min %8.3f ms  avg %8.3f ms  p99 %8.3f ms\n", names[i], min, avg, p99);
+			}
+
+			fclose(console);
+		}
+	}
+
+	FILE *file = nullptr;
+	if (fopen_s(&file, csv_path, "w") != 0)
+		return false;
+
+	fprintf(file, "loop,frame,cpu_ms,gpu_ms,frame_ms\n");
+	for (const frame_timing &timing : timings)
+		fprintf(file, "%u,%llu,%.4f,%.4f,%.4f\n", timing.loop, static_cast<unsigned long long>(timing.frame), timing.cpu_ms, timing.gpu_ms, timing.frame_ms);
+
+	fclose(file);
+	return true;
+}
+
+// Reads back the back buffer and writes its width, height and format followed by its tightly packed rows to a file, so that playback results can be compared against reference images
+// Waits for the GPU to finish, so frame times of frames with a screenshot are not representative
+static bool write_screenshot(reshade::api::command_queue *queue, reshade::api::resource back_buffer, const char *path)
+{
+	reshade::api::device *const device = queue->get_device();
+	reshade::api::command_list *const cmd_list = queue->get_immediate_command_list();
+
+	const reshade::api::resource_desc desc = device->get_resource_desc(back_buffer);
+	const uint32_t width = desc.texture.width;
+	const uint32_t height = desc.texture.height;
+	const uint32_t row_size = reshade::api::format_row_pitch(desc.texture.format, width);
+	if (desc.texture.samples > 1 || row_size == 0)
+		return false;
+
+	std::vector<uint8_t> pixels(static_cast<size_t>(row_size) * height);
+
+	// Copies from textures to buffers are not available in D3D9 and D3D11, where the back buffer is copied to a texture that can be mapped instead
+	if (device->check_capability(reshade::api::device_caps::copy_buffer_to_texture))
+	{
+		// D3D12 requires rows in buffers to be aligned to 256 bytes
+		const uint32_t row_pitch = (row_size + 255) & ~255u;
+
+		reshade::api::resource readback = {};
+		if (!device->create_resource(reshade::api::resource_desc(static_cast<uint64_t>(row_pitch) * height, reshade::api::memory_heap::gpu_to_cpu, reshade::api::resource_usage::copy_dest), nullptr, reshade::api::resource_usage::copy_dest, &readback))
+			return false;
+
+		cmd_list->barrier(back_buffer, reshade::api::resource_usage::render_target, reshade::api::resource_usage::copy_source);
+		cmd_list->copy_texture_to_buffer(back_buffer, 0, nullptr, readback, 0, static_cast<uint32_t>(static_cast<uint64_t>(row_pitch) * width / row_size), height);
+		cmd_list->barrier(back_buffer, reshade::api::resource_usage::copy_source, reshade::api::resource_usage::render_target);
+		queue->flush_immediate_command_list();
+		queue->wait_idle();
+
+		void *mapped_data = nullptr;
+		const bool mapped = device->map_buffer_region(readback, 0, UINT64_MAX, reshade::api::map_access::read_only, &mapped_data);
+		if (mapped)
+		{
+			for (uint32_t y = 0; y < height; ++y)
+				std::memcpy(pixels.data() + static_cast<size_t>(y) * row_size, static_cast<const uint8_t *>(mapped_data) + static_cast<size_t>(y) * row_pitch, row_size);
+			device->unmap_buffer_region(readback);
+		}
+
+		device->destroy_resource(readback);
+
+		if (!mapped)
+			return false;
+	}
+	else
+	{
+		reshade::api::resource readback = {};
+		if (!device->create_resource(reshade::api::resource_desc(width, height, 1, 1, desc.texture.format, 1, reshade::api::memory_heap::gpu_to_cpu, reshade::api::resource_usage::copy_dest), nullptr, reshade::api::resource_usage::copy_dest, &readback))
+			return false;
+
+		cmd_list->barrier(back_buffer, reshade::api::resource_usage::render_target, reshade::api::resource_usage::copy_source);
+		cmd_list->copy_resource(back_buffer, readback);
+		cmd_list->barrier(back_buffer, reshade::api::resource_usage::copy_source, reshade::api::resource_usage::render_target);
+		queue->flush_immediate_command_list();
+		queue->wait_idle();
+
+		reshade::api::subresource_data mapped_data = {};
+		const bool mapped = device->map_texture_region(readback, 0, nullptr, reshade::api::map_access::read_only, &mapped_data);
+		if (mapped)
+		{
+			for (uint32_t y = 0; y < height; ++y)
+				std::memcpy(pixels.data() + static_cast<size_t>(y) * row_size, static_cast<const uint8_t *>(mapped_data.data) + static_cast<size_t>(y) * mapped_data.row_pitch, row_size);
+			device->unmap_texture_region(readback, 0);
+		}
+
+		device->destroy_resource(readback);
+
+		if (!mapped)
+			return false;
+	}
+
+	FILE *file = nullptr;
+	if (fopen_s(&file, path, "wb") != 0 || file == nullptr)
+		return false;
+
+	const uint32_t header[3] = { width, height, static_cast<uint32_t>(desc.texture.format) };
+	fwrite(header, sizeof(header), 1, file);
+	fwrite(pixels.data(), 1, pixels.size(), file);
+
+	fclose(file);
+	return true;
+}
+
+// Records timestamps around render passes, draws and dispatches during playback, to find out which parts of a frame take the most GPU time
+// Results of a frame are only read back when its queries are reused a few frames later, so that this does not stall the GPU
+class gpu_profiler
+{
+public:
+	static constexpr uint32_t max_frames_in_flight = 4;
+	static constexpr uint32_t max_queries_per_frame = 8192;
+
+	~gpu_profiler()
+	{
+		if (_query_heap != 0)
+			_device->destroy_query_heap(_query_heap);
+	}
+
+	bool init(reshade::api::device *device, reshade::api::command_queue *queue)
+	{
+		_device = device;
+		_queue = queue;
+
+		if (queue->get_timestamp_frequency() == 0)
+			return false;
+		_timestamp_period_us = 1000000.0 / static_cast<double>(queue->get_timestamp_frequency());
+
+		return device->create_query_heap(reshade::api::query_type::timestamp, max_frames_in_flight * max_queries_per_frame, &_query_heap);
+	}
+
+	void begin_frame(uint64_t frame, reshade::api::command_list *cmd_list)
+	{
+		frame_queries &queries = _frames[_frame_count++ % max_frames_in_flight];
+		// Queries of this frame are reused, so collect the results of the frame that used them before
+		if (queries.used)
+			read_results(queries);
+
+		queries.used = true;
+		queries.frame = frame;
+		queries.query_count = 0;
+		queries.scopes.clear();
+
+		_current = &queries;
+		_cmd_list = cmd_list;
+		_event_index = 0;
+		_pending_scopes.clear();
+		_open_passes.clear();
+
+		write_timestamp();
+	}
+	void end_frame()
+	{
+		// The last timestamp ends the frame, as well as the last draw or render pass
+		end_pending_scopes(write_timestamp());
+		_current = nullptr;
+	}
+
+	void read_all_results()
+	{
+		_queue->wait_idle();
+
+		for (uint32_t i = 0; i < max_frames_in_flight; ++i)
+		{
+			frame_queries &queries = _frames[(_frame_count + i) % max_frames_in_flight];
+			if (queries.used)
+				read_results(queries);
+			queries.used = false;
+		}
+	}
+
+	// Writes the results in the Chrome trace event format, which can be viewed in chrome://tracing or Perfetto
+	bool write_json(const char *path) const
+	{
+		FILE *file = nullptr;
+		if (fopen_s(&file, path, "w") != 0)
+			return false;
+
+		fprintf(file, "{\"traceEvents\":[\n");
+		for (size_t i = 0; i < _results.size(); ++i)
+		{
+			const result &result = _results[i];
+
+			if (result.event_index == UINT64_MAX)
+				fprintf(file, "{\"name\":\"frame %llu\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu}}", static_cast<unsigned long long>(result.frame), result.begin_us, result.duration_us, static_cast<unsigned long long>(result.frame));
+			else
+				fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu,\"event\":%llu,\"offset\":%llu}}", event_name(result.ev), result.begin_us, result.duration_us, static_cast<unsigned long long>(result.frame), static_cast<unsigned long long>(result.event_index), static_cast<unsigned long long>(result.offset));
+
+			fprintf(file, i + 1 < _results.size() ? ",\n" : "\n");
+		}
+		fprintf(file, "],\"displayTimeUnit\":\"ns\"}\n");
+
+		fclose(file);
+		return true;
+	}
+
+	// Called by the playback code before each event of a frame
+	static void on_event(reshade::addon_event ev, uint64_t offset, void *user_data)
+	{
+		gpu_profiler &profiler = *static_cast<gpu_profiler *>(user_data);
+
+		const uint64_t event_index = profiler._event_index++;
+
+		const bool draw_or_dispatch = ev == reshade::addon_event::draw || ev == reshade::addon_event::draw_indexed || ev == reshade::addon_event::dispatch || ev == reshade::addon_event::draw_or_dispatch_indirect;
+		if (draw_or_dispatch || ev == reshade::addon_event::begin_render_pass || !profiler._pending_scopes.empty())
+		{
+			// A single timestamp both ends the previous draw and begins the next one when they directly follow each other
+			const uint32_t query = profiler.write_timestamp();
+			profiler.end_pending_scopes(query);
+
+			if (draw_or_dispatch || ev == reshade::addon_event::begin_render_pass)
+			{
+				if (draw_or_dispatch)
+					profiler._pending_scopes.push_back(profiler._current->scopes.size());
+				else
+					profiler._open_passes.push_back(profiler._current->scopes.size());
+
+				profiler._current->scopes.push_back({ ev, event_index, offset, query, UINT32_MAX });
+			}
+		}
+
+		// The render pass ends after this event, so its end timestamp is written before the next one
+		if (ev == reshade::addon_event::end_render_pass && !profiler._open_passes.empty())
+		{
+			profiler._pending_scopes.push_back(profiler._open_passes.back());
+			profiler._open_passes.pop_back();
+		}
+	}
+
+private:
+	struct scope
+	{
+		reshade::addon_event ev;
+		uint64_t event_index;
+		uint64_t offset;
+		uint32_t begin_query;
+		uint32_t end_query;
+	};
+	struct frame_queries
+	{
+		bool used = false;
+		uint64_t frame = 0;
+		uint32_t query_count = 0;
+		std::vector<scope> scopes;
+	};
+	struct result
+	{
+		reshade::addon_event ev;
+		uint64_t frame;
+		uint64_t event_index;
+		uint64_t offset;
+		double begin_us;
+		double duration_us;
+	};
+
+	static const char *event_name(reshade::addon_event ev)
+	{
+		switch (ev)
+		{
+		case reshade::addon_event::begin_render_pass:
+			return "render_pass";
+		case reshade::addon_event::draw:
+			return "draw";
+		case reshade::addon_event::draw_indexed:
+			return "draw_indexed";
+		case reshade::addon_event::dispatch:
+			return "dispatch";
+		case reshade::addon_event::draw_or_dispatch_indirect:
+			return "draw_or_dispatch_indirect";
+		default:
+			return "unknown";
+		}
+	}
+
+	// Returns UINT32_MAX once all queries of the frame are used up, scopes that would need more are dropped
+	uint32_t write_timestamp()
+	{
+		if (_current->query_count == max_queries_per_frame)
+			return UINT32_MAX;
+
+		const uint32_t slot = static_cast<uint32_t>(_current - _frames);
+		const uint32_t query = slot * max_queries_per_frame + _current->query_count++;
+		_cmd_list->end_query(_query_heap, reshade::api::query_type::timestamp, query);
+		return query;
+	}
+
+	void end_pending_scopes(uint32_t query)
+	{
+		for (const size_t scope_index : _pending_scopes)
+			_current->scopes[scope_index].end_query = query;
+		_pending_scopes.clear();
+	}
+
+	void read_results(const frame_queries &queries)
+	{
+		if (queries.query_count < 2)
+			return;
+
+		const uint32_t first = static_cast<uint32_t>(&queries - _frames) * max_queries_per_frame;
+
+		_timestamps.resize(queries.query_count);
+		if (!_device->get_query_heap_results(_query_heap, first, queries.query_count, _timestamps.data(), sizeof(uint64_t)))
+		{
+			_queue->wait_idle();
+			if (!_device->get_query_heap_results(_query_heap, first, queries.query_count, _timestamps.data(), sizeof(uint64_t)))
+				return;
+		}
+
+		// Timestamps are made relative to the start of the first frame that was recorded
+		if (_results.empty())
+			_base_timestamp = _timestamps[0];
+
+		const auto to_us = [this](uint64_t timestamp) { return static_cast<double>(static_cast<int64_t>(timestamp - _base_timestamp)) * _timestamp_period_us; };
+
+		_results.push_back({ reshade::addon_event::present, queries.frame, UINT64_MAX, 0, to_us(_timestamps[0]), to_us(_timestamps[queries.query_count - 1]) - to_us(_timestamps[0]) });
+
+		for (const scope &scope : queries.scopes)
+		{
+			if (scope.begin_query == UINT32_MAX || scope.end_query == UINT32_MAX)
+				continue;
+
+			const double begin_us = to_us(_timestamps[scope.begin_query - first]);
+			_results.push_back({ scope.ev, queries.frame, scope.event_index, scope.offset, begin_us, to_us(_timestamps[scope.end_query - first]) - begin_us });
+		}
+	}
+
+	reshade::api::device *_device = nullptr;
+	reshade::api::command_queue *_queue = nullptr;
+	reshade::api::query_heap _query_heap = {};
+	double _timestamp_period_us = 0.0;
+
+	frame_queries _frames[max_frames_in_flight];
+	uint64_t _frame_count = 0;
+	frame_queries *_current = nullptr;
+	reshade::api::command_list *_cmd_list = nullptr;
+	uint64_t _event_index = 0;
+	std::vector<size_t> _pending_scopes;
+	std::vector<size_t> _open_passes;
+
+	std::vector<uint64_t> _timestamps;
+	uint64_t _base_timestamp = 0;
+	std::vector<result> _results;
+};
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow)
 {
@@ -46,30 +448,75 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow
 		return 1;
 	ShowWindow(window_handle, nCmdShow);
 
-	trace_data_read trace_data(__argc > 1 ? __argv[1] : "api_trace_log.bin");
+	const char *trace_path = "api_trace_log.bin";
+	uint64_t start_frame = 0;
+	bool benchmark = false;
+	uint64_t benchmark_frames = 0;
+	uint32_t benchmark_loops = 3;
+	const char *benchmark_csv_path = "benchmark.csv";
+	bool profile = false;
+	const char *profile_json_path = "profile.json";
+	std::vector<uint64_t> screenshot_frames;
+	std::string screenshot_dir = ".";
+
+	for (int i = 1; i < __argc; ++i)
+	{
+		if (strcmp(__argv[i], "--frame") == 0 && i + 1 < __argc)
+			start_frame = _strtoui64(__argv[++i], nullptr, 10);
+		else if (strcmp(__argv[i], "--benchmark") == 0)
+			benchmark = true;
+		else if (strcmp(__argv[i], "--frames") == 0 && i + 1 < __argc)
+			benchmark_frames = _strtoui64(__argv[++i], nullptr, 10);
+		else if (strcmp(__argv[i], "--loops") == 0 && i + 1 < __argc)
+			benchmark_loops = strtoul(__argv[++i], nullptr, 10);
+		else if (strcmp(__argv[i], "--csv") == 0 && i + 1 < __argc)
+			benchmark_csv_path = __argv[++i];
+		else if (strcmp(__argv[i], "--profile") == 0)
+			profile = true;
+		else if (strcmp(__argv[i], "--json") == 0 && i + 1 < __argc)
+			profile_json_path = __argv[++i];
+		else if (strcmp(__argv[i], "--screenshot") == 0 && i + 1 < __argc)
+			screenshot_frames.push_back(_strtoui64(__argv[++i], nullptr, 10));
+		else if (strcmp(__argv[i], "--screenshot-dir") == 0 && i + 1 < __argc)
+			screenshot_dir = __argv[++i];
+		else
+			trace_path = __argv[i];
+	}
+
+	trace_data_read trace_data(trace_path);
 	if (!trace_data.is_open())
 		return 2;
 
-	if (constexpr uint64_t MAGIC = (uint64_t('A') << 0) | (uint64_t('P') << 8) | (uint64_t('I') << 16) | (uint64_t('T') << 24) | (uint64_t('R') << 32) | (uint64_t('A') << 40) | (uint64_t('C') << 48) | (uint64_t('E') << 56);
-		MAGIC != trace_data.read<uint64_t>())
+	const auto graphics_api = trace_data.read<reshade::api::device_api>();
+
+	trace_index index;
+	if (!trace_data.read_index(index) && (start_frame != 0 || benchmark))
 		return 2;
 
-	const auto graphics_api = trace_data.read<reshade::api::device_api>();
+	if (benchmark)
+	{
+		// The last frame offset points past the final present, so it does not start a complete frame
+		const uint64_t frame_count = index.frame_offsets.size() - 1;
+		if (start_frame >= frame_count || benchmark_loops == 0)
+			return 2;
+		if (benchmark_frames == 0 || benchmark_frames > frame_count - start_frame)
+			benchmark_frames = frame_count - start_frame;
+	}
 
 	std::unique_ptr<application> app;
 	switch (graphics_api)
 	{
 	case reshade::api::device_api::d3d9:
-		app = create_application_d3d9(window_handle);
+		app = create_application_d3d9(window_handle, !benchmark);
 		break;
 	case reshade::api::device_api::d3d11:
-		app = create_application_d3d11(window_handle);
+		app = create_application_d3d11(window_handle, !benchmark);
 		break;
 	case reshade::api::device_api::d3d12:
-		app = create_application_d3d12(window_handle);
+		app = create_application_d3d12(window_handle, !benchmark);
 		break;
 	case reshade::api::device_api::opengl:
-		app = create_application_opengl(window_handle);
+		app = create_application_opengl(window_handle, !benchmark);
 		break;
 	}
 
@@ -80,8 +527,165 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow
 	if (!create_effect_runtime(graphics_api, app->get_device(), app->get_command_queue(), app->get_swapchain(), ".\\", &runtime))
 		return 1;
 
+	// Repeated benchmark loops should not include pipeline compile times in any of them, so create all pipelines before the first frame
+	if (benchmark)
+		warm_up_pipelines(trace_path, index, runtime->get_device());
+
+	// Transient resources the trace creates and destroys every frame are recycled, so that frame times do not include allocation cost
+	enable_resource_pool(runtime->get_device());
+
+	// Seeking to the first frame also restores resource contents of traces that were captured starting in the middle of a session
+	if ((start_frame != 0 || !index.snapshot_offsets.empty()) && !seek_frame(trace_data, index, start_frame, runtime->get_command_queue()->get_immediate_command_list(), runtime))
+	{
+		release_resource_pool();
+		release_pipeline_cache();
+		return 2;
+	}
+
+	// Objects created during the following frames are looked up in the index, which traces that were not closed properly do not have
+	if (!index.state_offsets.empty())
+		enable_prefetch(trace_path, index, runtime->get_device());
+
 	MSG msg = {};
-	while (true)
+
+	if (benchmark)
+	{
+		reshade::api::device *const device = runtime->get_device();
+		reshade::api::command_queue *const queue = runtime->get_command_queue();
+
+		// Keep a few frames of timestamp queries in flight, so that reading back results does not stall the GPU
+		constexpr uint32_t max_frames_in_flight = 4;
+
+		reshade::api::query_heap query_heap = {};
+		if (!device->create_query_heap(reshade::api::query_type::timestamp, 2 * max_frames_in_flight, &query_heap))
+		{
+			disable_prefetch();
+			release_resource_pool();
+			release_pipeline_cache();
+			return 1;
+		}
+
+		const double timestamp_period_ms = 1000.0 / static_cast<double>(queue->get_timestamp_frequency());
+
+		LARGE_INTEGER cpu_frequency = {};
+		QueryPerformanceFrequency(&cpu_frequency);
+		const double cpu_period_ms = 1000.0 / static_cast<double>(cpu_frequency.QuadPart);
+
+		std::vector<frame_timing> timings;
+		timings.reserve(static_cast<size_t>(benchmark_frames * benchmark_loops));
+
+		const auto read_gpu_time = [&](size_t timing_index) {
+			const uint32_t query_index = 2 * static_cast<uint32_t>(timing_index % max_frames_in_flight);
+
+			uint64_t timestamps[2] = {};
+			if (!device->get_query_heap_results(query_heap, query_index, 2, timestamps, sizeof(uint64_t)))
+			{
+				queue->wait_idle();
+				if (!device->get_query_heap_results(query_heap, query_index, 2, timestamps, sizeof(uint64_t)))
+					return false;
+			}
+
+			timings[timing_index].gpu_ms = (timestamps[1] - timestamps[0]) * timestamp_period_ms;
+			return true;
+		};
+
+		int result = EXIT_SUCCESS;
+
+		LARGE_INTEGER last_frame_end = {};
+		QueryPerformanceCounter(&last_frame_end);
+
+		for (uint32_t loop = 0; loop < benchmark_loops && msg.message != WM_QUIT; ++loop)
+		{
+			// Rewind to the start of the frame range, which recreates all objects alive at that point
+			if (loop != 0 && !seek_frame(trace_data, index, start_frame, queue->get_immediate_command_list(), runtime))
+			{
+				result = 2;
+				break;
+			}
+
+			for (uint64_t frame = 0; frame < benchmark_frames; ++frame)
+			{
+				while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE) && msg.message != WM_QUIT)
+					DispatchMessage(&msg);
+
+				if (msg.message == WM_QUIT)
+					break;
+
+				// Query slot of this frame is reused, so collect the results of the frame that used it before
+				if (timings.size() >= max_frames_in_flight)
+					read_gpu_time(timings.size() - max_frames_in_flight);
+
+				const uint32_t query_index = 2 * static_cast<uint32_t>(timings.size() % max_frames_in_flight);
+
+				LARGE_INTEGER cpu_start = {};
+				QueryPerformanceCounter(&cpu_start);
+
+				reshade::api::command_list *const cmd_list = queue->get_immediate_command_list();
+				cmd_list->end_query(query_heap, reshade::api::query_type::timestamp, query_index);
+				cmd_list->barrier(runtime->get_current_back_buffer(), reshade::api::resource_usage::present, reshade::api::resource_usage::render_target);
+				play_frame(trace_data, cmd_list, runtime);
+
+				// Screenshots are only taken in the first loop, the following ones replay the same frames
+				if (loop == 0 && std::find(screenshot_frames.begin(), screenshot_frames.end(), start_frame + frame) != screenshot_frames.end())
+				{
+					const std::string screenshot_path = screenshot_dir + "\\frame" + std::to_string(start_frame + frame) + ".raw";
+					if (!write_screenshot(queue, runtime->get_current_back_buffer(), screenshot_path.c_str()))
+						result = 1;
+				}
+
+				cmd_list->barrier(runtime->get_current_back_buffer(), reshade::api::resource_usage::render_target, reshade::api::resource_usage::present);
+				cmd_list->end_query(query_heap, reshade::api::query_type::timestamp, query_index + 1);
+
+				LARGE_INTEGER cpu_end = {};
+				QueryPerformanceCounter(&cpu_end);
+
+				update_and_present_effect_runtime(runtime);
+
+				app->present();
+
+				LARGE_INTEGER frame_end = {};
+				QueryPerformanceCounter(&frame_end);
+
+				timings.push_back({ loop, start_frame + frame, (cpu_end.QuadPart - cpu_start.QuadPart) * cpu_period_ms, 0.0, (frame_end.QuadPart - last_frame_end.QuadPart) * cpu_period_ms });
+				last_frame_end = frame_end;
+			}
+		}
+
+		queue->wait_idle();
+
+		for (size_t timing_index = timings.size() > max_frames_in_flight ? timings.size() - max_frames_in_flight : 0; timing_index < timings.size(); ++timing_index)
+			read_gpu_time(timing_index);
+
+		device->destroy_query_heap(query_heap);
+
+		disable_prefetch();
+		release_resource_pool();
+		release_pipeline_cache();
+		destroy_effect_runtime(runtime);
+
+		if (!write_benchmark_results(timings, benchmark_csv_path) && result == EXIT_SUCCESS)
+			result = 1;
+
+		return result;
+	}
+
+	// Only the first frames are profiled (10 by default), since results of every draw are kept in memory until they are written out
+	std::unique_ptr<gpu_profiler> profiler;
+	uint64_t profile_frames = benchmark_frames != 0 ? benchmark_frames : 10;
+	if (profile)
+	{
+		profiler = std::make_unique<gpu_profiler>();
+		if (!profiler->init(runtime->get_device(), runtime->get_command_queue()))
+			profiler.reset();
+	}
+
+	const auto finish_profile = [&]() {
+		profiler->read_all_results();
+		profiler->write_json(profile_json_path);
+		profiler.reset();
+	};
+
+	for (uint64_t frame = start_frame; true; ++frame)
 	{
 		while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE) && msg.message != WM_QUIT)
 			DispatchMessage(&msg);
@@ -90,15 +694,27 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow
 			break;
 
 		reshade::api::command_list *const cmd_list = runtime->get_command_queue()->get_immediate_command_list();
+		if (profiler != nullptr)
+			profiler->begin_frame(frame, cmd_list);
 		cmd_list->barrier(runtime->get_current_back_buffer(), reshade::api::resource_usage::present, reshade::api::resource_usage::render_target);
-		play_frame(trace_data, cmd_list, runtime);
+		play_frame(trace_data, cmd_list, runtime->get_command_queue(), runtime, profiler != nullptr ? &gpu_profiler::on_event : nullptr, profiler.get());
 		cmd_list->barrier(runtime->get_current_back_buffer(), reshade::api::resource_usage::render_target, reshade::api::resource_usage::present);
+		if (profiler != nullptr)
+			profiler->end_frame();
 
 		update_and_present_effect_runtime(runtime);
 
 		app->present();
+
+		if (profiler != nullptr && --profile_frames == 0)
+			finish_profile();
 	}
 
+	if (profiler != nullptr)
+		finish_profile();
+
+	disable_prefetch();
+	release_resource_pool();
 	destroy_effect_runtime(runtime);
 
 	return static_cast<int>(msg.wParam);
@@ -18,7 +18,7 @@ public:
 	virtual void present() = 0;
 };
 
-std::unique_ptr<application> create_application_d3d9(HWND window_handle, unsigned int samples = 1);
-std::unique_ptr<application> create_application_d3d11(HWND window_handle, unsigned int samples = 1);
-std::unique_ptr<application> create_application_d3d12(HWND window_handle);
-std::unique_ptr<application> create_application_opengl(HWND window_handle, unsigned int samples = 1);
+std::unique_ptr<application> create_application_d3d9(HWND window_handle, bool vsync = true, unsigned int samples = 1);
+std::unique_ptr<application> create_application_d3d11(HWND window_handle, bool vsync = true, unsigned int samples = 1);
+std::unique_ptr<application> create_application_d3d12(HWND window_handle, bool vsync = true);
+std::unique_ptr<application> create_application_opengl(HWND window_handle, bool vsync = true, unsigned int samples = 1);
@@ -9,12 +9,13 @@
 
 struct application_d3d11 : public application
 {
-	application_d3d11(HMODULE dxgi_module, HMODULE d3d11_module, com_ptr<ID3D11Device> device, com_ptr<ID3D11DeviceContext> immediate_context, com_ptr<IDXGISwapChain> swapchain) :
+	application_d3d11(HMODULE dxgi_module, HMODULE d3d11_module, com_ptr<ID3D11Device> device, com_ptr<ID3D11DeviceContext> immediate_context, com_ptr<IDXGISwapChain> swapchain, bool vsync) :
 		_dxgi_module(dxgi_module),
 		_d3d11_module(d3d11_module),
 		_device(std::move(device)),
 		_immediate_context(std::move(immediate_context)),
-		_swapchain(std::move(swapchain))
+		_swapchain(std::move(swapchain)),
+		_sync_interval(vsync ? 1 : 0)
 	{
 	}
 	~application_d3d11()
@@ -42,7 +43,7 @@ struct application_d3d11 : public application
 
 	void present() final
 	{
-		_swapchain->Present(1, 0);
+		_swapchain->Present(_sync_interval, 0);
 	}
 
 	HMODULE _dxgi_module = nullptr;
@@ -51,9 +52,10 @@ struct application_d3d11 : public application
 	com_ptr<ID3D11Device> _device;
 	com_ptr<ID3D11DeviceContext> _immediate_context;
 	com_ptr<IDXGISwapChain> _swapchain;
+	UINT _sync_interval = 1;
 };
 
-std::unique_ptr<application> create_application_d3d11(HWND window_handle, unsigned int samples)
+std::unique_ptr<application> create_application_d3d11(HWND window_handle, bool vsync, unsigned int samples)
 {
 	const HMODULE dxgi_module = LoadLibrary(TEXT("dxgi.dll"));
 	if (dxgi_module == nullptr)
@@ -81,5 +83,5 @@ std::unique_ptr<application> create_application_d3d11(HWND window_handle, unsign
 	if (FAILED(create_d3d11(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, 0, nullptr, 0, D3D11_SDK_VERSION, &desc, &swapchain, &device, nullptr, &immediate_context)))
 		return nullptr;
 
-	return std::make_unique<application_d3d11>(dxgi_module, d3d11_module, std::move(device), std::move(immediate_context), std::move(swapchain));
+	return std::make_unique<application_d3d11>(dxgi_module, d3d11_module, std::move(device), std::move(immediate_context), std::move(swapchain), vsync);
 }
@@ -10,12 +10,13 @@
 
 struct application_d3d12 : public application
 {
-	application_d3d12(HMODULE dxgi_module, HMODULE d3d12_module, com_ptr<ID3D12Device> device, com_ptr<ID3D12CommandQueue> command_queue, com_ptr<IDXGISwapChain1> swapchain) :
+	application_d3d12(HMODULE dxgi_module, HMODULE d3d12_module, com_ptr<ID3D12Device> device, com_ptr<ID3D12CommandQueue> command_queue, com_ptr<IDXGISwapChain1> swapchain, bool vsync) :
 		_dxgi_module(dxgi_module),
 		_d3d12_module(d3d12_module),
 		_device(std::move(device)),
 		_command_queue(std::move(command_queue)),
-		_swapchain(std::move(swapchain))
+		_swapchain(std::move(swapchain)),
+		_sync_interval(vsync ? 1 : 0)
 	{
 	}
 	~application_d3d12()
@@ -43,7 +44,7 @@ struct application_d3d12 : public application
 
 	void present() final
 	{
-		_swapchain->Present(1, 0);
+		_swapchain->Present(_sync_interval, 0);
 	}
 
 	HMODULE _dxgi_module = nullptr;
@@ -52,9 +53,10 @@ struct application_d3d12 : public application
 	com_ptr<ID3D12Device> _device;
 	com_ptr<ID3D12CommandQueue> _command_queue;
 	com_ptr<IDXGISwapChain1> _swapchain;
+	UINT _sync_interval = 1;
 };
 
-std::unique_ptr<application> create_application_d3d12(HWND window_handle)
+std::unique_ptr<application> create_application_d3d12(HWND window_handle, bool vsync)
 {
 	const HMODULE dxgi_module = LoadLibrary(TEXT("dxgi.dll"));
 	if (dxgi_module == nullptr)
@@ -98,5 +100,5 @@ std::unique_ptr<application> create_application_d3d12(HWND window_handle)
 	if (FAILED(dxgi_factory->CreateSwapChainForHwnd(command_queue.get(), window_handle, &swapchain_desc, nullptr, nullptr, &swapchain)))
 		return nullptr;
 
-	return std::make_unique<application_d3d12>(dxgi_module, d3d12_module, std::move(device), std::move(command_queue), std::move(swapchain));
+	return std::make_unique<application_d3d12>(dxgi_module, d3d12_module, std::move(device), std::move(command_queue), std::move(swapchain), vsync);
 }
@@ -52,7 +52,7 @@ struct application_d3d9 : public application
 	com_ptr<IDirect3DSwapChain9> _swapchain;
 };
 
-std::unique_ptr<application> create_application_d3d9(HWND window_handle, unsigned int samples)
+std::unique_ptr<application> create_application_d3d9(HWND window_handle, bool vsync, unsigned int samples)
 {
 	const HMODULE d3d9_module = LoadLibrary(TEXT("d3d9.dll"));
 	if (d3d9_module == nullptr)
@@ -72,7 +72,7 @@ std::unique_ptr<application> create_application_d3d9(HWND window_handle, unsigne
 	pp.hDeviceWindow = window_handle;
 	pp.Windowed = true;
 	pp.Flags = 0;
-	pp.PresentationInterval = D3DPRESENT_INTERVAL_ONE;
+	pp.PresentationInterval = vsync ? D3DPRESENT_INTERVAL_ONE : D3DPRESENT_INTERVAL_IMMEDIATE;
 
 	com_ptr<IDirect3DDevice9> device;
 	if (FAILED(d3d->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, window_handle, D3DCREATE_HARDWARE_VERTEXPROCESSING, &pp, &device)))
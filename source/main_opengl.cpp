@@ -50,7 +50,7 @@ struct application_opengl : public application
 	HGLRC _hglrc = nullptr;
 };
 
-std::unique_ptr<application> create_application_opengl(HWND window_handle, unsigned int samples)
+std::unique_ptr<application> create_application_opengl(HWND window_handle, bool vsync, unsigned int samples)
 {
 	const HMODULE opengl_module = LoadLibrary(TEXT("opengl32.dll"));
 	if (opengl_module == nullptr)
@@ -129,5 +129,9 @@ std::unique_ptr<application> create_application_opengl(HWND window_handle, unsig
 
 	wgl_make_current(hdc2, hglrc2);
 
+	const auto wgl_swap_interval = reinterpret_cast<BOOL(WINAPI *)(int)>(wgl_get_proc_address("wglSwapIntervalEXT"));
+	if (wgl_swap_interval != nullptr)
+		wgl_swap_interval(vsync ? 1 : 0);
+
 	return std::make_unique<application_opengl>(opengl_module, hdc2, hglrc2);
 }
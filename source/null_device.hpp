@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2024 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "trace_data.hpp"
+#include <reshade.hpp>
+
+// Device, command list and queue that do nothing, so that tools can run the playback code to decode a trace without any GPU work
+// Objects are given unique dummy handles, since playback skips operations on null handles
+class null_device : public reshade::api::device
+{
+public:
+	explicit null_device(reshade::api::device_api api) : _api(api) {}
+
+	uint64_t get_native() const override { return 0; }
+	void get_private_data(const uint8_t[16], uint64_t *data) const override { *data = 0; }
+	void set_private_data(const uint8_t[16], const uint64_t) override {}
+
+	reshade::api::device_api get_api() const override { return _api; }
+
+	bool check_capability(reshade::api::device_caps) const override { return true; }
+	bool check_format_support(reshade::api::format, reshade::api::resource_usage) const override { return true; }
+
+	bool create_sampler(const reshade::api::sampler_desc &, reshade::api::sampler *out_sampler) override { *out_sampler = { create_handle(trace_object_type::sampler) }; return true; }
+	void destroy_sampler(reshade::api::sampler) override {}
+
+	bool create_resource(const reshade::api::resource_desc &, const reshade::api::subresource_data *, reshade::api::resource_usage, reshade::api::resource *out_resource, void ** = nullptr) override { *out_resource = { create_handle(trace_object_type::resource) }; return true; }
+	void destroy_resource(reshade::api::resource) override {}
+
+	reshade::api::resource_desc get_resource_desc(reshade::api::resource) const override { return {}; }
+
+	bool create_resource_view(reshade::api::resource, reshade::api::resource_usage, const reshade::api::resource_view_desc &, reshade::api::resource_view *out_view) override { *out_view = { create_handle(trace_object_type::resource_view) }; return true; }
+	void destroy_resource_view(reshade::api::resource_view) override {}
+
+	reshade::api::resource get_resource_from_view(reshade::api::resource_view) const override { return { 0 }; }
+	reshade::api::resource_view_desc get_resource_view_desc(reshade::api::resource_view) const override { return {}; }
+
+	// Mapping fails by default, so that uploads are decoded but not copied anywhere
+	bool map_buffer_region(reshade::api::resource, uint64_t, uint64_t, reshade::api::map_access, void **out_data) override { *out_data = nullptr; return false; }
+	void unmap_buffer_region(reshade::api::resource) override {}
+	bool map_texture_region(reshade::api::resource, uint32_t, const reshade::api::subresource_box *, reshade::api::map_access, reshade::api::subresource_data *out_data) override { *out_data = {}; return false; }
+	void unmap_texture_region(reshade::api::resource, uint32_t) override {}
+
+	void update_buffer_region(const void *, reshade::api::resource, uint64_t, uint64_t) override {}
+	void update_texture_region(const reshade::api::subresource_data &, reshade::api::resource, uint32_t, const reshade::api::subresource_box * = nullptr) override {}
+
+	bool create_pipeline(reshade::api::pipeline_layout, uint32_t, const reshade::api::pipeline_subobject *, reshade::api::pipeline *out_pipeline) override { *out_pipeline = { create_handle(trace_object_type::pipeline) }; return true; }
+	void destroy_pipeline(reshade::api::pipeline) override {}
+
+	bool create_pipeline_layout(uint32_t, const reshade::api::pipeline_layout_param *, reshade::api::pipeline_layout *out_layout) override { *out_layout = { create_handle(trace_object_type::pipeline_layout) }; return true; }
+	void destroy_pipeline_layout(reshade::api::pipeline_layout) override {}
+
+	bool allocate_descriptor_tables(uint32_t, reshade::api::pipeline_layout, uint32_t, reshade::api::descriptor_table *) override { return false; }
+	void free_descriptor_tables(uint32_t, const reshade::api::descriptor_table *) override {}
+
+	void get_descriptor_heap_offset(reshade::api::descriptor_table, uint32_t, uint32_t, reshade::api::descriptor_heap *out_heap, uint32_t *out_offset) const override { *out_heap = { 0 }; *out_offset = 0; }
+
+	void copy_descriptor_tables(uint32_t, const reshade::api::descriptor_table_copy *) override {}
+	void update_descriptor_tables(uint32_t, const reshade::api::descriptor_table_update *) override {}
+
+	bool create_query_heap(reshade::api::query_type, uint32_t, reshade::api::query_heap *out_heap) override { *out_heap = { _next_handle++ }; return true; }
+	void destroy_query_heap(reshade::api::query_heap) override {}
+
+	bool get_query_heap_results(reshade::api::query_heap, uint32_t, uint32_t, void *, uint32_t) override { return false; }
+
+	void set_resource_name(reshade::api::resource, const char *) override {}
+	void set_resource_view_name(reshade::api::resource_view, const char *) override {}
+
+	bool create_fence(uint64_t, reshade::api::fence_flags, reshade::api::fence *out_fence, void ** = nullptr) override { *out_fence = { _next_handle++ }; return true; }
+	void destroy_fence(reshade::api::fence) override {}
+
+	uint64_t get_completed_fence_value(reshade::api::fence) const override { return 0; }
+
+	bool wait(reshade::api::fence, uint64_t, uint64_t = UINT64_MAX) override { return true; }
+	bool signal(reshade::api::fence, uint64_t) override { return true; }
+
+	bool get_property(reshade::api::device_properties, void *) const override { return false; }
+
+	uint64_t get_resource_view_gpu_address(reshade::api::resource_view) const override { return 0; }
+
+	void get_acceleration_structure_size(reshade::api::acceleration_structure_type, reshade::api::acceleration_structure_build_flags, uint32_t, const reshade::api::acceleration_structure_build_input *, uint64_t *out_size, uint64_t *out_build_scratch_size, uint64_t *out_update_scratch_size) const override
+	{
+		if (out_size != nullptr)
+			*out_size = 0;
+		if (out_build_scratch_size != nullptr)
+			*out_build_scratch_size = 0;
+		if (out_update_scratch_size != nullptr)
+			*out_update_scratch_size = 0;
+	}
+
+	bool get_pipeline_shader_group_handles(reshade::api::pipeline, uint32_t, uint32_t, void *) override { return false; }
+
+protected:
+	// Returns the handle for a new object, which only has to be unique and not null
+	virtual uint64_t create_handle(trace_object_type) { return _next_handle++; }
+
+private:
+	const reshade::api::device_api _api;
+	uint64_t _next_handle = 1;
+};
+
+class null_command_list : public reshade::api::command_list
+{
+public:
+	explicit null_command_list(reshade::api::device *device) : _device(device) {}
+
+	uint64_t get_native() const override { return 0; }
+	void get_private_data(const uint8_t[16], uint64_t *data) const override { *data = 0; }
+	void set_private_data(const uint8_t[16], const uint64_t) override {}
+
+	reshade::api::device *get_device() override { return _device; }
+
+	void barrier(uint32_t, const reshade::api::resource *, const reshade::api::resource_usage *, const reshade::api::resource_usage *) override {}
+
+	void begin_render_pass(uint32_t, const reshade::api::render_pass_render_target_desc *, const reshade::api::render_pass_depth_stencil_desc * = nullptr) override {}
+	void end_render_pass() override {}
+	void bind_render_targets_and_depth_stencil(uint32_t, const reshade::api::resource_view *, reshade::api::resource_view = { 0 }) override {}
+
+	void bind_pipeline(reshade::api::pipeline_stage, reshade::api::pipeline) override {}
+	void bind_pipeline_states(uint32_t, const reshade::api::dynamic_state *, const uint32_t *) override {}
+	void bind_viewports(uint32_t, uint32_t, const reshade::api::viewport *) override {}
+	void bind_scissor_rects(uint32_t, uint32_t, const reshade::api::rect *) override {}
+	void push_constants(reshade::api::shader_stage, reshade::api::pipeline_layout, uint32_t, uint32_t, uint32_t, const void *) override {}
+	void push_descriptors(reshade::api::shader_stage, reshade::api::pipeline_layout, uint32_t, const reshade::api::descriptor_table_update &) override {}
+	void bind_descriptor_tables(reshade::api::shader_stage, reshade::api::pipeline_layout, uint32_t, uint32_t, const reshade::api::descriptor_table *) override {}
+	void bind_index_buffer(reshade::api::resource, uint64_t, uint32_t) override {}
+	void bind_vertex_buffers(uint32_t, uint32_t, const reshade::api::resource *, const uint64_t *, const uint32_t *) override {}
+	void bind_stream_output_buffers(uint32_t, uint32_t, const reshade::api::resource *, const uint64_t *, const uint64_t *, const reshade::api::resource *, const uint64_t *) override {}
+
+	void draw(uint32_t, uint32_t, uint32_t, uint32_t) override {}
+	void draw_indexed(uint32_t, uint32_t, uint32_t, int32_t, uint32_t) override {}
+	void dispatch(uint32_t, uint32_t, uint32_t) override {}
+	void dispatch_mesh(uint32_t, uint32_t, uint32_t) override {}
+	void dispatch_rays(reshade::api::resource, uint64_t, uint64_t, reshade::api::resource, uint64_t, uint64_t, uint64_t, reshade::api::resource, uint64_t, uint64_t, uint64_t, reshade::api::resource, uint64_t, uint64_t, uint64_t, uint32_t, uint32_t, uint32_t) override {}
+	void draw_or_dispatch_indirect(reshade::api::indirect_command, reshade::api::resource, uint64_t, uint32_t, uint32_t) override {}
+
+	void copy_resource(reshade::api::resource, reshade::api::resource) override {}
+	void copy_buffer_region(reshade::api::resource, uint64_t, reshade::api::resource, uint64_t, uint64_t) override {}
+	void copy_buffer_to_texture(reshade::api::resource, uint64_t, uint32_t, uint32_t, reshade::api::resource, uint32_t, const reshade::api::subresource_box * = nullptr) override {}
+	void copy_texture_region(reshade::api::resource, uint32_t, const reshade::api::subresource_box *, reshade::api::resource, uint32_t, const reshade::api::subresource_box *, reshade::api::filter_mode = reshade::api::filter_mode::min_mag_mip_point) override {}
+	void copy_texture_to_buffer(reshade::api::resource, uint32_t, const reshade::api::subresource_box *, reshade::api::resource, uint64_t, uint32_t = 0, uint32_t = 0) override {}
+	void resolve_texture_region(reshade::api::resource, uint32_t, const reshade::api::subresource_box *, reshade::api::resource, uint32_t, int32_t, int32_t, int32_t, reshade::api::format) override {}
+
+	void clear_depth_stencil_view(reshade::api::resource_view, const float *, const uint8_t *, uint32_t = 0, const reshade::api::rect * = nullptr) override {}
+	void clear_render_target_view(reshade::api::resource_view, const float[4], uint32_t = 0, const reshade::api::rect * = nullptr) override {}
+	void clear_unordered_access_view_uint(reshade::api::resource_view, const uint32_t[4], uint32_t = 0, const reshade::api::rect * = nullptr) override {}
+	void clear_unordered_access_view_float(reshade::api::resource_view, const float[4], uint32_t = 0, const reshade::api::rect * = nullptr) override {}
+
+	void generate_mipmaps(reshade::api::resource_view) override {}
+
+	void begin_query(reshade::api::query_heap, reshade::api::query_type, uint32_t) override {}
+	void end_query(reshade::api::query_heap, reshade::api::query_type, uint32_t) override {}
+	void copy_query_heap_results(reshade::api::query_heap, reshade::api::query_type, uint32_t, uint32_t, reshade::api::resource, uint64_t, uint32_t) override {}
+
+	void begin_debug_event(const char *, const float[4] = nullptr) override {}
+	void end_debug_event() override {}
+	void insert_debug_marker(const char *, const float[4] = nullptr) override {}
+
+	void copy_acceleration_structure(reshade::api::resource_view, reshade::api::resource_view, reshade::api::acceleration_structure_copy_mode) override {}
+	void build_acceleration_structure(reshade::api::acceleration_structure_type, reshade::api::acceleration_structure_build_flags, uint32_t, const reshade::api::acceleration_structure_build_input *, reshade::api::resource, uint64_t, reshade::api::resource_view, reshade::api::resource_view, reshade::api::acceleration_structure_build_mode) override {}
+
+private:
+	reshade::api::device *const _device;
+};
+
+class null_command_queue : public reshade::api::command_queue
+{
+public:
+	null_command_queue(reshade::api::device *device, reshade::api::command_list *cmd_list) : _device(device), _cmd_list(cmd_list) {}
+
+	uint64_t get_native() const override { return 0; }
+	void get_private_data(const uint8_t[16], uint64_t *data) const override { *data = 0; }
+	void set_private_data(const uint8_t[16], const uint64_t) override {}
+
+	reshade::api::device *get_device() override { return _device; }
+
+	reshade::api::command_queue_type get_type() const override { return reshade::api::command_queue_type::graphics | reshade::api::command_queue_type::compute | reshade::api::command_queue_type::copy; }
+
+	void wait_idle() const override {}
+
+	void flush_immediate_command_list() const override {}
+
+	reshade::api::command_list *get_immediate_command_list() override { return _cmd_list; }
+
+	void begin_debug_event(const char *, const float[4] = nullptr) override {}
+	void end_debug_event() override {}
+	void insert_debug_marker(const char *, const float[4] = nullptr) override {}
+
+	bool wait(reshade::api::fence, uint64_t) override { return true; }
+	bool signal(reshade::api::fence, uint64_t) override { return true; }
+
+	uint64_t get_timestamp_frequency() const override { return 0; }
+
+private:
+	reshade::api::device *const _device;
+	reshade::api::command_list *const _cmd_list;
+};
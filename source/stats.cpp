@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2024 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "null_device.hpp"
+#include "trace_events.hpp"
+#include <array>
+#include <cstdlib>
+#include <cinttypes>
+#include <unordered_set>
+
+using namespace reshade::api;
+
+extern void set_object_callback(void(*callback)(trace_object_type type, uint64_t id, void *user_data), void *user_data);
+extern command_queue_type get_command_queue_type(uint64_t id);
+extern bool play_frame(trace_data_read &trace_data, command_list *cmd_list, command_queue *queue, effect_runtime *runtime, void(*callback)(reshade::addon_event ev, uint64_t offset, void *user_data), void *user_data);
+
+// Event types are counted in a fixed table, with the last slot used for snapshot data
+constexpr size_t event_type_count = trace_event_type_count;
+constexpr size_t snapshot_event_index = event_type_count;
+
+static size_t event_index(reshade::addon_event ev)
+{
+	if (static_cast<uint32_t>(ev) == trace_snapshot_data_event)
+		return snapshot_event_index;
+	assert(static_cast<size_t>(ev) < event_type_count);
+	return static_cast<size_t>(ev);
+}
+
+static const char *event_name(size_t index)
+{
+	return index == snapshot_event_index ? "snapshot_data" : trace_event_name(static_cast<reshade::addon_event>(index));
+}
+
+// Trace bytes are attributed to a category by the type of the event they belong to
+enum class byte_category
+{
+	shader_code,
+	initial_data,
+	uploads,
+	objects,
+	commands,
+	count
+};
+
+static const char *const s_category_names[] = { "shader code", "initial data", "uploads", "objects", "commands" };
+
+static byte_category event_category(size_t index)
+{
+	if (index == snapshot_event_index)
+		return byte_category::uploads;
+
+	switch (static_cast<reshade::addon_event>(index))
+	{
+	case reshade::addon_event::init_pipeline:
+		return byte_category::shader_code;
+	case reshade::addon_event::init_resource:
+		return byte_category::initial_data;
+	case reshade::addon_event::unmap_buffer_region:
+	case reshade::addon_event::unmap_texture_region:
+	case reshade::addon_event::update_buffer_region:
+	case reshade::addon_event::update_texture_region:
+		return byte_category::uploads;
+	case reshade::addon_event::init_command_queue:
+	case reshade::addon_event::destroy_command_queue:
+	case reshade::addon_event::init_swapchain:
+	case reshade::addon_event::destroy_swapchain:
+	case reshade::addon_event::init_sampler:
+	case reshade::addon_event::destroy_sampler:
+	case reshade::addon_event::destroy_resource:
+	case reshade::addon_event::init_resource_view:
+	case reshade::addon_event::destroy_resource_view:
+	case reshade::addon_event::map_buffer_region:
+	case reshade::addon_event::map_texture_region:
+	case reshade::addon_event::destroy_pipeline:
+	case reshade::addon_event::init_pipeline_layout:
+	case reshade::addon_event::destroy_pipeline_layout:
+	case reshade::addon_event::copy_descriptor_tables:
+	case reshade::addon_event::update_descriptor_tables:
+		return byte_category::objects;
+	default:
+		return byte_category::commands;
+	}
+}
+
+struct frame_stats
+{
+	std::array<uint32_t, event_type_count + 1> event_counts = {};
+	std::array<uint64_t, event_type_count + 1> event_bytes = {};
+	uint64_t bytes = 0;
+	uint32_t submissions = 0;
+	// Submissions to compute or copy queues, which may have overlapped with graphics work during capture, but are played back in order
+	uint32_t async_submissions = 0;
+	uint32_t draws = 0;
+	uint32_t dispatches = 0;
+	uint32_t unique_pipelines = 0;
+	uint32_t redundant_binds = 0;
+	uint32_t pipelines_created = 0;
+};
+
+struct trace_stats
+{
+	std::vector<frame_stats> frames;
+	// Event that is currently being played back, its size is only known once the next one starts
+	size_t event = SIZE_MAX;
+	uint64_t event_offset = 0;
+	std::unordered_set<uint64_t> bound_pipelines;
+	// Queue that the command list of the current 'execute_command_list' event was executed on, other submissions are not attributed to a queue
+	uint64_t submission_queue = 0;
+
+	frame_stats &current() { return frames.back(); }
+
+	void end_event(uint64_t offset)
+	{
+		if (event == SIZE_MAX)
+			return;
+
+		const uint64_t size = offset - event_offset;
+		current().event_counts[event]++;
+		current().event_bytes[event] += size;
+		current().bytes += size;
+		event = SIZE_MAX;
+	}
+};
+
+// Device and command list that only count what is done on them, so that the playback code decodes the trace without any GPU work
+class stats_device : public null_device
+{
+public:
+	stats_device(device_api api, trace_stats &stats) : null_device(api), _stats(stats) {}
+
+	bool create_pipeline(pipeline_layout layout, uint32_t subobject_count, const pipeline_subobject *subobjects, pipeline *out_pipeline) final
+	{
+		_stats.current().pipelines_created++;
+		return null_device::create_pipeline(layout, subobject_count, subobjects, out_pipeline);
+	}
+
+private:
+	trace_stats &_stats;
+};
+
+// Binds are redundant if they set exactly what is already bound, which is tracked per pipeline stage and slot
+class stats_command_list : public null_command_list
+{
+public:
+	stats_command_list(stats_device *device, trace_stats &stats) : null_command_list(device), _stats(stats) {}
+
+	void reset_bound_state()
+	{
+		_pipelines.clear();
+		_viewports.clear();
+		_scissor_rects.clear();
+		_index_buffer = { UINT64_MAX };
+		_vertex_buffers.clear();
+		_render_targets.clear();
+	}
+
+	void bind_render_targets_and_depth_stencil(uint32_t count, const resource_view *rtvs, resource_view dsv = { 0 }) final
+	{
+		std::vector<uint64_t> render_targets(count + 1);
+		for (uint32_t i = 0; i < count; ++i)
+			render_targets[i] = rtvs[i].handle;
+		render_targets[count] = dsv.handle;
+
+		count_bind(_render_targets == render_targets);
+		_render_targets = std::move(render_targets);
+	}
+
+	void bind_pipeline(pipeline_stage stages, pipeline pipeline) final
+	{
+		_stats.bound_pipelines.insert(pipeline.handle);
+
+		uint64_t &bound = _pipelines[static_cast<uint32_t>(stages)];
+		count_bind(bound == pipeline.handle && pipeline.handle != 0);
+		bound = pipeline.handle;
+	}
+	void bind_viewports(uint32_t first, uint32_t count, const viewport *viewports) final
+	{
+		count_bind(bind_range(_viewports, first, count, viewports));
+	}
+	void bind_scissor_rects(uint32_t first, uint32_t count, const rect *rects) final
+	{
+		count_bind(bind_range(_scissor_rects, first, count, rects));
+	}
+	void bind_index_buffer(resource buffer, uint64_t offset, uint32_t index_size) final
+	{
+		const index_buffer_binding binding = { buffer.handle, offset, index_size };
+		count_bind(std::memcmp(&_index_buffer, &binding, sizeof(binding)) == 0);
+		_index_buffer = binding;
+	}
+	void bind_vertex_buffers(uint32_t first, uint32_t count, const resource *buffers, const uint64_t *offsets, const uint32_t *strides) final
+	{
+		std::vector<vertex_buffer_binding> bindings(count);
+		for (uint32_t i = 0; i < count; ++i)
+			bindings[i] = { buffers[i].handle, offsets[i], strides != nullptr ? strides[i] : 0 };
+
+		count_bind(bind_range(_vertex_buffers, first, count, bindings.data()));
+	}
+
+	void draw(uint32_t, uint32_t, uint32_t, uint32_t) final { _stats.current().draws++; }
+	void draw_indexed(uint32_t, uint32_t, uint32_t, int32_t, uint32_t) final { _stats.current().draws++; }
+	void dispatch(uint32_t, uint32_t, uint32_t) final { _stats.current().dispatches++; }
+	void dispatch_mesh(uint32_t, uint32_t, uint32_t) final { _stats.current().draws++; }
+	void dispatch_rays(resource, uint64_t, uint64_t, resource, uint64_t, uint64_t, uint64_t, resource, uint64_t, uint64_t, uint64_t, resource, uint64_t, uint64_t, uint64_t, uint32_t, uint32_t, uint32_t) final { _stats.current().dispatches++; }
+	void draw_or_dispatch_indirect(indirect_command type, resource, uint64_t, uint32_t draw_count, uint32_t) final
+	{
+		if (type == indirect_command::dispatch)
+			_stats.current().dispatches += draw_count;
+		else
+			_stats.current().draws += draw_count;
+	}
+
+private:
+	struct index_buffer_binding
+	{
+		uint64_t buffer;
+		uint64_t offset;
+		uint64_t index_size;
+	};
+	struct vertex_buffer_binding
+	{
+		uint64_t buffer;
+		uint64_t offset;
+		uint64_t stride;
+	};
+
+	// Only counts as redundant if every element in the range was already bound with the same value
+	template <typename T>
+	static bool bind_range(std::vector<T> &bound, uint32_t first, uint32_t count, const T *values)
+	{
+		bool redundant = count != 0 && first + count <= bound.size();
+		if (bound.size() < first + count)
+			bound.resize(first + count);
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			redundant &= std::memcmp(&bound[first + i], &values[i], sizeof(T)) == 0;
+			bound[first + i] = values[i];
+		}
+
+		return redundant;
+	}
+
+	void count_bind(bool redundant)
+	{
+		if (redundant)
+			_stats.current().redundant_binds++;
+	}
+
+	trace_stats &_stats;
+	std::unordered_map<uint32_t, uint64_t> _pipelines;
+	std::vector<viewport> _viewports;
+	std::vector<rect> _scissor_rects;
+	index_buffer_binding _index_buffer = { UINT64_MAX };
+	std::vector<vertex_buffer_binding> _vertex_buffers;
+	std::vector<uint64_t> _render_targets;
+};
+
+// Separately recorded command lists are played back on the immediate command list, which starts with no state bound after each submission
+class stats_command_queue : public null_command_queue
+{
+public:
+	stats_command_queue(stats_device *device, stats_command_list *cmd_list, trace_stats &stats) : null_command_queue(device, cmd_list), _cmd_list(cmd_list), _stats(stats) {}
+
+	void flush_immediate_command_list() const final
+	{
+		_stats.current().submissions++;
+		if ((get_command_queue_type(_stats.submission_queue) & command_queue_type::graphics) == 0)
+			_stats.current().async_submissions++;
+		_stats.submission_queue = 0;
+
+		_cmd_list->reset_bound_state();
+	}
+
+private:
+	stats_command_list *const _cmd_list;
+	trace_stats &_stats;
+};
+
+static void on_event(reshade::addon_event ev, uint64_t offset, void *user_data)
+{
+	trace_stats &stats = *static_cast<trace_stats *>(user_data);
+
+	stats.end_event(offset);
+	stats.event = event_index(ev);
+	stats.event_offset = offset;
+}
+
+static void on_object(trace_object_type type, uint64_t id, void *user_data)
+{
+	if (type == trace_object_type::command_queue)
+		static_cast<trace_stats *>(user_data)->submission_queue = id;
+}
+
+static bool write_frame_stats(const trace_stats &stats, const frame_stats &totals, const char *csv_path)
+{
+	FILE *file = nullptr;
+	if (fopen_s(&file, csv_path, "w") != 0 || file == nullptr)
+		return false;
+
+	fputs("frame,bytes,submissions,async_submissions,draws,dispatches,unique_pipelines,redundant_binds,pipelines_created", file);
+	for (size_t category = 0; category < static_cast<size_t>(byte_category::count); ++category)
+		fprintf(file, ",%s bytes", s_category_names[category]);
+	// Only include columns for event types that occur somewhere in the trace
+	for (size_t index = 0; index < totals.event_counts.size(); ++index)
+		if (totals.event_counts[index] != 0)
+			fprintf(file, ",%s", event_name(index));
+	fputs("\n", file);
+
+	for (size_t frame = 0; frame < stats.frames.size(); ++frame)
+	{
+		const frame_stats &frame_stats = stats.frames[frame];
+
+		uint64_t category_bytes[static_cast<size_t>(byte_category::count)] = {};
+		for (size_t index = 0; index < frame_stats.event_bytes.size(); ++index)
+			category_bytes[static_cast<size_t>(event_category(index))] += frame_stats.event_bytes[index];
+
+		fprintf(file, "%zu,%" PRIu64 ",%u,%u,%u,%u,%u,%u,%u", frame, frame_stats.bytes, frame_stats.submissions, frame_stats.async_submissions, frame_stats.draws, frame_stats.dispatches, frame_stats.unique_pipelines, frame_stats.redundant_binds, frame_stats.pipelines_created);
+		for (const uint64_t bytes : category_bytes)
+			fprintf(file, ",%" PRIu64, bytes);
+		for (size_t index = 0; index < totals.event_counts.size(); ++index)
+			if (totals.event_counts[index] != 0)
+				fprintf(file, ",%u", frame_stats.event_counts[index]);
+		fputs("\n", file);
+	}
+
+	fclose(file);
+	return true;
+}
+
+static void print_summary(const trace_stats &stats, const frame_stats &totals)
+{
+	const size_t frame_count = std::max<size_t>(stats.frames.size(), 1);
+
+	printf("%zu frames, %.2f MiB of event data (%.2f KiB per frame)\n", stats.frames.size(), totals.bytes / (1024.0 * 1024.0), totals.bytes / (1024.0 * frame_count));
+	printf("%u submissions (%u to compute or copy queues), %u draws, %u dispatches, %u pipelines created, %u redundant binds\n\n", totals.submissions, totals.async_submissions, totals.draws, totals.dispatches, totals.pipelines_created, totals.redundant_binds);
+
+	uint64_t category_bytes[static_cast<size_t>(byte_category::count)] = {};
+	for (size_t index = 0; index < totals.event_bytes.size(); ++index)
+		category_bytes[static_cast<size_t>(event_category(index))] += totals.event_bytes[index];
+
+	printf("%-40s %16s %8s\n", "category", "bytes", "share");
+	for (size_t category = 0; category < static_cast<size_t>(byte_category::count); ++category)
+		printf("%-40s %16" PRIu64 " %7.2f%%\n", s_category_names[category], category_bytes[category], 100.0 * category_bytes[category] / std::max<uint64_t>(totals.bytes, 1));
+	printf("\n");
+
+	// Sort event types by the amount of data they make up, since that is what determines trace size and decode time
+	std::vector<size_t> indices;
+	for (size_t index = 0; index < totals.event_counts.size(); ++index)
+		if (totals.event_counts[index] != 0)
+			indices.push_back(index);
+	std::sort(indices.begin(), indices.end(), [&totals](size_t a, size_t b) { return totals.event_bytes[a] > totals.event_bytes[b]; });
+
+	printf("%-40s %12s %12s %16s %8s\n", "event", "count", "per frame", "bytes", "share");
+	for (const size_t index : indices)
+		printf("%-40s %12u %12.1f %16" PRIu64 " %7.2f%%\n", event_name(index), totals.event_counts[index], static_cast<double>(totals.event_counts[index]) / frame_count, totals.event_bytes[index], 100.0 * totals.event_bytes[index] / std::max<uint64_t>(totals.bytes, 1));
+}
+
+int main(int argc, char *argv[])
+{
+	const char *trace_path = "api_trace_log.bin";
+	const char *csv_path = "stats.csv";
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+			csv_path = argv[++i];
+		else
+			trace_path = argv[i];
+	}
+
+	trace_data_read trace_data(trace_path);
+	if (!trace_data.is_open())
+	{
+		fprintf(stderr, "Failed to open trace file '%s'.\n", trace_path);
+		return 2;
+	}
+
+	const auto graphics_api = trace_data.read<device_api>();
+
+	// Excludes the index from event data, if the trace has one
+	trace_index index;
+	trace_data.read_index(index);
+
+	trace_stats stats;
+	stats_device device(graphics_api, stats);
+	stats_command_list cmd_list(&device, stats);
+	stats_command_queue queue(&device, &cmd_list, stats);
+
+	set_object_callback(on_object, &stats);
+
+	for (bool present = true; present;)
+	{
+		stats.frames.emplace_back();
+		stats.bound_pipelines.clear();
+
+		present = play_frame(trace_data, &cmd_list, &queue, nullptr, on_event, &stats);
+
+		stats.end_event(trace_data.tell());
+		stats.current().unique_pipelines = static_cast<uint32_t>(stats.bound_pipelines.size());
+
+		// Drop the empty frame after the last present
+		if (!present && stats.current().bytes == 0)
+			stats.frames.pop_back();
+	}
+
+	frame_stats totals;
+	for (const frame_stats &frame_stats : stats.frames)
+	{
+		for (size_t index = 0; index < totals.event_counts.size(); ++index)
+		{
+			totals.event_counts[index] += frame_stats.event_counts[index];
+			totals.event_bytes[index] += frame_stats.event_bytes[index];
+		}
+
+		totals.bytes += frame_stats.bytes;
+		totals.submissions += frame_stats.submissions;
+		totals.async_submissions += frame_stats.async_submissions;
+		totals.draws += frame_stats.draws;
+		totals.dispatches += frame_stats.dispatches;
+		totals.redundant_binds += frame_stats.redundant_binds;
+		totals.pipelines_created += frame_stats.pipelines_created;
+	}
+
+	print_summary(stats, totals);
+
+	if (!write_frame_stats(stats, totals, csv_path))
+	{
+		fprintf(stderr, "Failed to write '%s'.\n", csv_path);
+		return 1;
+	}
+
+	return 0;
+}
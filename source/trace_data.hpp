@@ -7,30 +7,207 @@
 
 #include <cstdio>
 #include <cassert>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <Windows.h>
+#include <compressapi.h>
 
-struct trace_data
+namespace reshade { enum class addon_event : uint32_t; }
+
+constexpr uint64_t trace_magic = (uint64_t('A') << 0) | (uint64_t('P') << 8) | (uint64_t('I') << 16) | (uint64_t('T') << 24) | (uint64_t('R') << 32) | (uint64_t('A') << 40) | (uint64_t('C') << 48) | (uint64_t('E') << 56);
+constexpr uint64_t trace_index_magic = (uint64_t('A') << 0) | (uint64_t('P') << 8) | (uint64_t('I') << 16) | (uint64_t('I') << 24) | (uint64_t('N') << 32) | (uint64_t('D') << 40) | (uint64_t('E') << 48) | (uint64_t('X') << 56);
+constexpr uint32_t trace_version = 10;
+
+// The file header (magic, version and flags) is always stored uncompressed, everything after it is split into compressed blocks if 'trace_flag_compressed' is set
+constexpr uint32_t trace_header_size = 16;
+constexpr uint32_t trace_flag_compressed = 1 << 0;
+
+// Blobs of at least this size are preceded by the offset of an identical blob written earlier in the trace (or zero if the data follows inline)
+constexpr uint64_t trace_blob_min_size = 128;
+
+// Encoding of the data written with 'unmap_buffer_region' events, delta encoded data consists of the ranges that changed since the last mapping of that buffer
+enum class trace_buffer_encoding : uint8_t
+{
+	raw,
+	// Raw data that the following delta encoded mappings of the buffer refer to
+	raw_and_keep,
+	delta
+};
+
+// Types of objects that are referenced by sequential IDs in the trace
+enum class trace_object_type : uint32_t
+{
+	sampler,
+	resource,
+	resource_view,
+	pipeline_layout,
+	pipeline,
+	command_queue
+};
+
+// Events are identified by a single byte in the trace, which is enough for all 'reshade::addon_event' values
+using trace_event_tag = uint8_t;
+
+// Resource contents read back after a capture started are written later in the trace wrapped in this event (followed by the wrapped update event), since they only become available a few frames in
+// Playback skips them in stream order and instead applies them right after the objects created before the first frame
+constexpr uint32_t trace_snapshot_data_event = 0xFF;
+
+// Maps signed integers to unsigned ones with small magnitudes first, so that they encode to short varints
+inline uint64_t trace_zigzag_encode(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); }
+inline int64_t trace_zigzag_decode(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+
+// MurmurHash64A
+inline uint64_t trace_blob_hash(const void *data, size_t size, uint64_t seed = 0x8445d61a4e774912ull)
 {
-	trace_data()
+	constexpr uint64_t m = 0xc6a4a7935bd1e995ull;
+	constexpr int r = 47;
+
+	uint64_t h = seed ^ (size * m);
+
+	const auto p = static_cast<const uint8_t *>(data);
+	const uint8_t *const end = p + (size & ~size_t(7));
+
+	for (const uint8_t *it = p; it != end; it += 8)
 	{
+		uint64_t k;
+		std::memcpy(&k, it, sizeof(k));
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
 	}
-	~trace_data()
+
+	switch (size & 7)
 	{
-		if (s != nullptr)
-			fclose(s);
+	case 7: h ^= uint64_t(end[6]) << 48; [[fallthrough]];
+	case 6: h ^= uint64_t(end[5]) << 40; [[fallthrough]];
+	case 5: h ^= uint64_t(end[4]) << 32; [[fallthrough]];
+	case 4: h ^= uint64_t(end[3]) << 24; [[fallthrough]];
+	case 3: h ^= uint64_t(end[2]) << 16; [[fallthrough]];
+	case 2: h ^= uint64_t(end[1]) << 8; [[fallthrough]];
+	case 1: h ^= uint64_t(end[0]);
+		h *= m;
 	}
 
-	bool is_open() const { return s != nullptr; }
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
 
-	FILE *s = nullptr;
+// Trailing index of a trace, followed by its offset in the file and 'trace_index_magic'
+struct trace_index
+{
+	// Offset of the first event of every frame
+	std::vector<uint64_t> frame_offsets;
+	// Offset of every device-level event (object creation and destruction, descriptor and resource updates), which later frames may depend on
+	std::vector<uint64_t> state_offsets;
+	// Offset of every 'trace_snapshot_data_event'
+	std::vector<uint64_t> snapshot_offsets;
 };
 
-struct trace_data_read : trace_data
+struct trace_data_read
 {
+	// Number of compressed blocks that are decompressed ahead of the current read position
+	static constexpr size_t max_read_ahead_blocks = 4;
+	// Upper bound on the number of blocks decompressed ahead to cover the frames requested with 'read_ahead_frames', which limits the memory used for large frames
+	static constexpr size_t max_frame_read_ahead_blocks = 16;
+
 	explicit trace_data_read(const char *filename)
 	{
-		fopen_s(&s, filename, "rb");
+		_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (_file == INVALID_HANDLE_VALUE)
+			return;
+
+		LARGE_INTEGER file_size = {};
+		if (!GetFileSizeEx(_file, &file_size) || file_size.QuadPart < trace_header_size)
+			return;
+
+		_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (_mapping == nullptr)
+			return;
+
+		_data = static_cast<const uint8_t *>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+		if (_data == nullptr)
+			return;
+
+		uint64_t magic; uint32_t version, flags;
+		std::memcpy(&magic, _data, sizeof(magic));
+		std::memcpy(&version, _data + 8, sizeof(version));
+		std::memcpy(&flags, _data + 12, sizeof(flags));
+		if (magic != trace_magic || version != trace_version)
+			return;
+
+		_size = static_cast<uint64_t>(file_size.QuadPart);
+		_position = trace_header_size;
+
+		if ((flags & trace_flag_compressed) != 0)
+		{
+			// Build block table, so that logical offsets can be translated to compressed blocks
+			uint64_t file_offset = trace_header_size;
+			uint64_t logical_offset = trace_header_size;
+
+			while (_size - file_offset >= 2 * sizeof(uint32_t))
+			{
+				block_info info;
+				std::memcpy(&info.stored_size, _data + file_offset, sizeof(uint32_t));
+				std::memcpy(&info.size, _data + file_offset + sizeof(uint32_t), sizeof(uint32_t));
+				info.file_offset = file_offset + 2 * sizeof(uint32_t);
+				info.logical_offset = logical_offset;
+
+				// Stop at a truncated block in case the trace was not closed properly
+				if (info.stored_size == 0 || info.stored_size > info.size || info.stored_size > _size - info.file_offset)
+					break;
+
+				_blocks.push_back(info);
+
+				file_offset = info.file_offset + info.stored_size;
+				logical_offset += info.size;
+			}
+
+			_size = logical_offset;
+
+			CreateDecompressor(COMPRESS_ALGORITHM_XPRESS | COMPRESS_RAW, nullptr, &_decompressor);
+
+			_read_ahead_thread = std::thread(&trace_data_read::read_ahead_thread, this);
+		}
+	}
+	~trace_data_read()
+	{
+		if (_read_ahead_thread.joinable())
+		{
+			{
+				const std::unique_lock<std::mutex> lock(_mutex);
+				_exit = true;
+			}
+			_read_ahead_cv.notify_all();
+			_read_ahead_thread.join();
+		}
+
+		if (_decompressor != nullptr)
+			CloseDecompressor(_decompressor);
+
+		if (_data != nullptr)
+			UnmapViewOfFile(_data);
+		if (_mapping != nullptr)
+			CloseHandle(_mapping);
+		if (_file != INVALID_HANDLE_VALUE)
+			CloseHandle(_file);
 	}
 
+	bool is_open() const { return _size != 0; }
+
 	template <typename T>
 	T read()
 	{
@@ -40,45 +217,831 @@ struct trace_data_read : trace_data
 	}
 	bool read(void *data, size_t size)
 	{
-		size_t read = fread(data, 1, size, s);
-		assert(read == size || read == 0);
-		return read == size;
+		if (size > _size - _position)
+		{
+			assert(_position == _size);
+			_position = _size;
+			return false;
+		}
+
+		if (_blocks.empty())
+		{
+			std::memcpy(data, _data + _position, size);
+			_position += size;
+		}
+		else
+		{
+			copy_blocks(static_cast<uint8_t *>(data), size);
+		}
+
+		return true;
+	}
+
+	// Reads the type of the next event, returns false at the end of the trace
+	bool read_event(reshade::addon_event &ev)
+	{
+		trace_event_tag tag;
+		if (!read(&tag, sizeof(tag)))
+			return false;
+		ev = static_cast<reshade::addon_event>(tag);
+		return true;
+	}
+	reshade::addon_event read_event()
+	{
+		reshade::addon_event ev = static_cast<reshade::addon_event>(0);
+		read_event(ev);
+		return ev;
+	}
+
+	// Reads an unsigned LEB128 integer written with 'write_varint'
+	uint64_t read_varint()
+	{
+		uint64_t value = 0;
+		for (unsigned int shift = 0; shift < 64; shift += 7)
+		{
+			uint8_t byte;
+			if (!read(&byte, sizeof(byte)))
+				break;
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				break;
+		}
+		return value;
+	}
+
+	// Returns a pointer to the next 'size' bytes without copying them if possible
+	// For uncompressed traces this points straight into the mapped file and stays valid for the lifetime of this object, otherwise only until the next call to 'release_data'
+	const void *read_data(size_t size)
+	{
+		if (size > _size - _position)
+		{
+			assert(_position == _size);
+			_position = _size;
+			return nullptr;
+		}
+
+		if (_blocks.empty())
+		{
+			const uint8_t *const data = _data + _position;
+			_position += size;
+			return data;
+		}
+
+		size_t available = 0;
+		const uint8_t *const data = block_data(_position, available);
+		if (size <= available)
+		{
+			_position += size;
+			return data;
+		}
+
+		// Data crosses a block boundary, so have to gather it into a separate buffer
+		uint8_t *const spill_data = _spill_data.emplace_back(new uint8_t[size]).get();
+		copy_blocks(spill_data, size);
+		return spill_data;
+	}
+	// Releases memory backing pointers previously returned by 'read_data'
+	void release_data()
+	{
+		_retained_blocks.clear();
+		_spill_data.clear();
+	}
+
+	// Reads data written with 'trace_data_write::write_blob', resolving references to earlier blobs without copying where possible
+	// Referenced blobs stay valid for the lifetime of this object, so they can be shared between events
+	const void *read_blob(size_t size)
+	{
+		if (size < trace_blob_min_size)
+			return read_data(size);
+
+		if (_recorded_blobs != nullptr)
+			_recorded_blobs->push_back({ _position, size });
+
+		const auto reference = read<uint64_t>();
+		if (reference == 0)
+			return read_data(size);
+
+		if (reference > _size || size > _size - reference)
+		{
+			assert(false);
+			return nullptr;
+		}
+
+		if (_blocks.empty())
+			return _data + reference;
+
+		std::unique_ptr<uint8_t[]> &blob = _blob_cache[reference];
+		if (blob == nullptr)
+		{
+			blob.reset(new uint8_t[size]);
+
+			// Decompress the referenced blocks directly, so that the current block and read-ahead are not affected
+			for (uint64_t offset = reference, end = reference + size; offset < end;)
+			{
+				const size_t index = find_block(offset);
+				const block_info &info = _blocks[index];
+
+				std::shared_ptr<const decompressed_block> block;
+				if (_current_block != nullptr && _current_block->index == index)
+					block = _current_block;
+				else
+					block = decompress_block(_decompressor, index);
+
+				const size_t block_offset = static_cast<size_t>(offset - info.logical_offset);
+				const size_t chunk = static_cast<size_t>(std::min<uint64_t>(end - offset, info.size - block_offset));
+				std::memcpy(blob.get() + (offset - reference), block->data + block_offset, chunk);
+
+				offset += chunk;
+			}
+		}
+
+		return blob.get();
+	}
+
+	uint64_t tell() const { return _position; }
+	uint64_t size() const { return _size; }
+
+	// Moves past a blob without reading its data
+	void skip_blob(size_t size)
+	{
+		if (size >= trace_blob_min_size && _recorded_blobs != nullptr)
+			_recorded_blobs->push_back({ _position, size });
+
+		if (size >= trace_blob_min_size && read<uint64_t>() != 0)
+			return;
+
+		seek(std::min(_position + size, _size));
+	}
+
+	void seek(uint64_t offset)
+	{
+		assert(offset <= _size);
+		_position = offset;
+	}
+
+	// Starts reading the data of the frames following the one at the current read position in the background (if the index was read), so that playing them back later does not wait on the disk or on decompression
+	// Compressed blocks are decompressed ahead on the read-ahead thread, for uncompressed traces the pages of the mapped file are prefetched by the system
+	void read_ahead_frames(size_t count)
+	{
+		const auto frame_it = std::upper_bound(_frame_offsets.begin(), _frame_offsets.end(), _position);
+		if (frame_it == _frame_offsets.end())
+			return;
+
+		const size_t frame = std::min(static_cast<size_t>(frame_it - _frame_offsets.begin()) + count, _frame_offsets.size() - 1);
+		const uint64_t end = std::min(_frame_offsets[frame], _size);
+
+		if (_blocks.empty())
+		{
+			// Start over after seeking
+			if (_read_ahead_offset < _position || _read_ahead_offset > end)
+				_read_ahead_offset = _position;
+			if (_read_ahead_offset == end)
+				return;
+
+			const uint64_t begin = _read_ahead_offset;
+			_read_ahead_offset = end;
+
+			WIN32_MEMORY_RANGE_ENTRY range;
+			range.VirtualAddress = const_cast<uint8_t *>(_data + begin);
+			range.NumberOfBytes = static_cast<SIZE_T>(end - begin);
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+		}
+		else if (end != 0)
+		{
+			{
+				const std::unique_lock<std::mutex> lock(_mutex);
+				_read_ahead_end = find_block(end - 1) + 1;
+			}
+			_read_ahead_cv.notify_all();
+		}
+	}
+
+	// Remembers the offset and size of every blob read or skipped from now on (until this is called with null), so that the events containing them can be copied to another trace
+	void record_blobs(std::vector<std::pair<uint64_t, size_t>> *blobs) { _recorded_blobs = blobs; }
+
+	// Reads the trailing index and excludes it from the event data, traces that were not closed properly do not have one
+	bool read_index(trace_index &index)
+	{
+		constexpr uint64_t footer_size = 2 * sizeof(uint64_t);
+		if (_size - _position < footer_size)
+			return false;
+
+		const uint64_t position = _position;
+
+		_position = _size - footer_size;
+		const auto index_offset = read<uint64_t>();
+		if (read<uint64_t>() != trace_index_magic || index_offset < position || index_offset > _size - footer_size)
+		{
+			_position = position;
+			return false;
+		}
+
+		_position = index_offset;
+		for (std::vector<uint64_t> *offsets : { &index.frame_offsets, &index.state_offsets, &index.snapshot_offsets })
+		{
+			const auto count = read<uint64_t>();
+			if (count > (_size - footer_size - _position) / sizeof(uint64_t))
+			{
+				_position = position;
+				return false;
+			}
+
+			offsets->resize(static_cast<size_t>(count));
+			read(offsets->data(), offsets->size() * sizeof(uint64_t));
+		}
+
+		_frame_offsets = index.frame_offsets;
+
+		_size = index_offset;
+		_position = position;
+		return true;
+	}
+
+private:
+	struct block_info
+	{
+		uint64_t file_offset;
+		uint64_t logical_offset;
+		uint32_t stored_size;
+		uint32_t size;
+	};
+	struct decompressed_block
+	{
+		size_t index;
+		const uint8_t *data;
+		std::unique_ptr<uint8_t[]> storage;
+	};
+
+	std::shared_ptr<const decompressed_block> decompress_block(DECOMPRESSOR_HANDLE decompressor, size_t index) const
+	{
+		const block_info &info = _blocks[index];
+
+		const auto block = std::make_shared<decompressed_block>();
+		block->index = index;
+
+		if (info.stored_size == info.size)
+		{
+			block->data = _data + info.file_offset;
+		}
+		else
+		{
+			block->storage.reset(new uint8_t[info.size]);
+			block->data = block->storage.get();
+
+			SIZE_T decompressed_size = 0;
+			if (!Decompress(decompressor, _data + info.file_offset, info.stored_size, block->storage.get(), info.size, &decompressed_size) || decompressed_size != info.size)
+				assert(false);
+		}
+
+		return block;
+	}
+
+	size_t find_block(uint64_t offset) const
+	{
+		return std::upper_bound(_blocks.begin(), _blocks.end(), offset, [](uint64_t offset, const block_info &info) { return offset < info.logical_offset; }) - _blocks.begin() - 1;
+	}
+
+	// Returns the index of the first block past the read-ahead window, must be called while holding '_mutex'
+	size_t read_ahead_limit() const
+	{
+		return std::max(_read_ahead_first + max_read_ahead_blocks, std::min(_read_ahead_end, _read_ahead_first + max_frame_read_ahead_blocks));
+	}
+
+	std::shared_ptr<const decompressed_block> fetch_block(size_t index)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		// Restart read-ahead when jumping to a block outside the current window
+		if (index < _read_ahead_first || index >= read_ahead_limit())
+		{
+			_read_ahead_generation++;
+			_read_ahead_blocks.clear();
+			_read_ahead_first = _read_ahead_next = index + 1;
+
+			lock.unlock();
+			_read_ahead_cv.notify_all();
+
+			return decompress_block(_decompressor, index);
+		}
+
+		_read_ahead_cv.wait(lock, [this, index]() { return !_read_ahead_blocks.empty() && _read_ahead_blocks.back()->index >= index; });
+
+		while (_read_ahead_blocks.front()->index < index)
+			_read_ahead_blocks.pop_front();
+
+		const std::shared_ptr<const decompressed_block> block = std::move(_read_ahead_blocks.front());
+		_read_ahead_blocks.pop_front();
+		_read_ahead_first = index + 1;
+
+		lock.unlock();
+		_read_ahead_cv.notify_all();
+
+		return block;
+	}
+
+	const uint8_t *block_data(uint64_t offset, size_t &available)
+	{
+		if (_current_block == nullptr || offset < _blocks[_current_block->index].logical_offset || offset >= _blocks[_current_block->index].logical_offset + _blocks[_current_block->index].size)
+		{
+			const size_t index = find_block(offset);
+
+			if (_current_block != nullptr)
+				_retained_blocks.push_back(std::move(_current_block));
+			_current_block = fetch_block(index);
+		}
+
+		const block_info &info = _blocks[_current_block->index];
+		const size_t block_offset = static_cast<size_t>(offset - info.logical_offset);
+
+		available = info.size - block_offset;
+		return _current_block->data + block_offset;
+	}
+
+	void copy_blocks(uint8_t *data, size_t size)
+	{
+		while (size != 0)
+		{
+			size_t available = 0;
+			const uint8_t *const src = block_data(_position, available);
+
+			const size_t chunk = std::min(size, available);
+			std::memcpy(data, src, chunk);
+
+			data += chunk;
+			size -= chunk;
+			_position += chunk;
+		}
 	}
+
+	void read_ahead_thread()
+	{
+		DECOMPRESSOR_HANDLE decompressor = nullptr;
+		CreateDecompressor(COMPRESS_ALGORITHM_XPRESS | COMPRESS_RAW, nullptr, &decompressor);
+
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		while (true)
+		{
+			_read_ahead_cv.wait(lock, [this]() { return _exit || (_read_ahead_next < _blocks.size() && _read_ahead_next < read_ahead_limit()); });
+
+			if (_exit)
+				break;
+
+			const size_t index = _read_ahead_next++;
+			const uint64_t generation = _read_ahead_generation;
+
+			lock.unlock();
+
+			std::shared_ptr<const decompressed_block> block = decompress_block(decompressor, index);
+
+			lock.lock();
+
+			if (generation == _read_ahead_generation)
+				_read_ahead_blocks.push_back(std::move(block));
+
+			_read_ahead_cv.notify_all();
+		}
+
+		CloseDecompressor(decompressor);
+	}
+
+	HANDLE _file = INVALID_HANDLE_VALUE;
+	HANDLE _mapping = nullptr;
+	const uint8_t *_data = nullptr;
+	uint64_t _size = 0;
+	uint64_t _position = 0;
+
+	std::vector<block_info> _blocks;
+	DECOMPRESSOR_HANDLE _decompressor = nullptr;
+	std::shared_ptr<const decompressed_block> _current_block;
+	std::vector<std::shared_ptr<const decompressed_block>> _retained_blocks;
+	std::vector<std::unique_ptr<uint8_t[]>> _spill_data;
+	std::unordered_map<uint64_t, std::unique_ptr<uint8_t[]>> _blob_cache;
+	std::vector<std::pair<uint64_t, size_t>> *_recorded_blobs = nullptr;
+	std::vector<uint64_t> _frame_offsets;
+	uint64_t _read_ahead_offset = 0;
+
+	std::mutex _mutex;
+	std::condition_variable _read_ahead_cv;
+	std::deque<std::shared_ptr<const decompressed_block>> _read_ahead_blocks;
+	size_t _read_ahead_first = 0;
+	size_t _read_ahead_next = 0;
+	size_t _read_ahead_end = 0;
+	uint64_t _read_ahead_generation = 0;
+	bool _exit = false;
+	std::thread _read_ahead_thread;
 };
 
 
-struct trace_data_write : trace_data
+struct trace_data_buffer
 {
-	explicit trace_data_write(const char *filename)
+	template <typename T>
+	void write(T &&value)
+	{
+		write(&value, sizeof(T));
+	}
+	void write(const void *data, size_t size)
 	{
-		fopen_s(&s, filename, "wb");
+		const auto p = static_cast<const uint8_t *>(data);
+		buffer.insert(buffer.end(), p, p + size);
+	}
+	void write(reshade::addon_event ev)
+	{
+		buffer.push_back(static_cast<trace_event_tag>(ev));
+	}
+
+	// Writes an unsigned integer as LEB128, seven bits per byte with the high bit set on all but the last byte
+	void write_varint(uint64_t value)
+	{
+		for (; value >= 0x80; value >>= 7)
+			buffer.push_back(static_cast<uint8_t>(value | 0x80));
+		buffer.push_back(static_cast<uint8_t>(value));
+	}
+
+	// Blobs are always stored inline, but their location is remembered so that they can still be deduplicated when the buffer is appended to a trace
+	void write_blob(const void *data, size_t size)
+	{
+		if (size < trace_blob_min_size)
+		{
+			write(data, size);
+			return;
+		}
+
+		blobs.push_back({ buffer.size(), size });
+		write(static_cast<uint64_t>(0));
+		write(data, size);
+	}
+
+	void clear() { buffer.clear(); blobs.clear(); }
+	bool empty() const { return buffer.empty(); }
+
+	std::vector<uint8_t> buffer;
+	std::vector<std::pair<size_t, size_t>> blobs;
+};
+
+struct trace_data_write
+{
+	// Size of the blocks producers copy into, must be a multiple of the sector size since the file is written unbuffered
+	static constexpr size_t block_size = 4 * 1024 * 1024;
+	static constexpr size_t sector_size = 4096;
+	// Maximum number of blocks queued up for the I/O thread before producers have to wait
+	static constexpr size_t max_pending_blocks = 8;
+	// Maximum number of blobs remembered to be referenced by later identical ones
+	static constexpr size_t max_blobs = 256 * 1024;
+
+	explicit trace_data_write(const char *filename, bool compress = false) : _compress(compress)
+	{
+		_file = CreateFileA(filename, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr);
 
 		assert(is_open());
+
+		// Compressed blocks end at arbitrary offsets, so everything goes through a staging buffer that is only written out in whole sectors
+		_output = static_cast<uint8_t *>(VirtualAlloc(nullptr, 2 * block_size + sector_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+
+		const uint32_t flags = compress ? trace_flag_compressed : 0;
+		write_file(&trace_magic, sizeof(trace_magic));
+		write_file(&trace_version, sizeof(trace_version));
+		write_file(&flags, sizeof(flags));
+		_position = trace_header_size;
+
+		_block = acquire_block();
+		_thread = std::thread(&trace_data_write::write_thread, this);
+
+		if (compress)
+			for (unsigned int i = 0; i < std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u); ++i)
+				_compress_threads.emplace_back(&trace_data_write::compress_thread, this);
+	}
+	~trace_data_write()
+	{
+		if (_block.data != nullptr)
+			submit_block();
+
+		{
+			const std::unique_lock<std::mutex> lock(_mutex);
+			_exit = true;
+		}
+		_pending_cv.notify_all();
+		_thread.join();
+
+		for (std::thread &thread : _compress_threads)
+			thread.join();
+
+		for (const block &block : _free_blocks)
+		{
+			VirtualFree(block.data, 0, MEM_RELEASE);
+			if (block.compressed_data != nullptr)
+				VirtualFree(block.compressed_data, 0, MEM_RELEASE);
+		}
+
+		if (is_open())
+		{
+			// Unbuffered writes always operate on whole sectors, so cut off the padding written with the last block
+			FILE_END_OF_FILE_INFO end_of_file_info;
+			end_of_file_info.EndOfFile.QuadPart = static_cast<LONGLONG>(_file_size);
+			SetFileInformationByHandle(_file, FileEndOfFileInfo, &end_of_file_info, sizeof(end_of_file_info));
+
+			CloseHandle(_file);
+		}
+
+		VirtualFree(_output, 0, MEM_RELEASE);
 	}
 
+	bool is_open() const { return _file != INVALID_HANDLE_VALUE; }
+
 	template <typename T>
 	void write(T &&value)
 	{
 		write(&value, sizeof(T));
 	}
+	void write(reshade::addon_event ev)
+	{
+		const auto tag = static_cast<trace_event_tag>(ev);
+		write(&tag, sizeof(tag));
+	}
+	void write_varint(uint64_t value)
+	{
+		uint8_t bytes[10];
+		size_t size = 0;
+		for (; value >= 0x80; value >>= 7)
+			bytes[size++] = static_cast<uint8_t>(value | 0x80);
+		bytes[size++] = static_cast<uint8_t>(value);
+		write(bytes, size);
+	}
 	void write(const void *data, size_t size)
 	{
-#if 0
-		auto p = static_cast<const unsigned char *>(data);
+		auto p = static_cast<const uint8_t *>(data);
+
+		_position += size;
 
 		while (size != 0)
 		{
-			const size_t chunk = std::min(size, size_t(512));
+			const size_t chunk = std::min(size, block_size - _block.size);
+
+			std::memcpy(_block.data + _block.size, p, chunk);
+			_block.size += chunk;
 
-			size_t written = fwrite(p, 1, chunk, s);
-			assert(written == chunk);
+			if (_block.size == block_size)
+			{
+				submit_block();
+				_block = acquire_block();
+			}
 
 			p += chunk;
 			size -= chunk;
 		}
-#else
-		size_t written = fwrite(data, 1, size, s);
+	}
+
+	// Writes data that is likely to repeat over the course of a trace (shader code, resource data), replacing repeated blobs with a reference to their first occurrence
+	void write_blob(const void *data, size_t size)
+	{
+		if (size < trace_blob_min_size)
+		{
+			write(data, size);
+			return;
+		}
+
+		// Blobs already written are gone from memory, so they cannot be compared with, instead two hashes with different seeds make up a 128-bit key that is practically unique
+		const blob_key key = { trace_blob_hash(data, size), trace_blob_hash(data, size, 0x2545f4914f6cdd1dull), size };
+		if (const auto it = _blobs.find(key); it != _blobs.end())
+		{
+			write(it->second);
+			return;
+		}
+
+		// Forget the oldest blobs once there are too many, which only means later copies of them are written inline again
+		if (_blob_order.size() >= max_blobs)
+		{
+			_blobs.erase(_blob_order.front());
+			_blob_order.pop_front();
+		}
+
+		write(static_cast<uint64_t>(0));
+		_blobs.emplace(key, tell());
+		_blob_order.push_back(key);
+		write(data, size);
+	}
+
+	void append(const trace_data_buffer &data)
+	{
+		size_t offset = 0;
+		for (const std::pair<size_t, size_t> &blob : data.blobs)
+		{
+			write(data.buffer.data() + offset, blob.first - offset);
+			write_blob(data.buffer.data() + blob.first + sizeof(uint64_t), blob.second);
+			offset = blob.first + sizeof(uint64_t) + blob.second;
+		}
+
+		write(data.buffer.data() + offset, data.buffer.size() - offset);
+	}
+
+	uint64_t tell() const { return _position; }
+
+	// Number of blocks waiting to be compressed or written to the file, producers have to wait once this reaches 'max_pending_blocks'
+	size_t pending_blocks()
+	{
+		const std::unique_lock<std::mutex> lock(_mutex);
+		return _pending_blocks.size();
+	}
+
+	void write_index(const trace_index &index)
+	{
+		const uint64_t index_offset = tell();
+
+		for (const std::vector<uint64_t> *offsets : { &index.frame_offsets, &index.state_offsets, &index.snapshot_offsets })
+		{
+			write(static_cast<uint64_t>(offsets->size()));
+			write(offsets->data(), offsets->size() * sizeof(uint64_t));
+		}
+
+		write(index_offset);
+		write(trace_index_magic);
+	}
+
+private:
+	struct block
+	{
+		uint8_t *data;
+		size_t size;
+		uint8_t *compressed_data;
+		size_t compressed_size;
+		enum { queued, compressing, ready } state;
+	};
+	struct blob_key
+	{
+		uint64_t hash[2];
+		size_t size;
+
+		bool operator==(const blob_key &other) const { return hash[0] == other.hash[0] && hash[1] == other.hash[1] && size == other.size; }
+	};
+	struct blob_key_hash
+	{
+		size_t operator()(const blob_key &key) const { return static_cast<size_t>(key.hash[0]); }
+	};
+
+	block acquire_block()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		if (_free_blocks.empty() && _num_blocks >= max_pending_blocks)
+			_free_cv.wait(lock, [this]() { return !_free_blocks.empty(); });
+
+		if (_free_blocks.empty())
+		{
+			_num_blocks++;
+
+			block block = {};
+			block.data = static_cast<uint8_t *>(VirtualAlloc(nullptr, block_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+			if (_compress)
+				block.compressed_data = static_cast<uint8_t *>(VirtualAlloc(nullptr, block_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+			return block;
+		}
+
+		const block block = _free_blocks.back();
+		_free_blocks.pop_back();
+		return block;
+	}
+	void submit_block()
+	{
+		_block.state = _compress ? block::queued : block::ready;
+
+		{
+			const std::unique_lock<std::mutex> lock(_mutex);
+			_pending_blocks.push_back(_block);
+		}
+		_pending_cv.notify_all();
+
+		_block = {};
+	}
+
+	void write_file(const void *data, size_t size)
+	{
+		assert(_output_size + size <= 2 * block_size);
+
+		std::memcpy(_output + _output_size, data, size);
+		_output_size += size;
+		_file_size += size;
+
+		if (_output_size >= block_size)
+			flush_file(false);
+	}
+	void flush_file(bool pad)
+	{
+		size_t size = _output_size & ~(sector_size - 1);
+
+		// Pad the last sector (the file is truncated to the actual size again on close)
+		if (pad && size != _output_size)
+		{
+			size += sector_size;
+			std::memset(_output + _output_size, 0, size - _output_size);
+		}
+
+		DWORD written = 0;
+		if (is_open())
+			WriteFile(_file, _output, static_cast<DWORD>(size), &written, nullptr);
 		assert(written == size);
-#endif
+
+		_output_size = size < _output_size ? _output_size - size : 0;
+		std::memmove(_output, _output + size, _output_size);
+	}
+
+	void write_thread()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		while (true)
+		{
+			_pending_cv.wait(lock, [this]() { return (!_pending_blocks.empty() && _pending_blocks.front().state == block::ready) || (_pending_blocks.empty() && _exit); });
+
+			if (_pending_blocks.empty())
+				break;
+
+			block block = _pending_blocks.front();
+			_pending_blocks.pop_front();
+
+			lock.unlock();
+
+			if (!_compress)
+			{
+				write_file(block.data, block.size);
+			}
+			else if (block.size != 0)
+			{
+				// Blocks that did not compress well are stored as is, which is indicated by the stored size matching the uncompressed size
+				const uint32_t header[2] = { static_cast<uint32_t>(block.compressed_size != 0 ? block.compressed_size : block.size), static_cast<uint32_t>(block.size) };
+				write_file(header, sizeof(header));
+				write_file(block.compressed_size != 0 ? block.compressed_data : block.data, header[0]);
+			}
+
+			block.size = 0;
+
+			lock.lock();
+
+			_free_blocks.push_back(block);
+			_free_cv.notify_one();
+		}
+
+		lock.unlock();
+
+		flush_file(true);
 	}
+
+	void compress_thread()
+	{
+		COMPRESSOR_HANDLE compressor = nullptr;
+		CreateCompressor(COMPRESS_ALGORITHM_XPRESS | COMPRESS_RAW, nullptr, &compressor);
+
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		while (true)
+		{
+			auto it = _pending_blocks.end();
+			_pending_cv.wait(lock, [this, &it]() {
+				it = std::find_if(_pending_blocks.begin(), _pending_blocks.end(), [](const block &block) { return block.state == block::queued; });
+				return it != _pending_blocks.end() || _exit;
+			});
+
+			if (it == _pending_blocks.end())
+				break;
+
+			// Elements of a deque are not moved when others are added or removed at either end, and this one is not removed before it is ready
+			block &job = *it;
+			job.state = block::compressing;
+
+			lock.unlock();
+
+			SIZE_T compressed_size = 0;
+			if (compressor == nullptr || !Compress(compressor, job.data, job.size, job.compressed_data, block_size, &compressed_size) || compressed_size >= job.size)
+				compressed_size = 0;
+
+			lock.lock();
+
+			job.compressed_size = static_cast<size_t>(compressed_size);
+			job.state = block::ready;
+
+			_pending_cv.notify_all();
+		}
+
+		if (compressor != nullptr)
+			CloseCompressor(compressor);
+	}
+
+	HANDLE _file = INVALID_HANDLE_VALUE;
+	uint64_t _position = 0;
+	uint64_t _file_size = 0;
+	uint8_t *_output = nullptr;
+	size_t _output_size = 0;
+	const bool _compress;
+	block _block = {};
+	size_t _num_blocks = 0;
+	std::vector<block> _free_blocks;
+	std::deque<block> _pending_blocks;
+	std::mutex _mutex;
+	std::condition_variable _free_cv;
+	std::condition_variable _pending_cv;
+	bool _exit = false;
+	std::thread _thread;
+	std::vector<std::thread> _compress_threads;
+	// Offset of the first occurrence of each blob, in the order they were written
+	std::unordered_map<blob_key, uint64_t, blob_key_hash> _blobs;
+	std::deque<blob_key> _blob_order;
 };
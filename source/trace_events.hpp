@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2024 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <reshade.hpp>
+#include <type_traits>
+#include "trace_data.hpp"
+
+// Number of event types, for tables indexed by them ('addon_event::max' is only declared with 'RESHADE_ADDON' defined, which all projects do)
+constexpr size_t trace_event_type_count = static_cast<size_t>(reshade::addon_event::max);
+
+// Returns the name of an event type, as used in statistics and logs
+inline const char *trace_event_name(reshade::addon_event ev)
+{
+#define TRACE_EVENT_NAME(name) case reshade::addon_event::name: return #name
+	switch (ev)
+	{
+		TRACE_EVENT_NAME(init_device);
+		TRACE_EVENT_NAME(destroy_device);
+		TRACE_EVENT_NAME(init_command_list);
+		TRACE_EVENT_NAME(destroy_command_list);
+		TRACE_EVENT_NAME(init_command_queue);
+		TRACE_EVENT_NAME(destroy_command_queue);
+		TRACE_EVENT_NAME(init_swapchain);
+		TRACE_EVENT_NAME(destroy_swapchain);
+		TRACE_EVENT_NAME(init_sampler);
+		TRACE_EVENT_NAME(destroy_sampler);
+		TRACE_EVENT_NAME(init_resource);
+		TRACE_EVENT_NAME(destroy_resource);
+		TRACE_EVENT_NAME(init_resource_view);
+		TRACE_EVENT_NAME(destroy_resource_view);
+		TRACE_EVENT_NAME(map_buffer_region);
+		TRACE_EVENT_NAME(unmap_buffer_region);
+		TRACE_EVENT_NAME(map_texture_region);
+		TRACE_EVENT_NAME(unmap_texture_region);
+		TRACE_EVENT_NAME(update_buffer_region);
+		TRACE_EVENT_NAME(update_texture_region);
+		TRACE_EVENT_NAME(init_pipeline);
+		TRACE_EVENT_NAME(destroy_pipeline);
+		TRACE_EVENT_NAME(init_pipeline_layout);
+		TRACE_EVENT_NAME(destroy_pipeline_layout);
+		TRACE_EVENT_NAME(copy_descriptor_tables);
+		TRACE_EVENT_NAME(update_descriptor_tables);
+		TRACE_EVENT_NAME(init_query_heap);
+		TRACE_EVENT_NAME(destroy_query_heap);
+		TRACE_EVENT_NAME(get_query_heap_results);
+		TRACE_EVENT_NAME(barrier);
+		TRACE_EVENT_NAME(begin_render_pass);
+		TRACE_EVENT_NAME(end_render_pass);
+		TRACE_EVENT_NAME(bind_render_targets_and_depth_stencil);
+		TRACE_EVENT_NAME(bind_pipeline);
+		TRACE_EVENT_NAME(bind_pipeline_states);
+		TRACE_EVENT_NAME(bind_viewports);
+		TRACE_EVENT_NAME(bind_scissor_rects);
+		TRACE_EVENT_NAME(push_constants);
+		TRACE_EVENT_NAME(push_descriptors);
+		TRACE_EVENT_NAME(bind_descriptor_tables);
+		TRACE_EVENT_NAME(bind_index_buffer);
+		TRACE_EVENT_NAME(bind_vertex_buffers);
+		TRACE_EVENT_NAME(bind_stream_output_buffers);
+		TRACE_EVENT_NAME(draw);
+		TRACE_EVENT_NAME(draw_indexed);
+		TRACE_EVENT_NAME(dispatch);
+		TRACE_EVENT_NAME(draw_or_dispatch_indirect);
+		TRACE_EVENT_NAME(copy_resource);
+		TRACE_EVENT_NAME(copy_buffer_region);
+		TRACE_EVENT_NAME(copy_buffer_to_texture);
+		TRACE_EVENT_NAME(copy_texture_region);
+		TRACE_EVENT_NAME(copy_texture_to_buffer);
+		TRACE_EVENT_NAME(resolve_texture_region);
+		TRACE_EVENT_NAME(clear_depth_stencil_view);
+		TRACE_EVENT_NAME(clear_render_target_view);
+		TRACE_EVENT_NAME(clear_unordered_access_view_uint);
+		TRACE_EVENT_NAME(clear_unordered_access_view_float);
+		TRACE_EVENT_NAME(generate_mipmaps);
+		TRACE_EVENT_NAME(begin_query);
+		TRACE_EVENT_NAME(end_query);
+		TRACE_EVENT_NAME(copy_query_heap_results);
+		TRACE_EVENT_NAME(reset_command_list);
+		TRACE_EVENT_NAME(close_command_list);
+		TRACE_EVENT_NAME(execute_command_list);
+		TRACE_EVENT_NAME(execute_secondary_command_list);
+		TRACE_EVENT_NAME(present);
+		TRACE_EVENT_NAME(reshade_present);
+	}
+#undef TRACE_EVENT_NAME
+
+	return "unknown";
+}
+
+// Payloads of events that always have the same size, which capture and playback both use, so that they are written with a single copy and read back with a single load
+// Members are packed and in the order of the event arguments, for events with variable data only the fixed part at the start is described, which that data follows
+template <reshade::addon_event ev>
+struct trace_event_payload;
+
+#pragma pack(push, 1)
+
+template <>
+struct trace_event_payload<reshade::addon_event::map_buffer_region>
+{
+	reshade::api::resource buffer;
+	uint64_t offset;
+	uint64_t size;
+	reshade::api::map_access access;
+};
+
+// Followed by the encoding and data of the mapping, unless it was only mapped for reading
+template <>
+struct trace_event_payload<reshade::addon_event::unmap_buffer_region>
+{
+	reshade::api::resource buffer;
+	uint64_t offset;
+	uint64_t size;
+	reshade::api::map_access access;
+};
+// Followed by the data as a blob
+template <>
+struct trace_event_payload<reshade::addon_event::update_buffer_region>
+{
+	reshade::api::resource buffer;
+	uint64_t offset;
+	uint64_t size;
+};
+// Followed by the box if there is one, and then the texture data
+template <>
+struct trace_event_payload<reshade::addon_event::update_texture_region>
+{
+	reshade::api::resource texture;
+	uint32_t subresource;
+	bool has_box;
+};
+
+template <>
+struct trace_event_payload<reshade::addon_event::copy_resource>
+{
+	reshade::api::resource src;
+	reshade::api::resource dst;
+};
+template <>
+struct trace_event_payload<reshade::addon_event::copy_buffer_region>
+{
+	reshade::api::resource src;
+	uint64_t src_offset;
+	reshade::api::resource dst;
+	uint64_t dst_offset;
+	uint64_t size;
+};
+
+template <>
+struct trace_event_payload<reshade::addon_event::clear_render_target_view>
+{
+	reshade::api::resource_view rtv;
+	float color[4];
+};
+template <>
+struct trace_event_payload<reshade::addon_event::clear_unordered_access_view_uint>
+{
+	reshade::api::resource_view uav;
+	uint32_t values[4];
+};
+template <>
+struct trace_event_payload<reshade::addon_event::clear_unordered_access_view_float>
+{
+	reshade::api::resource_view uav;
+	float values[4];
+};
+
+template <>
+struct trace_event_payload<reshade::addon_event::generate_mipmaps>
+{
+	reshade::api::resource_view srv;
+};
+
+template <>
+struct trace_event_payload<reshade::addon_event::execute_command_list>
+{
+	uint64_t queue_id;
+	uint64_t cmd_list_id;
+};
+
+// Event type followed by its payload
+template <reshade::addon_event ev>
+struct trace_event_record
+{
+	trace_event_tag type;
+	trace_event_payload<ev> payload;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(trace_event_payload<reshade::addon_event::map_buffer_region>) == 28);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::unmap_buffer_region>) == 28);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::update_buffer_region>) == 24);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::update_texture_region>) == 13);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::copy_resource>) == 16);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::copy_buffer_region>) == 40);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::clear_render_target_view>) == 24);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::clear_unordered_access_view_uint>) == 24);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::clear_unordered_access_view_float>) == 24);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::generate_mipmaps>) == 8);
+static_assert(sizeof(trace_event_payload<reshade::addon_event::execute_command_list>) == 16);
+
+// Creates the record of an event, so that the event type and payload are written together
+template <reshade::addon_event ev>
+inline trace_event_record<ev> make_trace_event(const trace_event_payload<ev> &payload)
+{
+	return { static_cast<trace_event_tag>(ev), payload };
+}
+
+// Payloads of command events, which are recorded many times per frame, are instead written as LEB128 varints (signed fields zigzag encoded and handles as their object ID)
+// Each lists its fields once in 'fields', which both 'write_compact' and 'read_compact' go through
+
+template <>
+struct trace_event_payload<reshade::addon_event::bind_pipeline>
+{
+	reshade::api::pipeline_stage stages;
+	reshade::api::pipeline pipeline;
+	template <typename F>
+	void fields(F &&f) { f(stages); f(pipeline); }
+};
+template <>
+struct trace_event_payload<reshade::addon_event::bind_index_buffer>
+{
+	reshade::api::resource buffer;
+	uint64_t offset;
+	uint32_t index_size;
+	template <typename F>
+	void fields(F &&f) { f(buffer); f(offset); f(index_size); }
+};
+
+template <>
+struct trace_event_payload<reshade::addon_event::draw>
+{
+	uint32_t vertex_count;
+	uint32_t instance_count;
+	uint32_t first_vertex;
+	uint32_t first_instance;
+	template <typename F>
+	void fields(F &&f) { f(vertex_count); f(instance_count); f(first_vertex); f(first_instance); }
+};
+template <>
+struct trace_event_payload<reshade::addon_event::draw_indexed>
+{
+	uint32_t index_count;
+	uint32_t instance_count;
+	uint32_t first_index;
+	int32_t vertex_offset;
+	uint32_t first_instance;
+	template <typename F>
+	void fields(F &&f) { f(index_count); f(instance_count); f(first_index); f(vertex_offset); f(first_instance); }
+};
+template <>
+struct trace_event_payload<reshade::addon_event::dispatch>
+{
+	uint32_t group_count_x;
+	uint32_t group_count_y;
+	uint32_t group_count_z;
+	template <typename F>
+	void fields(F &&f) { f(group_count_x); f(group_count_y); f(group_count_z); }
+};
+template <>
+struct trace_event_payload<reshade::addon_event::draw_or_dispatch_indirect>
+{
+	reshade::api::indirect_command type;
+	reshade::api::resource buffer;
+	uint64_t offset;
+	uint32_t draw_count;
+	uint32_t stride;
+	template <typename F>
+	void fields(F &&f) { f(type); f(buffer); f(offset); f(draw_count); f(stride); }
+};
+
+// Element of the 'bind_vertex_buffers' event, which is followed by one of these per buffer
+struct trace_vertex_buffer_binding
+{
+	reshade::api::resource buffer;
+	uint64_t offset;
+	uint32_t stride;
+	template <typename F>
+	void fields(F &&f) { f(buffer); f(offset); f(stride); }
+};
+// Element of the 'barrier' event, which is followed by one of these per resource
+struct trace_resource_barrier
+{
+	reshade::api::resource resource;
+	reshade::api::resource_usage old_state;
+	reshade::api::resource_usage new_state;
+	template <typename F>
+	void fields(F &&f) { f(resource); f(old_state); f(new_state); }
+};
+
+template <typename T>
+inline uint64_t trace_varint_encode(T value)
+{
+	if constexpr (std::is_enum_v<T>)
+		return trace_varint_encode(static_cast<std::underlying_type_t<T>>(value));
+	else if constexpr (std::is_signed_v<T>)
+		return trace_zigzag_encode(value);
+	else if constexpr (std::is_unsigned_v<T>)
+		return value;
+	else
+		return value.handle;
+}
+template <typename T>
+inline T trace_varint_decode(uint64_t value)
+{
+	if constexpr (std::is_enum_v<T>)
+		return static_cast<T>(trace_varint_decode<std::underlying_type_t<T>>(value));
+	else if constexpr (std::is_signed_v<T>)
+		return static_cast<T>(trace_zigzag_decode(value));
+	else if constexpr (std::is_unsigned_v<T>)
+		return static_cast<T>(value);
+	else
+		return T { value };
+}
+
+template <typename W, typename T>
+inline void write_compact(W &writer, T value)
+{
+	value.fields([&writer](const auto &field) { writer.write_varint(trace_varint_encode(field)); });
+}
+template <typename T>
+inline T read_compact(trace_data_read &trace_data)
+{
+	T value;
+	value.fields([&trace_data](auto &field) { field = trace_varint_decode<std::remove_reference_t<decltype(field)>>(trace_data.read_varint()); });
+	return value;
+}
+
+// Writes the event type followed by its compact payload
+template <reshade::addon_event ev, typename W>
+inline void write_compact_event(W &writer, const trace_event_payload<ev> &payload)
+{
+	writer.write(ev);
+	write_compact(writer, payload);
+}
@@ -0,0 +1,559 @@
+/*
+ * Copyright (C) 2024 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "null_device.hpp"
+#include "trace_events.hpp"
+#include <string>
+#include <cstdlib>
+#include <cinttypes>
+#include <unordered_set>
+
+using namespace reshade::api;
+
+extern void play_event_at(trace_data_read &trace_data, uint64_t offset, command_list *cmd_list, command_queue *queue, effect_runtime *runtime);
+extern void set_object_callback(void(*callback)(trace_object_type type, uint64_t id, void *user_data), void *user_data);
+extern const std::vector<uint8_t> &get_buffer_contents(uint64_t id);
+
+constexpr size_t object_type_count = 6;
+
+static uint64_t object_key(trace_object_type type, uint64_t id)
+{
+	return (static_cast<uint64_t>(type) << 56) | id;
+}
+
+// Location of an event in the source trace, along with the blobs it contains
+struct recorded_event
+{
+	uint64_t begin = 0;
+	uint64_t end = 0;
+	std::vector<std::pair<uint64_t, size_t>> blobs;
+};
+
+struct live_object
+{
+	recorded_event init;
+	// Objects of other types that were referenced when this one was created (e.g. the resource of a view)
+	std::vector<uint64_t> dependencies;
+};
+
+struct texture_upload
+{
+	uint32_t subresource;
+	recorded_event event;
+};
+
+struct buffer_contents
+{
+	std::vector<uint8_t> data;
+	bool mapped = false;
+	bool updated = false;
+};
+
+// Device that hands out the trace IDs as handles, and keeps track of the contents of buffers and which texture subresources are updated
+// Handles are the IDs of objects in the trace, which is the last one of that type the playback code read before creating it
+class trim_device : public null_device
+{
+public:
+	explicit trim_device(device_api api) : null_device(api) {}
+
+	bool create_resource(const resource_desc &desc, const subresource_data *initial_data, resource_usage initial_state, resource *out_resource, void **shared_handle = nullptr) final
+	{
+		if (track_uploads && desc.type == resource_type::buffer)
+		{
+			buffer_contents &contents = buffers[last_ids[static_cast<size_t>(trace_object_type::resource)]];
+			contents = {};
+			contents.data.resize(static_cast<size_t>(desc.buffer.size));
+			if (initial_data != nullptr && initial_data->data != nullptr)
+				std::memcpy(contents.data.data(), initial_data->data, contents.data.size());
+		}
+
+		return null_device::create_resource(desc, initial_data, initial_state, out_resource, shared_handle);
+	}
+	void destroy_resource(resource resource) final
+	{
+		if (track_uploads)
+			buffers.erase(resource.handle);
+	}
+
+	bool map_buffer_region(resource resource, uint64_t offset, uint64_t size, map_access access, void **out_data) final
+	{
+		buffer_contents *const contents = find_buffer(resource, offset, size);
+		if (contents == nullptr)
+			return null_device::map_buffer_region(resource, offset, size, access, out_data);
+
+		contents->mapped = true;
+		*out_data = contents->data.data() + offset;
+		return true;
+	}
+	bool map_texture_region(resource resource, uint32_t subresource, const subresource_box *box, map_access access, subresource_data *out_data) final
+	{
+		last_texture_upload = { resource.handle, subresource, box == nullptr };
+		return null_device::map_texture_region(resource, subresource, box, access, out_data);
+	}
+
+	void update_buffer_region(const void *data, resource resource, uint64_t offset, uint64_t size) final
+	{
+		buffer_contents *const contents = find_buffer(resource, offset, size);
+		if (contents == nullptr)
+			return;
+
+		contents->updated = true;
+		std::memcpy(contents->data.data() + offset, data, static_cast<size_t>(size));
+	}
+	void update_texture_region(const subresource_data &, resource resource, uint32_t subresource, const subresource_box *box = nullptr) final
+	{
+		last_texture_upload = { resource.handle, subresource, box == nullptr };
+	}
+
+	struct
+	{
+		uint64_t resource;
+		uint32_t subresource;
+		bool full;
+	} last_texture_upload = {};
+
+	uint64_t last_ids[object_type_count] = {};
+	// Buffer contents are only tracked up to the first frame that is kept, everything after that is written as is
+	bool track_uploads = true;
+	std::unordered_map<uint64_t, buffer_contents> buffers;
+
+protected:
+	uint64_t create_handle(trace_object_type type) final { return last_ids[static_cast<size_t>(type)]; }
+
+private:
+	buffer_contents *find_buffer(resource resource, uint64_t offset, uint64_t size)
+	{
+		if (!track_uploads)
+			return nullptr;
+
+		const auto it = buffers.find(resource.handle);
+		if (it == buffers.end())
+			return nullptr;
+
+		if (it->second.data.size() < offset + size)
+			it->second.data.resize(static_cast<size_t>(offset + size));
+		return &it->second;
+	}
+};
+
+struct trim_state
+{
+	explicit trim_state(device_api api) : device(api), cmd_list(&device), queue(&device, &cmd_list) {}
+
+	trim_device device;
+	null_command_list cmd_list;
+	null_command_queue queue;
+
+	// Objects referenced by the event that is currently played back, in the order they were read
+	std::vector<std::pair<trace_object_type, uint64_t>> references;
+
+	// Objects alive at the start of the first kept frame, with the event that created them
+	std::unordered_map<uint64_t, live_object> live_objects;
+	// Swapchains alive at the start of the first kept frame, keyed by the ID of their first back buffer
+	std::unordered_map<uint64_t, recorded_event> swapchains;
+	// Uploads that make up the last known contents of each texture, keyed by the texture ID
+	std::unordered_map<uint64_t, std::vector<texture_upload>> texture_uploads;
+	// Buffers that delta encoded mappings in the kept frames may apply to
+	std::unordered_set<uint64_t> delta_encoded_buffers;
+};
+
+static void on_object(trace_object_type type, uint64_t id, void *user_data)
+{
+	trim_state &state = *static_cast<trim_state *>(user_data);
+
+	state.device.last_ids[static_cast<size_t>(type)] = id;
+	state.references.push_back({ type, id });
+}
+
+// Plays back a single event and remembers where it is and which objects it referenced
+static reshade::addon_event play_recorded_event(trim_state &state, trace_data_read &trace_data, uint64_t offset, recorded_event &event)
+{
+	trace_data.seek(offset);
+	const auto ev = trace_data.read_event();
+
+	state.references.clear();
+	state.device.last_texture_upload = {};
+
+	event = { offset, offset };
+	trace_data.record_blobs(&event.blobs);
+	play_event_at(trace_data, offset, &state.cmd_list, &state.queue, nullptr);
+	trace_data.record_blobs(nullptr);
+	event.end = trace_data.tell();
+
+	return ev;
+}
+
+// Returns the type of object that the event creates or destroys, or false if it is not one of those
+static bool event_object_type(reshade::addon_event ev, trace_object_type &type, bool &init)
+{
+	switch (ev)
+	{
+	case reshade::addon_event::init_command_queue:
+	case reshade::addon_event::destroy_command_queue:
+		type = trace_object_type::command_queue;
+		init = ev == reshade::addon_event::init_command_queue;
+		return true;
+	case reshade::addon_event::init_sampler:
+	case reshade::addon_event::destroy_sampler:
+		type = trace_object_type::sampler;
+		init = ev == reshade::addon_event::init_sampler;
+		return true;
+	case reshade::addon_event::init_resource:
+	case reshade::addon_event::destroy_resource:
+		type = trace_object_type::resource;
+		init = ev == reshade::addon_event::init_resource;
+		return true;
+	case reshade::addon_event::init_resource_view:
+	case reshade::addon_event::destroy_resource_view:
+		type = trace_object_type::resource_view;
+		init = ev == reshade::addon_event::init_resource_view;
+		return true;
+	case reshade::addon_event::init_pipeline_layout:
+	case reshade::addon_event::destroy_pipeline_layout:
+		type = trace_object_type::pipeline_layout;
+		init = ev == reshade::addon_event::init_pipeline_layout;
+		return true;
+	case reshade::addon_event::init_pipeline:
+	case reshade::addon_event::destroy_pipeline:
+		type = trace_object_type::pipeline;
+		init = ev == reshade::addon_event::init_pipeline;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Object an event creates or destroys is the last one of that type it references
+static uint64_t find_event_object(const trim_state &state, trace_object_type type)
+{
+	for (auto it = state.references.rbegin(); it != state.references.rend(); ++it)
+		if (it->first == type)
+			return it->second;
+	return 0;
+}
+
+// Applies a device-level event before the first kept frame to the state that is written to the new trace
+static void record_state_event(trim_state &state, trace_data_read &trace_data, uint64_t offset)
+{
+	recorded_event event;
+	const reshade::addon_event ev = play_recorded_event(state, trace_data, offset, event);
+
+	trace_object_type type; bool init;
+	if (event_object_type(ev, type, init))
+	{
+		const uint64_t id = find_event_object(state, type);
+		const uint64_t key = object_key(type, id);
+
+		if (type == trace_object_type::resource)
+		{
+			state.texture_uploads.erase(id);
+			state.delta_encoded_buffers.erase(id);
+		}
+
+		if (!init)
+		{
+			state.live_objects.erase(key);
+			return;
+		}
+
+		live_object &object = state.live_objects[key];
+		object.init = std::move(event);
+		object.dependencies.clear();
+		for (const std::pair<trace_object_type, uint64_t> &reference : state.references)
+			if (reference.first != type && reference.second != 0)
+				object.dependencies.push_back(object_key(reference.first, reference.second));
+		return;
+	}
+
+	switch (ev)
+	{
+	case reshade::addon_event::init_swapchain:
+		if (!state.references.empty())
+			state.swapchains[state.references[0].second] = std::move(event);
+		break;
+	case reshade::addon_event::destroy_swapchain:
+		if (!state.references.empty())
+			state.swapchains.erase(state.references[0].second);
+		break;
+	case reshade::addon_event::unmap_texture_region:
+	case reshade::addon_event::update_texture_region:
+		if (const auto &upload = state.device.last_texture_upload; upload.resource != 0)
+		{
+			std::vector<texture_upload> &uploads = state.texture_uploads[upload.resource];
+			// Earlier uploads to a subresource no longer matter once it was replaced as a whole
+			if (upload.full)
+				uploads.erase(std::remove_if(uploads.begin(), uploads.end(), [&upload](const texture_upload &previous) { return previous.subresource == upload.subresource; }), uploads.end());
+			uploads.push_back({ upload.subresource, std::move(event) });
+		}
+		break;
+	case reshade::addon_event::unmap_buffer_region:
+		if (const uint64_t id = find_event_object(state, trace_object_type::resource); id != 0 && !get_buffer_contents(id).empty())
+			state.delta_encoded_buffers.insert(id);
+		break;
+	default:
+		// Buffer uploads are applied to the tracked contents instead, and descriptor tables are not recreated during playback, so everything else can be dropped
+		break;
+	}
+}
+
+// Copies an event into a buffer, with blobs written inline again, since the ones they reference may not be part of the new trace
+static void copy_event(trace_data_read &trace_data, const recorded_event &event, trace_data_buffer &buffer)
+{
+	uint64_t position = event.begin;
+
+	for (const std::pair<uint64_t, size_t> &blob : event.blobs)
+	{
+		trace_data.seek(position);
+		buffer.write(trace_data.read_data(static_cast<size_t>(blob.first - position)), static_cast<size_t>(blob.first - position));
+		buffer.write_blob(trace_data.read_blob(blob.second), blob.second);
+		position = trace_data.tell();
+	}
+
+	trace_data.seek(position);
+	buffer.write(trace_data.read_data(static_cast<size_t>(event.end - position)), static_cast<size_t>(event.end - position));
+
+	trace_data.release_data();
+}
+
+struct trimmed_event
+{
+	trace_data_buffer data;
+	bool state_event;
+	bool frame_start;
+};
+
+int main(int argc, char *argv[])
+{
+	const char *trace_path = "api_trace_log.bin";
+	std::string output_path;
+	uint64_t first_frame = 0;
+	uint64_t frame_count = 1;
+	bool compress = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--frame") == 0 && i + 1 < argc)
+			first_frame = _strtoui64(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			frame_count = _strtoui64(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			output_path = argv[++i];
+		else if (strcmp(argv[i], "--compress") == 0)
+			compress = true;
+		else
+			trace_path = argv[i];
+	}
+
+	if (output_path.empty())
+	{
+		output_path = trace_path;
+		if (const size_t extension = output_path.rfind(".bin"); extension != std::string::npos && extension == output_path.size() - 4)
+			output_path.erase(extension);
+		output_path += "_trimmed.bin";
+	}
+
+	trace_data_read trace_data(trace_path);
+	if (!trace_data.is_open())
+	{
+		fprintf(stderr, "Failed to open trace file '%s'.\n", trace_path);
+		return 2;
+	}
+
+	const auto graphics_api = trace_data.read<device_api>();
+
+	// The index is needed to find the frames and the device-level events before them
+	trace_index index;
+	if (!trace_data.read_index(index) || index.frame_offsets.empty())
+	{
+		fprintf(stderr, "Trace file '%s' has no frame index.\n", trace_path);
+		return 2;
+	}
+
+	// The last frame offset points past the final present, so it does not start a complete frame
+	const uint64_t trace_frame_count = index.frame_offsets.size() - 1;
+	if (first_frame >= trace_frame_count || frame_count == 0)
+	{
+		fprintf(stderr, "Frame %" PRIu64 " is out of range, the trace has %" PRIu64 " frames.\n", first_frame, trace_frame_count);
+		return 2;
+	}
+	frame_count = std::min(frame_count, trace_frame_count - first_frame);
+
+	trim_state state(graphics_api);
+	set_object_callback(on_object, &state);
+
+	// Replay the device-level events before the first kept frame, in the same order as seeking there during playback would
+	const uint64_t begin_offset = index.frame_offsets[static_cast<size_t>(first_frame)];
+	const uint64_t end_offset = index.frame_offsets[static_cast<size_t>(first_frame + frame_count)];
+
+	bool snapshot_restored = false;
+	for (const uint64_t offset : index.state_offsets)
+	{
+		if (offset >= begin_offset)
+			break;
+		if (!snapshot_restored && offset >= index.frame_offsets[0])
+		{
+			for (const uint64_t snapshot_offset : index.snapshot_offsets)
+				record_state_event(state, trace_data, snapshot_offset + sizeof(trace_event_tag));
+			snapshot_restored = true;
+		}
+
+		record_state_event(state, trace_data, offset);
+	}
+	if (!snapshot_restored)
+		for (const uint64_t snapshot_offset : index.snapshot_offsets)
+			record_state_event(state, trace_data, snapshot_offset + sizeof(trace_event_tag));
+
+	state.device.track_uploads = false;
+
+	// Decode the kept frames to find out which of the objects alive before them they reference
+	std::vector<trimmed_event> events;
+	std::unordered_set<uint64_t> referenced_objects;
+	std::unordered_set<uint64_t> created_objects;
+
+	bool frame_start = false;
+	for (uint64_t offset = begin_offset, frame = first_frame; offset < end_offset;)
+	{
+		if (offset == index.frame_offsets[static_cast<size_t>(frame)])
+		{
+			frame_start = true;
+			frame++;
+		}
+
+		recorded_event event;
+		const reshade::addon_event ev = play_recorded_event(state, trace_data, offset, event);
+		offset = event.end;
+
+		// Resource contents of the snapshot were already applied before the first kept frame
+		if (static_cast<uint32_t>(ev) == trace_snapshot_data_event)
+			continue;
+
+		trace_object_type type; bool init;
+		const bool creates_object = event_object_type(ev, type, init) && init;
+		const uint64_t created_id = creates_object ? find_event_object(state, type) : 0;
+
+		for (const std::pair<trace_object_type, uint64_t> &reference : state.references)
+		{
+			// Back buffers are created along with the swapchain
+			if (ev == reshade::addon_event::init_swapchain)
+			{
+				created_objects.insert(object_key(reference.first, reference.second));
+				continue;
+			}
+			if (reference.second == 0 || (creates_object && reference.first == type && reference.second == created_id))
+				continue;
+
+			const uint64_t key = object_key(reference.first, reference.second);
+			if (created_objects.find(key) == created_objects.end())
+				referenced_objects.insert(key);
+		}
+
+		if (creates_object)
+			created_objects.insert(object_key(type, created_id));
+
+		trimmed_event &trimmed = events.emplace_back();
+		trimmed.state_event = std::binary_search(index.state_offsets.begin(), index.state_offsets.end(), event.begin);
+		trimmed.frame_start = frame_start;
+		frame_start = false;
+		copy_event(trace_data, event, trimmed.data);
+	}
+
+	set_object_callback(nullptr, nullptr);
+
+	// Objects the referenced ones were created from have to be kept as well
+	for (std::vector<uint64_t> pending(referenced_objects.begin(), referenced_objects.end()); !pending.empty();)
+	{
+		const uint64_t key = pending.back();
+		pending.pop_back();
+
+		if (const auto it = state.live_objects.find(key); it != state.live_objects.end())
+			for (const uint64_t dependency : it->second.dependencies)
+				if (referenced_objects.insert(dependency).second)
+					pending.push_back(dependency);
+	}
+
+	// Keep the creation order of the source trace, which already has objects created after what they depend on
+	std::vector<const recorded_event *> init_events;
+	for (const auto &swapchain : state.swapchains)
+		init_events.push_back(&swapchain.second);
+	for (const auto &object : state.live_objects)
+		if (referenced_objects.find(object.first) != referenced_objects.end())
+			init_events.push_back(&object.second.init);
+	std::sort(init_events.begin(), init_events.end(), [](const recorded_event *a, const recorded_event *b) { return a->begin < b->begin; });
+
+	std::vector<const recorded_event *> upload_events;
+	for (const auto &uploads : state.texture_uploads)
+		if (referenced_objects.find(object_key(trace_object_type::resource, uploads.first)) != referenced_objects.end())
+			for (const texture_upload &upload : uploads.second)
+				upload_events.push_back(&upload.event);
+	std::sort(upload_events.begin(), upload_events.end(), [](const recorded_event *a, const recorded_event *b) { return a->begin < b->begin; });
+
+	trace_data_write output(output_path.c_str(), compress);
+	if (!output.is_open())
+	{
+		fprintf(stderr, "Failed to create trace file '%s'.\n", output_path.c_str());
+		return 1;
+	}
+
+	trace_index output_index;
+	trace_data_buffer buffer;
+
+	output.write(graphics_api);
+
+	for (const recorded_event *event : init_events)
+	{
+		buffer.clear();
+		copy_event(trace_data, *event, buffer);
+		output_index.state_offsets.push_back(output.tell());
+		output.append(buffer);
+	}
+
+	// Write the last known contents of kept buffers that changed since they were created
+	for (const auto &contents : state.device.buffers)
+	{
+		const uint64_t id = contents.first;
+		if (referenced_objects.find(object_key(trace_object_type::resource, id)) == referenced_objects.end() || !(contents.second.mapped || contents.second.updated))
+			continue;
+
+		const std::vector<uint8_t> &data = contents.second.data;
+
+		output_index.state_offsets.push_back(output.tell());
+		// Buffers that were mapped are written through a mapping again, which also restores what delta encoded mappings in the kept frames apply to
+		if (contents.second.mapped)
+		{
+			output.write(make_trace_event<reshade::addon_event::unmap_buffer_region>({ resource { id }, 0, data.size(), map_access::write_discard }));
+			output.write(state.delta_encoded_buffers.find(id) != state.delta_encoded_buffers.end() ? trace_buffer_encoding::raw_and_keep : trace_buffer_encoding::raw);
+			output.write_blob(data.data(), data.size());
+		}
+		else
+		{
+			output.write(make_trace_event<reshade::addon_event::update_buffer_region>({ resource { id }, 0, data.size() }));
+			output.write_blob(data.data(), data.size());
+		}
+	}
+
+	for (const recorded_event *event : upload_events)
+	{
+		buffer.clear();
+		copy_event(trace_data, *event, buffer);
+		output_index.state_offsets.push_back(output.tell());
+		output.append(buffer);
+	}
+
+	for (const trimmed_event &event : events)
+	{
+		if (event.frame_start)
+			output_index.frame_offsets.push_back(output.tell());
+		if (event.state_event)
+			output_index.state_offsets.push_back(output.tell());
+		output.append(event.data);
+	}
+
+	output_index.frame_offsets.push_back(output.tell());
+	output.write_index(output_index);
+
+	printf("Wrote %" PRIu64 " frames with %zu of %zu live objects to '%s'.\n", frame_count, init_events.size(), state.live_objects.size() + state.swapchains.size(), output_path.c_str());
+
+	return 0;
+}